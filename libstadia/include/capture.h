@@ -0,0 +1,49 @@
+/*
+ * capture.h -- Recording and reading back raw input report streams.
+ *
+ * A capture file starts with the magic "STCP", a version byte and a flags byte. Every record then
+ * holds, in order:
+ *
+ *  - the microseconds elapsed since the previous record (LEB128 varint, 0 for the first one),
+ *  - the report length shifted left by one, the low bit set for a delta record (varint),
+ *  - for a full record, the report bytes,
+ *  - for a delta record, a bitmask of the bytes that differ from the previous report (one bit per
+ *    byte, least significant bit first) followed by the new values of those bytes only.
+ *
+ * Delta records are only written when the capture was opened with delta compression, the report
+ * has the same length as the previous one, and the delta is shorter than the report itself.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+#include "compat.h"
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_FLAG_DELTA 0x01
+
+/*
+ * Longest report a capture can hold. Longer reports are truncated when written.
+ */
+#define CAPTURE_MAX_REPORT_SIZE 256
+
+struct capture_writer;
+struct capture_reader;
+
+struct capture_writer *capture_writer_open(LPTSTR path, BOOL delta);
+BOOL capture_writer_write(struct capture_writer *writer, ULONGLONG timestamp_us, const BYTE *report, size_t length);
+void capture_writer_close(struct capture_writer *writer);
+
+struct capture_reader *capture_reader_open(LPTSTR path);
+
+/*
+ * Reads the next report into buffer, truncated to length bytes. Timestamps count from the first
+ * report of the capture. Returns the full report length, or -1 at the end of the capture or when
+ * it is malformed.
+ */
+INT capture_reader_next(struct capture_reader *reader, ULONGLONG *timestamp_us, BYTE *buffer, size_t length);
+void capture_reader_close(struct capture_reader *reader);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,162 @@
+/*
+ * compat.h -- Win32 base types and primitives for platform-neutral modules.
+ *
+ * On Windows this is just <windows.h>. Elsewhere it provides the subset of the Win32 API the
+ * library relies on (types, TCHAR strings, slim reader/writer locks, interlocked operations and
+ * events), so shared code keeps using the Win32 idioms on both.
+ *
+ * Non-Windows builds must also add the posix/ directory next to this header to the include path,
+ * it provides the structure packing headers the bundled ViGEm headers expect from the Windows SDK.
+ */
+
+#ifndef COMPAT_H
+#define COMPAT_H
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+typedef char CHAR;
+typedef int16_t SHORT;
+typedef int32_t LONG;
+typedef int64_t LONGLONG;
+typedef int INT;
+
+typedef uint8_t BYTE;
+typedef uint8_t UCHAR;
+typedef uint16_t WORD;
+typedef uint16_t USHORT;
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef uint64_t ULONGLONG;
+typedef unsigned int UINT;
+
+typedef int BOOL;
+
+typedef void *LPVOID;
+typedef void *HANDLE;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define VOID void
+// Inlined even without optimizations, like __forceinline.
+#define FORCEINLINE static inline __attribute__((always_inline))
+
+#define RtlZeroMemory(destination, length) memset((destination), 0, (length))
+
+#define _In_
+#define _Out_
+
+/*
+ * TCHAR strings are plain char strings.
+ */
+typedef char TCHAR;
+typedef unsigned char TBYTE;
+typedef char *LPTSTR;
+typedef char *PTCHAR;
+
+#define TEXT(s) s
+#define _tcslen strlen
+#define _tcscpy strcpy
+#define _tcscmp strcmp
+#define _tcsicmp strcasecmp
+#define _tfopen fopen
+
+/*
+ * Slim reader/writer locks.
+ */
+typedef pthread_rwlock_t SRWLOCK;
+
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+
+static inline void InitializeSRWLock(SRWLOCK *lock)
+{
+    pthread_rwlock_init(lock, NULL);
+}
+
+static inline void AcquireSRWLockExclusive(SRWLOCK *lock)
+{
+    pthread_rwlock_wrlock(lock);
+}
+
+static inline void ReleaseSRWLockExclusive(SRWLOCK *lock)
+{
+    pthread_rwlock_unlock(lock);
+}
+
+static inline void AcquireSRWLockShared(SRWLOCK *lock)
+{
+    pthread_rwlock_rdlock(lock);
+}
+
+static inline void ReleaseSRWLockShared(SRWLOCK *lock)
+{
+    pthread_rwlock_unlock(lock);
+}
+
+/*
+ * Interlocked operations, all full barriers.
+ */
+static inline LONG InterlockedIncrement(volatile LONG *addend)
+{
+    return __atomic_add_fetch(addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedDecrement(volatile LONG *addend)
+{
+    return __atomic_sub_fetch(addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedExchangeAdd(volatile LONG *addend, LONG value)
+{
+    return __atomic_fetch_add(addend, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedExchange(volatile LONG *target, LONG value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedCompareExchange(volatile LONG *destination, LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(destination, &comparand, exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+static inline void MemoryBarrier()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Events. Only event handles are supported by WaitForSingleObject and CloseHandle.
+ */
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+
+HANDLE CreateEvent(void *security, BOOL manual_reset, BOOL initial_state, const char *name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+DWORD WaitForSingleObject(HANDLE event, DWORD timeout);
+BOOL CloseHandle(HANDLE event);
+
+ULONGLONG GetTickCount64();
+
+#endif /* _WIN32 */
+
+#endif /* COMPAT_H */
@@ -0,0 +1,66 @@
+/*
+ * device_cache.h -- Persistent memory of how known devices were opened.
+ *
+ * Opening a device the first time may take several attempts (exclusive, after re-enabling it to
+ * evict other readers, shared) plus a round of capability queries. The cache remembers, per device
+ * path, the caps and the open mode that worked, so the next connection goes straight to it. It
+ * also keeps a word of application-defined settings per device.
+ *
+ * The cache file starts with the magic "STDC", a version byte and the size of a TCHAR. Every
+ * record then holds the path length in characters (USHORT), the path, the open mode and the bus
+ * (one byte each), the input, output and feature report sizes (USHORT each) and the settings
+ * (DWORD), in native byte order. Records are kept most recently used first.
+ */
+
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+#include "compat.h"
+#include "hid.h"
+
+#define DEVICE_CACHE_VERSION 2
+
+/*
+ * Oldest entries are forgotten past this many devices.
+ */
+#define DEVICE_CACHE_MAX_ENTRIES 32
+
+#define DEVICE_CACHE_OPEN_EXCLUSIVE 0
+// Exclusive, but only once the device had been re-enabled.
+#define DEVICE_CACHE_OPEN_REENABLED 1
+#define DEVICE_CACHE_OPEN_SHARED 2
+
+struct device_cache;
+
+/*
+ * Never fails: a missing or malformed file yields an empty cache, which is written back to the
+ * same file on the first change. Not thread safe, the cache belongs to whichever thread opens
+ * devices.
+ */
+struct device_cache *device_cache_load(LPTSTR path);
+
+/*
+ * Returns FALSE for a device that has never been stored.
+ */
+BOOL device_cache_lookup(struct device_cache *cache, LPTSTR path, struct hid_caps *caps, UINT *open_mode);
+
+/*
+ * Makes the device the most recently used one and saves the cache if anything changed.
+ */
+void device_cache_store(struct device_cache *cache, LPTSTR path, const struct hid_caps *caps, UINT open_mode);
+
+/*
+ * Settings are 0 for a device that has never been stored or had them set. Setting them for a
+ * device that has never been stored does nothing, and forgetting a device drops them as well.
+ */
+DWORD device_cache_get_settings(struct device_cache *cache, LPTSTR path);
+void device_cache_set_settings(struct device_cache *cache, LPTSTR path, DWORD settings);
+
+/*
+ * Forgets the device, e.g. when the remembered way of opening it stopped working.
+ */
+void device_cache_forget(struct device_cache *cache, LPTSTR path);
+BOOL device_cache_save(struct device_cache *cache);
+void device_cache_free(struct device_cache *cache);
+
+#endif /* DEVICE_CACHE_H */
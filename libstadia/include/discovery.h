@@ -0,0 +1,58 @@
+/*
+ * discovery.h -- Debounced device discovery off the caller's thread.
+ *
+ * Device notifications tend to arrive in bursts (a dock brings several interfaces up at once, and
+ * each one may be reported more than once). They are queued as they come and handled together on
+ * a worker thread once no new one has arrived for the debounce interval, so slow work such as
+ * enumerating, opening or tearing devices down never runs on the thread that received them.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include "compat.h"
+#include "hid.h"
+
+#define DISCOVERY_ARRIVED 1
+#define DISCOVERY_REMOVED 2
+#define DISCOVERY_RESCAN 3
+
+/*
+ * Longest a burst can hold a pass back, in multiples of the debounce interval.
+ */
+#define DISCOVERY_MAX_DEBOUNCE_FACTOR 8
+
+/*
+ * Every callback runs on the worker thread, one pass at a time. Within a pass a path that was
+ * removed and came back is first removed, then arrives, so a re-plugged device is reopened.
+ */
+struct discovery_handler
+{
+    // Lists the devices present, for a rescan. The list is freed by the worker.
+    struct hid_device_info *(*enumerate)(void *context);
+    // Also called for every device a rescan lists, whether it is already tracked or not.
+    void (*arrived)(LPTSTR path, void *context);
+    void (*removed)(LPTSTR path, void *context);
+    // After a rescan, before its arrivals: drops whatever is tracked but not listed.
+    void (*prune)(const struct hid_device_info *present, void *context);
+    // At the end of every pass, e.g. to post the results back to the UI thread. May be NULL.
+    void (*done)(void *context);
+    void *context;
+};
+
+struct discovery;
+
+struct discovery *discovery_create(const struct discovery_handler *handler, DWORD debounce_ms);
+
+/*
+ * Queues an event, from any thread. Path is copied, and ignored for DISCOVERY_RESCAN, whose pass
+ * replaces every arrival queued alongside it; queued removals are still handled first.
+ */
+void discovery_notify(struct discovery *discovery, UINT op, LPTSTR path);
+
+/*
+ * Stops the worker, dropping queued events. A pass in progress is finished first.
+ */
+void discovery_destroy(struct discovery *discovery);
+
+#endif /* DISCOVERY_H */
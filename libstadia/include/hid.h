@@ -1,13 +1,25 @@
 /*
  * hid.h -- Routines for interacting with HID devices.
+ *
+ * Devices are opened through a transport backend: the Win32 HID stack, Linux hidraw nodes, or a
+ * file of recorded input reports. Everything above the backend only sees struct hid_device and
+ * requests completing on an I/O engine.
  */
 
 #ifndef HID_H
 #define HID_H
 
-#include <wtypes.h>
+#include <stddef.h>
+
+#include "compat.h"
+#include "io.h"
+
+#define HID_BUS_UNKNOWN 0x0
+#define HID_BUS_USB 0x1
+#define HID_BUS_BLUETOOTH 0x2
 
 struct hid_device_info;
+struct hid_device;
 
 struct hid_device_info
 {
@@ -17,34 +29,99 @@ struct hid_device_info
     struct hid_device_info *next;
 };
 
+/*
+ * What opening a device learns about it, enough to open it again without asking.
+ */
+struct hid_caps
+{
+    INT bus;
+
+    USHORT input_report_size;
+    USHORT output_report_size;
+    USHORT feature_report_size;
+};
+
+struct hid_backend
+{
+    const char *name;
+
+    // Known caps, when given, are taken as they are instead of being queried from the device.
+    struct hid_device *(*open)(LPTSTR path, BOOL access_rw, BOOL shared, const struct hid_caps *caps);
+
+    // Binds the device to an engine, all further requests complete on its thread.
+    BOOL (*attach)(struct hid_device *device, struct io_engine *engine);
+    void (*detach)(struct hid_device *device);
+
+    // Requests an input report, completing with the number of bytes read.
+    BOOL (*read_async)(struct hid_device *device, struct io_request *request);
+    // Send the request buffer as an output or feature report. The buffer must have room for a full
+    // report of the device's size, backends whose driver expects exactly that size pad it in place.
+    BOOL (*write_output)(struct hid_device *device, struct io_request *request);
+    BOOL (*write_feature)(struct hid_device *device, struct io_request *request);
+    void (*cancel)(struct hid_device *device, struct io_request *request);
+
+    void (*close)(struct hid_device *device);
+};
+
 struct hid_device
 {
-    LPTSTR path;
-    HANDLE handle;
+    const struct hid_backend *backend;
 
-    BOOL read_pending;
-    BOOL write_pending;
+    LPTSTR path;
+    INT bus;
 
     USHORT input_report_size;
     USHORT output_report_size;
     USHORT feature_report_size;
-    BYTE *input_buffer;
-    BYTE *output_buffer;
-    BYTE *feature_buffer;
-
-    OVERLAPPED input_ol;
-    OVERLAPPED output_ol;
 };
 
+#ifdef _WIN32
+extern const struct hid_backend hid_win32_backend;
+
 GUID hid_get_class();
 struct hid_device_info *hid_enumerate(const LPTSTR *path_filters);
 BOOL hid_reenable_device(LPTSTR path);
 BOOL check_vendor_and_product(LPTSTR path, USHORT vendor_id, USHORT product_id);
+#endif /* _WIN32 */
+
+#ifdef __linux__
+extern const struct hid_backend hid_hidraw_backend;
+#endif /* __linux__ */
+
+/*
+ * Opens a capture file (see capture.h) and feeds its reports to reads on their recorded timeline,
+ * then fails the next read once the capture is exhausted, as if the device had been unplugged.
+ * Output and feature reports are accepted and dropped.
+ */
+extern const struct hid_backend hid_replay_backend;
+
+/*
+ * Sets the pace of a replay device: 1 for the original speed (the default), 2 for twice as fast
+ * and so on, 0 to hand out reports as fast as they are read.
+ */
+void hid_replay_set_speed(struct hid_device *device, double speed);
+
+/*
+ * Whether any of the NULL-terminated filters occurs in the path, ignoring case. A NULL filter list
+ * matches everything. Also works on device instance IDs, which only differ from interface paths in
+ * their separators.
+ */
+BOOL hid_match_filters(LPTSTR path, const LPTSTR *path_filters);
 void hid_free_device_info(struct hid_device_info *device_info);
-struct hid_device *hid_open_device(LPTSTR path, BOOL access_rw, BOOL shared);
-INT hid_get_input_report(struct hid_device *device, DWORD timeout);
-INT hid_send_output_report(struct hid_device *device, const void *data, size_t length, DWORD timeout);
-INT hid_send_feature_report(struct hid_device *device, const void *data, size_t length);
+
+/*
+ * Caps remembered from an earlier open of the same path (see hid_get_caps) save querying them
+ * again, otherwise pass NULL.
+ */
+struct hid_device *hid_open_device(const struct hid_backend *backend, LPTSTR path, BOOL access_rw, BOOL shared,
+                                   const struct hid_caps *caps);
+void hid_get_caps(struct hid_device *device, struct hid_caps *caps);
+BOOL hid_attach_device(struct hid_device *device, struct io_engine *engine);
+void hid_detach_device(struct hid_device *device);
+BOOL hid_read_input_report(struct hid_device *device, struct io_request *request);
+BOOL hid_write_output_report(struct hid_device *device, struct io_request *request);
+BOOL hid_write_feature_report(struct hid_device *device, struct io_request *request);
+void hid_cancel_request(struct hid_device *device, struct io_request *request);
 void hid_close_device(struct hid_device *device);
 void hid_free_device(struct hid_device *device);
 
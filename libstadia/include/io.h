@@ -0,0 +1,99 @@
+/*
+ * io.h -- Shared I/O completion engine.
+ *
+ * A single engine thread owns the completions of every attached handle: I/O completion ports on
+ * Windows, epoll elsewhere. Requests are issued from any thread and their completion routines
+ * always run on the engine thread, so per-device state machines need no locking of their own.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include "compat.h"
+
+#ifdef _WIN32
+typedef HANDLE IO_NATIVE_HANDLE;
+#else
+// Any pollable descriptor (hidraw node, pipe, socket...), switched to non-blocking mode on attach.
+typedef int IO_NATIVE_HANDLE;
+#endif /* _WIN32 */
+
+/*
+ * Completion results besides the number of bytes transferred.
+ */
+#define IO_FAILED -1
+#define IO_CANCELLED -2
+
+struct io_engine;
+struct io_request;
+
+typedef void (*io_complete_fn)(struct io_request *request, INT result);
+
+struct io_request
+{
+#ifdef _WIN32
+    OVERLAPPED ol;
+#endif /* _WIN32 */
+
+    io_complete_fn complete;
+    void *context;
+
+    BYTE *buffer;
+    DWORD length;
+
+    // Engine bookkeeping.
+    INT result;
+    ULONGLONG due_us;
+    struct io_request *next;
+};
+
+struct io_handle
+{
+    IO_NATIVE_HANDLE native;
+    struct io_engine *engine;
+
+#ifndef _WIN32
+    // Reads waiting for the descriptor to become readable, oldest first.
+    struct io_request *reads;
+    // No longer watched once epoll reported it hung up or failed.
+    BOOL hung_up;
+#endif /* _WIN32 */
+};
+
+struct io_engine *io_engine_create();
+void io_engine_destroy(struct io_engine *engine);
+BOOL io_engine_is_current(struct io_engine *engine);
+
+/*
+ * Handles must only be detached from the engine thread, once none of their requests are pending.
+ */
+BOOL io_engine_attach(struct io_engine *engine, struct io_handle *handle, IO_NATIVE_HANDLE native);
+void io_engine_detach(struct io_handle *handle);
+
+BOOL io_read(struct io_handle *handle, struct io_request *request);
+BOOL io_write(struct io_handle *handle, struct io_request *request);
+#ifdef _WIN32
+// Issues the request buffer as the input of an overlapped device control.
+BOOL io_control(struct io_handle *handle, DWORD code, struct io_request *request);
+#endif /* _WIN32 */
+
+/*
+ * Cancels a pending request, or all pending requests of the handle when request is NULL. Cancelled
+ * requests complete with IO_CANCELLED.
+ */
+void io_cancel(struct io_handle *handle, struct io_request *request);
+
+/*
+ * Queues a completion for the request on the engine thread. A request must not be posted again
+ * before it has completed.
+ */
+void io_post(struct io_engine *engine, struct io_request *request, INT result);
+
+/*
+ * Completes the request with result 0 on the engine thread once timer_now_us() (see timer.h) has
+ * reached due_us, to within the millisecond resolution of the engine's waits. Only from the engine
+ * thread, and like a posted request it must not be scheduled again before it has completed.
+ */
+void io_schedule(struct io_engine *engine, struct io_request *request, ULONGLONG due_us);
+
+#endif /* IO_H */
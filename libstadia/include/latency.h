@@ -0,0 +1,38 @@
+/*
+ * latency.h -- Lock-free latency histograms.
+ *
+ * Samples are counted in log-linear microsecond buckets: exact below 8 us, then four buckets per
+ * power of two up to about 130 ms, with everything slower in the last bucket. A histogram has a
+ * single writer; readers on other threads may see a sample half-recorded, which only skews a
+ * summary by that one sample.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "compat.h"
+
+#define LATENCY_BUCKET_COUNT 64
+
+struct latency_histogram
+{
+    volatile LONG buckets[LATENCY_BUCKET_COUNT];
+    volatile LONG max_us;
+};
+
+/*
+ * Percentiles are bucket upper bounds, so they may overstate a sample by up to a quarter.
+ */
+struct latency_summary
+{
+    LONG count;
+    LONG p50_us;
+    LONG p99_us;
+    LONG max_us;
+};
+
+void latency_histogram_reset(struct latency_histogram *histogram);
+void latency_histogram_record(struct latency_histogram *histogram, ULONGLONG elapsed_us);
+void latency_histogram_summarize(const struct latency_histogram *histogram, struct latency_summary *summary);
+
+#endif /* LATENCY_H */
@@ -0,0 +1,5 @@
+/*
+ * poppack.h -- Stand-in for the Windows SDK header of the same name on non-Windows builds.
+ */
+
+#pragma pack(pop)
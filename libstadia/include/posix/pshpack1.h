@@ -0,0 +1,5 @@
+/*
+ * pshpack1.h -- Stand-in for the Windows SDK header of the same name on non-Windows builds.
+ */
+
+#pragma pack(push, 1)
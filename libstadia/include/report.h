@@ -0,0 +1,55 @@
+/*
+ * report.h -- Decoding of Stadia controller input reports.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stddef.h>
+
+#include "compat.h"
+
+/*
+ * Stadia controller input report identifier and the number of bytes needed to decode it.
+ */
+#define STADIA_INPUT_REPORT_ID 0x03
+#define STADIA_INPUT_REPORT_MIN_SIZE 10
+
+#define STADIA_BUTTON_NONE 0x00000000
+#define STADIA_BUTTON_A 0x00000001
+#define STADIA_BUTTON_B 0x00000002
+#define STADIA_BUTTON_X 0x00000004
+#define STADIA_BUTTON_Y 0x00000008
+#define STADIA_BUTTON_LB 0x00000010
+#define STADIA_BUTTON_RB 0x00000020
+#define STADIA_BUTTON_LS 0x00000040
+#define STADIA_BUTTON_RS 0x00000080
+#define STADIA_BUTTON_UP 0x00000100
+#define STADIA_BUTTON_DOWN 0x00000200
+#define STADIA_BUTTON_LEFT 0x00000400
+#define STADIA_BUTTON_RIGHT 0x00000800
+#define STADIA_BUTTON_OPTIONS 0x00001000
+#define STADIA_BUTTON_MENU 0x00002000
+#define STADIA_BUTTON_STADIA_BTN 0x00004000
+
+struct stadia_state
+{
+    DWORD buttons;
+
+    BYTE left_stick_x;
+    BYTE left_stick_y;
+
+    BYTE right_stick_x;
+    BYTE right_stick_y;
+
+    BYTE left_trigger;
+    BYTE right_trigger;
+};
+
+/*
+ * Decodes a raw input report into a controller state. Returns FALSE (leaving the state untouched)
+ * when the buffer is too short or does not carry the input report identifier.
+ */
+BOOL stadia_decode_report(const BYTE *buf, size_t len, struct stadia_state *out);
+
+#endif /* REPORT_H */
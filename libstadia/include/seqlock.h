@@ -0,0 +1,37 @@
+/*
+ * seqlock.h -- Sequence locks for a single writer and any number of non-blocking readers.
+ *
+ * The writer makes the sequence odd, writes the data, then makes it even again. Readers copy the
+ * data between seqlock_read_begin and seqlock_read_retry, and copy again for as long as the retry
+ * says a write was in progress or happened meanwhile. Readers never hold up the writer.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include "compat.h"
+
+FORCEINLINE void seqlock_write_begin(volatile LONG *sequence)
+{
+    InterlockedIncrement(sequence);
+}
+
+FORCEINLINE void seqlock_write_end(volatile LONG *sequence)
+{
+    InterlockedIncrement(sequence);
+}
+
+FORCEINLINE LONG seqlock_read_begin(volatile LONG *sequence)
+{
+    LONG begin = *sequence;
+    MemoryBarrier();
+    return begin;
+}
+
+FORCEINLINE BOOL seqlock_read_retry(volatile LONG *sequence, LONG begin)
+{
+    MemoryBarrier();
+    return (begin & 1) != 0 || begin != *sequence;
+}
+
+#endif /* SEQLOCK_H */
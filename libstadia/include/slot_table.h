@@ -0,0 +1,81 @@
+/*
+ * slot_table.h -- Growable table of pointers with stable slots and checked handles.
+ *
+ * An entry keeps its slot for as long as it is in the table; freed slots go to a free list and are
+ * reused before the table grows. Entries are named by handles that carry the slot index along with
+ * the slot's generation, which changes every time the slot is freed, so a handle that outlived its
+ * entry is told apart from the entry now in the same slot. 0 is never a valid handle.
+ *
+ * Not thread safe, callers serialize access with their own lock.
+ */
+
+#ifndef SLOT_TABLE_H
+#define SLOT_TABLE_H
+
+#include "compat.h"
+
+/*
+ * Hard upper bound on the limit of any table, set by the 16 bits a handle has for the slot.
+ */
+#define SLOT_TABLE_MAX_LIMIT 0xFFFF
+
+#define SLOT_TABLE_INVALID_HANDLE 0
+
+/*
+ * Slot of a handle, -1 for the invalid handle. Valid for as long as the entry is in the table.
+ */
+#define SLOT_TABLE_INDEX(handle) ((INT)((handle) & 0xFFFF) - 1)
+
+struct slot_table_entry
+{
+    void *value;
+    USHORT generation;
+    // Next free slot while this one is free, -1 at the end of the list.
+    INT next_free;
+};
+
+struct slot_table
+{
+    struct slot_table_entry *entries;
+    INT capacity;
+    // Slots ever used, every slot past it is free and not on the free list.
+    INT used;
+    INT count;
+    INT limit;
+    INT free_head;
+};
+
+/*
+ * The table starts out with room for initial_capacity entries and grows as needed, up to limit
+ * entries at once (at most SLOT_TABLE_MAX_LIMIT).
+ */
+BOOL slot_table_init(struct slot_table *table, INT initial_capacity, INT limit);
+void slot_table_free(struct slot_table *table);
+
+/*
+ * The value must not be NULL. Returns SLOT_TABLE_INVALID_HANDLE when the table is at its limit or
+ * out of memory.
+ */
+DWORD slot_table_add(struct slot_table *table, void *value);
+
+/*
+ * Both return NULL for a handle whose entry has already been removed.
+ */
+void *slot_table_get(struct slot_table *table, DWORD handle);
+void *slot_table_remove(struct slot_table *table, DWORD handle);
+
+/*
+ * Iteration over the entries, e.g. for (INT i = 0; i < slot_table_end(table); i++), skipping the
+ * free slots, for which slot_table_at returns NULL.
+ */
+FORCEINLINE INT slot_table_end(const struct slot_table *table)
+{
+    return table->used;
+}
+
+FORCEINLINE void *slot_table_at(const struct slot_table *table, INT index)
+{
+    return table->entries[index].value;
+}
+
+#endif /* SLOT_TABLE_H */
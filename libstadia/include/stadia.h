@@ -5,10 +5,15 @@
 #ifndef STADIA_H
 #define STADIA_H
 
-#include <wtypes.h>
+#include "compat.h"
+#include "io.h"
+#include "latency.h"
+#include "report.h"
+
+struct capture_writer;
 
 #define STADIA_ERROR_VIBRATION_INIT_FAILURE 0x1
-#define STADIA_ERROR_THREAD_CREATE_FAILURE 0x2
+#define STADIA_ERROR_IO_FAILURE 0x2
 
 #define STADIA_USB_HW_VENDOR_ID 0x18D1
 #define STADIA_USB_HW_PRODUCT_ID 0x9400
@@ -18,63 +23,201 @@
 #define STADIA_BLT_HW_PRODUCT_ID 0x9400
 #define STADIA_BLT_HW_FILTER TEXT("vid&0218d1_pid&9400")
 
-#define STADIA_BUTTON_NONE 0x00000000
-#define STADIA_BUTTON_A 0x00000001
-#define STADIA_BUTTON_B 0x00000002
-#define STADIA_BUTTON_X 0x00000004
-#define STADIA_BUTTON_Y 0x00000008
-#define STADIA_BUTTON_LB 0x00000010
-#define STADIA_BUTTON_RB 0x00000020
-#define STADIA_BUTTON_LS 0x00000040
-#define STADIA_BUTTON_RS 0x00000080
-#define STADIA_BUTTON_UP 0x00000100
-#define STADIA_BUTTON_DOWN 0x00000200
-#define STADIA_BUTTON_LEFT 0x00000400
-#define STADIA_BUTTON_RIGHT 0x00000800
-#define STADIA_BUTTON_OPTIONS 0x00001000
-#define STADIA_BUTTON_MENU 0x00002000
-#define STADIA_BUTTON_STADIA_BTN 0x00004000
-
-struct stadia_state
+/*
+ * Number of input reads kept in flight per controller, so reports never wait for a re-arm.
+ */
+#define STADIA_READ_QUEUE_DEPTH 4
+
+#define STADIA_VIBRATION_REPORT_SIZE 5
+
+/*
+ * Number of vibration reports that may be in flight at once. Past that, newer values wait for a
+ * completion, so a stalled Bluetooth stack holds back at most this many stale reports.
+ */
+#define STADIA_WRITE_QUEUE_DEPTH 2
+
+/*
+ * Default shortest interval between two vibration reports, in milliseconds. Feature reports over
+ * Bluetooth make a full round trip to the pad, so they are spaced further apart.
+ */
+#define STADIA_USB_VIBRATION_INTERVAL 8
+#define STADIA_BLT_VIBRATION_INTERVAL 20
+
+/*
+ * Interval between two calls of the stats callback while reports are flowing, in milliseconds.
+ */
+#define STADIA_STATS_INTERVAL 10000
+
+/*
+ * Input latency stages, all measured from the completion of the read that carried the report:
+ *  - decode: until the report has been decoded into controller state,
+ *  - dispatch: until the consumer starts submitting it to its target,
+ *  - submit: the submission itself,
+ *  - total: until the submission has returned.
+ * The last three are only known when the consumer reports them with stadia_controller_record_submit
+ * or stadia_controller_record_submit_at.
+ */
+struct stadia_latency
 {
-    DWORD buttons;
+    struct latency_histogram decode;
+    struct latency_histogram dispatch;
+    struct latency_histogram submit;
+    struct latency_histogram total;
+};
 
-    BYTE left_stick_x;
-    BYTE left_stick_y;
+struct stadia_latency_summary
+{
+    struct latency_summary decode;
+    struct latency_summary dispatch;
+    struct latency_summary submit;
+    struct latency_summary total;
+};
 
-    BYTE right_stick_x;
-    BYTE right_stick_y;
+struct stadia_controller;
 
-    BYTE left_trigger;
-    BYTE right_trigger;
+/*
+ * A consumer of one controller's input. Every callback is optional and runs on the engine thread;
+ * all subscribers of a controller are handed the same report buffer and decoded state, so neither is
+ * copied per subscriber. Reports are only decoded while at least one subscriber takes updates.
+ *
+ * The callbacks may be swapped from the engine thread while subscribed, e.g. from a request posted
+ * with io_post; a report then reaches either the old or the new one.
+ * The subscriber belongs to the controller from subscribing until its destroy callback, which runs
+ * exactly once, when the controller stops or the subscription is removed. It can be freed from there.
+ */
+struct stadia_subscriber
+{
+    void (*update)(struct stadia_controller *controller, const struct stadia_state *state, void *context);
+    void (*report)(struct stadia_controller *controller, const BYTE *report, size_t length, void *context);
+    // Called every STADIA_STATS_INTERVAL while reports are flowing, e.g. to dump the statistics.
+    void (*stats)(struct stadia_controller *controller, void *context);
+    void (*destroy)(struct stadia_controller *controller, void *context);
+    void *context;
+
+    // Owned by the controller.
+    struct stadia_controller *controller;
+    struct io_request subscribe_request;
+    struct io_request unsubscribe_request;
+    struct stadia_subscriber *next;
 };
 
 struct stadia_controller
 {
     struct hid_device *device;
+    struct io_engine *engine;
 
     BOOL bluetooth;
 
-    SRWLOCK state_lock;
+    // Published with a sequence lock (see seqlock.h), the engine thread being the writer.
+    volatile LONG state_sequence;
     struct stadia_state state;
 
-    BOOL active;
-    HANDLE stopping_event;
-    HANDLE output_event;
+    // Only touched from the engine thread.
+    struct stadia_subscriber *subscribers;
+    BOOL stopping;
+    BOOL stopped;
+    INT pending;
+    INT write_free[STADIA_WRITE_QUEUE_DEPTH];
+    INT write_free_count;
+    BOOL vibration_dirty;
+    ULONGLONG report_window_start;
+    LONG report_window_count;
+    ULONGLONG stats_window_start;
+    ULONGLONG report_time_us;
+    ULONGLONG vibration_sent_us;
+    BOOL vibration_scheduled;
+
+    BYTE *read_buffers;
+    struct io_request read_requests[STADIA_READ_QUEUE_DEPTH];
+    BYTE *write_buffers;
+    struct io_request write_requests[STADIA_WRITE_QUEUE_DEPTH];
+    struct io_request vibration_request;
+    struct io_request vibration_timer;
+    struct io_request stop_request;
+
+    LONG vibration_queued;
+    LONG stop_queued;
+    LONG refs;
+    HANDLE stopped_event;
+
+    LONG reports_handled;
+    LONG reports_per_second;
+    struct stadia_latency latency;
+
+    SRWLOCK capture_lock;
+    struct capture_writer *capture;
 
     SRWLOCK vibration_lock;
     BYTE small_motor;
     BYTE big_motor;
-
-    HANDLE input_thread;
-    HANDLE output_thread;
+    BOOL vibration_unsent;
+    volatile LONG vibration_interval;
+    volatile LONG vibrations_sent;
+    volatile LONG vibrations_dropped;
 };
 
-void (*stadia_update_callback)(struct stadia_controller *, struct stadia_state *);
-void (*stadia_destroy_callback)(struct stadia_controller *);
+/*
+ * Controllers are driven by the given engine: callbacks run on its thread, and destroying a
+ * controller from any other thread waits until the destroy callbacks have run. The given subscriber,
+ * if any, is in place before the first report; callbacks may run before create returns.
+ *
+ * The returned controller comes with a reference owned by the caller, which keeps its memory valid
+ * even once it has stopped on its own. Release it when done, after destroying the controller.
+ */
+struct stadia_controller *stadia_controller_create(struct io_engine *engine, struct hid_device *device,
+                                                   struct stadia_subscriber *subscriber);
+
+/*
+ * Both take effect asynchronously on the engine thread, in call order. Subscribing to a controller
+ * that has already stopped calls the destroy callback right away.
+ */
+void stadia_controller_subscribe(struct stadia_controller *controller, struct stadia_subscriber *subscriber);
+void stadia_controller_unsubscribe(struct stadia_controller *controller, struct stadia_subscriber *subscriber);
+
+/*
+ * Additional references, e.g. to destroy the controller from another thread while it may stop on
+ * its own. A controller that has stopped still accepts every call, they do nothing.
+ */
+void stadia_controller_retain(struct stadia_controller *controller);
+void stadia_controller_release(struct stadia_controller *controller);
+LONG stadia_controller_get_report_rate(struct stadia_controller *controller);
+
+/*
+ * Copies the latest decoded state. Never blocks the input path, a read that overlaps an update is
+ * simply retried.
+ */
+void stadia_controller_get_state(struct stadia_controller *controller, struct stadia_state *state);
 
-struct stadia_controller *stadia_controller_create(struct hid_device *device);
+/*
+ * Completion time (see timer.h) of the report being handled. Only meaningful from the update and
+ * report callbacks, which can then time their own work against it.
+ */
+ULONGLONG stadia_controller_get_report_time(struct stadia_controller *controller);
+void stadia_controller_record_submit(struct stadia_controller *controller, ULONGLONG start_us, ULONGLONG end_us);
+
+/*
+ * Records the submission of an earlier report, for consumers that submit after the callbacks have
+ * returned and so keep the report time (see stadia_controller_get_report_time) themselves. Only
+ * from the engine thread.
+ */
+void stadia_controller_record_submit_at(struct stadia_controller *controller, ULONGLONG report_time_us,
+                                        ULONGLONG start_us, ULONGLONG end_us);
+void stadia_controller_get_latency(struct stadia_controller *controller, struct stadia_latency_summary *summary);
+void stadia_controller_reset_latency(struct stadia_controller *controller);
+
+/*
+ * Records every input report to the given capture, or stops recording when capture is NULL. Once
+ * this returns, the previous capture is no longer written to and can be closed.
+ */
+void stadia_controller_set_capture(struct stadia_controller *controller, struct capture_writer *capture);
+
+/*
+ * Vibration is last value wins: only the newest motor values are ever sent, at most once per
+ * vibration interval, and values superseded before they went out are counted as dropped.
+ */
 void stadia_controller_set_vibration(struct stadia_controller *controller, BYTE small_motor, BYTE big_motor);
+void stadia_controller_set_vibration_interval(struct stadia_controller *controller, DWORD interval_ms);
+void stadia_controller_get_vibration_stats(struct stadia_controller *controller, LONG *sent, LONG *dropped);
 void stadia_controller_destroy(struct stadia_controller *controller);
 
 #endif // STADIA_H
\ No newline at end of file
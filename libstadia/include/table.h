@@ -0,0 +1,17 @@
+/*
+ * table.h -- Compile-time generation of 256-entry lookup tables.
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+/*
+ * Expands to the initializer list f(0), f(1), ..., f(255). The generator must be a constant
+ * expression macro so the table ends up in read-only data with no runtime initialization.
+ */
+#define TABLE_4(f, n) f(n), f((n) + 1), f((n) + 2), f((n) + 3)
+#define TABLE_16(f, n) TABLE_4(f, n), TABLE_4(f, (n) + 4), TABLE_4(f, (n) + 8), TABLE_4(f, (n) + 12)
+#define TABLE_64(f, n) TABLE_16(f, n), TABLE_16(f, (n) + 16), TABLE_16(f, (n) + 32), TABLE_16(f, (n) + 48)
+#define TABLE_256(f) TABLE_64(f, 0), TABLE_64(f, 64), TABLE_64(f, 128), TABLE_64(f, 192)
+
+#endif /* TABLE_H */
@@ -0,0 +1,15 @@
+/*
+ * timer.h -- High resolution monotonic clock.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "compat.h"
+
+/*
+ * Microseconds since an arbitrary fixed point, never going backwards.
+ */
+ULONGLONG timer_now_us();
+
+#endif /* TIMER_H */
@@ -5,7 +5,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <wtypes.h>
+#include "compat.h"
 
 PTCHAR _tcsistr(PTCHAR haystack, const PTCHAR needle);
 
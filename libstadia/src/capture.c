@@ -0,0 +1,247 @@
+/*
+ * capture.c -- Recording and reading back raw input report streams.
+ */
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif /* _WIN32 */
+
+static const BYTE capture_magic[4] = {'S', 'T', 'C', 'P'};
+
+#define CAPTURE_MASK_SIZE(length) (((length) + 7) / 8)
+
+struct capture_writer
+{
+    FILE *file;
+    BOOL delta;
+
+    ULONGLONG last_timestamp_us;
+    BOOL started;
+
+    BYTE previous[CAPTURE_MAX_REPORT_SIZE];
+    size_t previous_length;
+};
+
+struct capture_reader
+{
+    FILE *file;
+
+    ULONGLONG timestamp_us;
+
+    BYTE previous[CAPTURE_MAX_REPORT_SIZE];
+    size_t previous_length;
+};
+
+static size_t _capture_put_varint(BYTE *out, ULONGLONG value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80)
+    {
+        out[length++] = (BYTE)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (BYTE)value;
+
+    return length;
+}
+
+static BOOL _capture_get_varint(FILE *file, ULONGLONG *value)
+{
+    *value = 0;
+
+    for (INT shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(file);
+        if (c == EOF)
+        {
+            return FALSE;
+        }
+
+        *value |= (ULONGLONG)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+struct capture_writer *capture_writer_open(LPTSTR path, BOOL delta)
+{
+    FILE *file = _tfopen(path, TEXT("wb"));
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    BYTE header[6] = {capture_magic[0], capture_magic[1], capture_magic[2], capture_magic[3],
+                      CAPTURE_VERSION, delta ? CAPTURE_FLAG_DELTA : 0};
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    struct capture_writer *writer = (struct capture_writer *)malloc(sizeof(struct capture_writer));
+    writer->file = file;
+    writer->delta = delta;
+    writer->last_timestamp_us = 0;
+    writer->started = FALSE;
+    writer->previous_length = 0;
+
+    return writer;
+}
+
+BOOL capture_writer_write(struct capture_writer *writer, ULONGLONG timestamp_us, const BYTE *report, size_t length)
+{
+    // Room for both varints, the mask and the report bytes.
+    BYTE record[2 * 10 + CAPTURE_MASK_SIZE(CAPTURE_MAX_REPORT_SIZE) + CAPTURE_MAX_REPORT_SIZE];
+    size_t record_length = 0;
+
+    if (length > CAPTURE_MAX_REPORT_SIZE)
+    {
+        length = CAPTURE_MAX_REPORT_SIZE;
+    }
+
+    ULONGLONG elapsed = writer->started && timestamp_us > writer->last_timestamp_us
+                            ? timestamp_us - writer->last_timestamp_us
+                            : 0;
+    record_length += _capture_put_varint(&record[record_length], elapsed);
+
+    BOOL use_delta = FALSE;
+    BYTE mask[CAPTURE_MASK_SIZE(CAPTURE_MAX_REPORT_SIZE)];
+    size_t changed = 0;
+    if (writer->delta && writer->started && length == writer->previous_length)
+    {
+        memset(mask, 0, CAPTURE_MASK_SIZE(length));
+        for (size_t i = 0; i < length; i++)
+        {
+            if (report[i] != writer->previous[i])
+            {
+                mask[i / 8] |= 1 << (i % 8);
+                changed++;
+            }
+        }
+        use_delta = CAPTURE_MASK_SIZE(length) + changed < length;
+    }
+
+    record_length += _capture_put_varint(&record[record_length], ((ULONGLONG)length << 1) | (use_delta ? 1 : 0));
+    if (use_delta)
+    {
+        memcpy(&record[record_length], mask, CAPTURE_MASK_SIZE(length));
+        record_length += CAPTURE_MASK_SIZE(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            if (mask[i / 8] & (1 << (i % 8)))
+            {
+                record[record_length++] = report[i];
+            }
+        }
+    }
+    else
+    {
+        memcpy(&record[record_length], report, length);
+        record_length += length;
+    }
+
+    writer->last_timestamp_us = timestamp_us;
+    writer->started = TRUE;
+    memcpy(writer->previous, report, length);
+    writer->previous_length = length;
+
+    return fwrite(record, 1, record_length, writer->file) == record_length;
+}
+
+void capture_writer_close(struct capture_writer *writer)
+{
+    fclose(writer->file);
+    free(writer);
+}
+
+struct capture_reader *capture_reader_open(LPTSTR path)
+{
+    FILE *file = _tfopen(path, TEXT("rb"));
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    BYTE header[6];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, capture_magic, sizeof(capture_magic)) != 0 || header[4] != CAPTURE_VERSION)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    struct capture_reader *reader = (struct capture_reader *)malloc(sizeof(struct capture_reader));
+    reader->file = file;
+    reader->timestamp_us = 0;
+    reader->previous_length = 0;
+
+    return reader;
+}
+
+INT capture_reader_next(struct capture_reader *reader, ULONGLONG *timestamp_us, BYTE *buffer, size_t length)
+{
+    ULONGLONG elapsed, header;
+
+    if (!_capture_get_varint(reader->file, &elapsed) || !_capture_get_varint(reader->file, &header))
+    {
+        return -1;
+    }
+
+    size_t report_length = (size_t)(header >> 1);
+    if (report_length > CAPTURE_MAX_REPORT_SIZE)
+    {
+        return -1;
+    }
+
+    if (header & 1)
+    {
+        BYTE mask[CAPTURE_MASK_SIZE(CAPTURE_MAX_REPORT_SIZE)];
+
+        if (report_length != reader->previous_length ||
+            fread(mask, 1, CAPTURE_MASK_SIZE(report_length), reader->file) != CAPTURE_MASK_SIZE(report_length))
+        {
+            return -1;
+        }
+        for (size_t i = 0; i < report_length; i++)
+        {
+            if (mask[i / 8] & (1 << (i % 8)))
+            {
+                int c = fgetc(reader->file);
+                if (c == EOF)
+                {
+                    return -1;
+                }
+                reader->previous[i] = (BYTE)c;
+            }
+        }
+    }
+    else if (fread(reader->previous, 1, report_length, reader->file) != report_length)
+    {
+        return -1;
+    }
+    reader->previous_length = report_length;
+
+    reader->timestamp_us += elapsed;
+    *timestamp_us = reader->timestamp_us;
+    memcpy(buffer, reader->previous, report_length < length ? report_length : length);
+
+    return (INT)report_length;
+}
+
+void capture_reader_close(struct capture_reader *reader)
+{
+    fclose(reader->file);
+    free(reader);
+}
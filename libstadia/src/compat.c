@@ -0,0 +1,136 @@
+/*
+ * compat.c -- Win32 primitives for platform-neutral modules.
+ */
+
+#include "compat.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct compat_event
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    BOOL manual_reset;
+    BOOL signaled;
+};
+
+HANDLE CreateEvent(void *security, BOOL manual_reset, BOOL initial_state, const char *name)
+{
+    struct compat_event *event = (struct compat_event *)malloc(sizeof(struct compat_event));
+    (void)security;
+    (void)name;
+
+    if (event == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&event->lock, NULL);
+    pthread_cond_init(&event->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    event->manual_reset = manual_reset;
+    event->signaled = initial_state;
+
+    return event;
+}
+
+BOOL SetEvent(HANDLE handle)
+{
+    struct compat_event *event = (struct compat_event *)handle;
+
+    pthread_mutex_lock(&event->lock);
+    event->signaled = TRUE;
+    if (event->manual_reset)
+    {
+        pthread_cond_broadcast(&event->cond);
+    }
+    else
+    {
+        pthread_cond_signal(&event->cond);
+    }
+    pthread_mutex_unlock(&event->lock);
+
+    return TRUE;
+}
+
+BOOL ResetEvent(HANDLE handle)
+{
+    struct compat_event *event = (struct compat_event *)handle;
+
+    pthread_mutex_lock(&event->lock);
+    event->signaled = FALSE;
+    pthread_mutex_unlock(&event->lock);
+
+    return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD timeout)
+{
+    struct compat_event *event = (struct compat_event *)handle;
+    struct timespec deadline;
+    DWORD result = WAIT_OBJECT_0;
+
+    if (timeout != INFINITE)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&event->lock);
+    while (!event->signaled)
+    {
+        if (timeout == INFINITE)
+        {
+            pthread_cond_wait(&event->cond, &event->lock);
+        }
+        else if (pthread_cond_timedwait(&event->cond, &event->lock, &deadline) == ETIMEDOUT)
+        {
+            result = WAIT_TIMEOUT;
+            break;
+        }
+    }
+    if (result == WAIT_OBJECT_0 && !event->manual_reset)
+    {
+        event->signaled = FALSE;
+    }
+    pthread_mutex_unlock(&event->lock);
+
+    return result;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+    struct compat_event *event = (struct compat_event *)handle;
+
+    pthread_cond_destroy(&event->cond);
+    pthread_mutex_destroy(&event->lock);
+    free(event);
+
+    return TRUE;
+}
+
+ULONGLONG GetTickCount64()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 1000 + (ULONGLONG)now.tv_nsec / 1000000;
+}
+
+#endif /* _WIN32 */
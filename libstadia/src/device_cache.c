@@ -0,0 +1,238 @@
+/*
+ * device_cache.c -- Persistent memory of how known devices were opened.
+ */
+
+#include "device_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif /* _WIN32 */
+
+static const BYTE device_cache_magic[4] = {'S', 'T', 'D', 'C'};
+
+struct device_cache_entry
+{
+    LPTSTR path;
+    struct hid_caps caps;
+    UINT open_mode;
+    DWORD settings;
+};
+
+struct device_cache
+{
+    LPTSTR file;
+
+    // Most recently used first.
+    struct device_cache_entry entries[DEVICE_CACHE_MAX_ENTRIES];
+    INT count;
+};
+
+static INT _device_cache_find(struct device_cache *cache, LPTSTR path)
+{
+    for (INT i = 0; i < cache->count; i++)
+    {
+        if (_tcsicmp(cache->entries[i].path, path) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static BOOL _device_cache_same_caps(const struct hid_caps *a, const struct hid_caps *b)
+{
+    return a->bus == b->bus && a->input_report_size == b->input_report_size &&
+           a->output_report_size == b->output_report_size && a->feature_report_size == b->feature_report_size;
+}
+
+static void _device_cache_remove(struct device_cache *cache, INT index)
+{
+    free(cache->entries[index].path);
+    memmove(&cache->entries[index], &cache->entries[index + 1],
+            (cache->count - index - 1) * sizeof(struct device_cache_entry));
+    cache->count--;
+}
+
+static BOOL _device_cache_read_entry(FILE *file, struct device_cache_entry *entry)
+{
+    USHORT path_length;
+    if (fread(&path_length, sizeof(path_length), 1, file) != 1 || path_length == 0)
+    {
+        return FALSE;
+    }
+
+    LPTSTR path = (LPTSTR)malloc((path_length + 1) * sizeof(TCHAR));
+    BYTE mode_bus[2];
+    USHORT sizes[3];
+    DWORD settings;
+    if (fread(path, sizeof(TCHAR), path_length, file) != path_length ||
+        fread(mode_bus, 1, sizeof(mode_bus), file) != sizeof(mode_bus) ||
+        fread(sizes, sizeof(USHORT), 3, file) != 3 || fread(&settings, sizeof(settings), 1, file) != 1 ||
+        mode_bus[0] > DEVICE_CACHE_OPEN_SHARED)
+    {
+        free(path);
+        return FALSE;
+    }
+    path[path_length] = 0;
+
+    entry->path = path;
+    entry->open_mode = mode_bus[0];
+    entry->caps.bus = mode_bus[1];
+    entry->caps.input_report_size = sizes[0];
+    entry->caps.output_report_size = sizes[1];
+    entry->caps.feature_report_size = sizes[2];
+    entry->settings = settings;
+    return TRUE;
+}
+
+struct device_cache *device_cache_load(LPTSTR path)
+{
+    struct device_cache *cache = (struct device_cache *)malloc(sizeof(struct device_cache));
+    cache->file = (LPTSTR)malloc((_tcslen(path) + 1) * sizeof(TCHAR));
+    _tcscpy(cache->file, path);
+    cache->count = 0;
+
+    FILE *file = _tfopen(path, TEXT("rb"));
+    if (file == NULL)
+    {
+        return cache;
+    }
+
+    BYTE header[6];
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) &&
+        memcmp(header, device_cache_magic, sizeof(device_cache_magic)) == 0 &&
+        header[4] == DEVICE_CACHE_VERSION && header[5] == sizeof(TCHAR))
+    {
+        // A truncated record drops itself and whatever follows, not the records before it.
+        while (cache->count < DEVICE_CACHE_MAX_ENTRIES &&
+               _device_cache_read_entry(file, &cache->entries[cache->count]))
+        {
+            cache->count++;
+        }
+    }
+
+    fclose(file);
+    return cache;
+}
+
+BOOL device_cache_lookup(struct device_cache *cache, LPTSTR path, struct hid_caps *caps, UINT *open_mode)
+{
+    INT i = _device_cache_find(cache, path);
+    if (i < 0)
+    {
+        return FALSE;
+    }
+
+    *caps = cache->entries[i].caps;
+    *open_mode = cache->entries[i].open_mode;
+    return TRUE;
+}
+
+void device_cache_store(struct device_cache *cache, LPTSTR path, const struct hid_caps *caps, UINT open_mode)
+{
+    struct device_cache_entry entry;
+
+    INT i = _device_cache_find(cache, path);
+    if (i == 0 && cache->entries[0].open_mode == open_mode && _device_cache_same_caps(&cache->entries[0].caps, caps))
+    {
+        return;
+    }
+
+    if (i >= 0)
+    {
+        entry = cache->entries[i];
+        memmove(&cache->entries[1], &cache->entries[0], i * sizeof(struct device_cache_entry));
+    }
+    else
+    {
+        if (cache->count == DEVICE_CACHE_MAX_ENTRIES)
+        {
+            _device_cache_remove(cache, cache->count - 1);
+        }
+        entry.path = (LPTSTR)malloc((_tcslen(path) + 1) * sizeof(TCHAR));
+        _tcscpy(entry.path, path);
+        entry.settings = 0;
+        memmove(&cache->entries[1], &cache->entries[0], cache->count * sizeof(struct device_cache_entry));
+        cache->count++;
+    }
+
+    entry.caps = *caps;
+    entry.open_mode = open_mode;
+    cache->entries[0] = entry;
+
+    device_cache_save(cache);
+}
+
+DWORD device_cache_get_settings(struct device_cache *cache, LPTSTR path)
+{
+    INT i = _device_cache_find(cache, path);
+    return i >= 0 ? cache->entries[i].settings : 0;
+}
+
+void device_cache_set_settings(struct device_cache *cache, LPTSTR path, DWORD settings)
+{
+    INT i = _device_cache_find(cache, path);
+    if (i >= 0 && cache->entries[i].settings != settings)
+    {
+        cache->entries[i].settings = settings;
+        device_cache_save(cache);
+    }
+}
+
+void device_cache_forget(struct device_cache *cache, LPTSTR path)
+{
+    INT i = _device_cache_find(cache, path);
+    if (i >= 0)
+    {
+        _device_cache_remove(cache, i);
+        device_cache_save(cache);
+    }
+}
+
+BOOL device_cache_save(struct device_cache *cache)
+{
+    FILE *file = _tfopen(cache->file, TEXT("wb"));
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+
+    BYTE header[6] = {device_cache_magic[0], device_cache_magic[1], device_cache_magic[2], device_cache_magic[3],
+                      DEVICE_CACHE_VERSION, sizeof(TCHAR)};
+    BOOL success = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    for (INT i = 0; success && i < cache->count; i++)
+    {
+        struct device_cache_entry *entry = &cache->entries[i];
+        USHORT path_length = (USHORT)_tcslen(entry->path);
+        BYTE mode_bus[2] = {(BYTE)entry->open_mode, (BYTE)entry->caps.bus};
+        USHORT sizes[3] = {entry->caps.input_report_size, entry->caps.output_report_size,
+                           entry->caps.feature_report_size};
+
+        success = fwrite(&path_length, sizeof(path_length), 1, file) == 1 &&
+                  fwrite(entry->path, sizeof(TCHAR), path_length, file) == path_length &&
+                  fwrite(mode_bus, 1, sizeof(mode_bus), file) == sizeof(mode_bus) &&
+                  fwrite(sizes, sizeof(USHORT), 3, file) == 3 &&
+                  fwrite(&entry->settings, sizeof(entry->settings), 1, file) == 1;
+    }
+
+    if (fclose(file) != 0)
+    {
+        success = FALSE;
+    }
+    return success;
+}
+
+void device_cache_free(struct device_cache *cache)
+{
+    for (INT i = 0; i < cache->count; i++)
+    {
+        free(cache->entries[i].path);
+    }
+    free(cache->file);
+    free(cache);
+}
@@ -0,0 +1,271 @@
+/*
+ * discovery.c -- Debounced device discovery off the caller's thread.
+ */
+
+#include "discovery.h"
+
+#include "timer.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+#else
+#include <pthread.h>
+#endif /* _WIN32 */
+
+/*
+ * Everything queued for one path since the last pass.
+ */
+struct discovery_event
+{
+    LPTSTR path;
+    BOOL removed;
+    BOOL present;
+
+    struct discovery_event *next;
+};
+
+struct discovery
+{
+    struct discovery_handler handler;
+    DWORD debounce_ms;
+
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif /* _WIN32 */
+    HANDLE wake_event;
+
+    // Queued events, oldest first, the time of the first and last one, and the worker's stop request.
+    SRWLOCK lock;
+    struct discovery_event *events;
+    BOOL rescan;
+    BOOL queued;
+    ULONGLONG first_us;
+    ULONGLONG last_us;
+    BOOL closing;
+};
+
+static void _discovery_free_events(struct discovery_event *events)
+{
+    while (events != NULL)
+    {
+        struct discovery_event *next = events->next;
+        free(events->path);
+        free(events);
+        events = next;
+    }
+}
+
+static void _discovery_pass(struct discovery *discovery, struct discovery_event *events, BOOL rescan)
+{
+    const struct discovery_handler *handler = &discovery->handler;
+    struct discovery_event *event;
+
+    for (event = events; event != NULL; event = event->next)
+    {
+        if (event->removed)
+        {
+            handler->removed(event->path, handler->context);
+        }
+    }
+
+    if (rescan)
+    {
+        struct hid_device_info *present = handler->enumerate(handler->context);
+
+        handler->prune(present, handler->context);
+        for (struct hid_device_info *cur = present; cur != NULL; cur = cur->next)
+        {
+            handler->arrived(cur->path, handler->context);
+        }
+
+        while (present != NULL)
+        {
+            struct hid_device_info *next = present->next;
+            hid_free_device_info(present);
+            present = next;
+        }
+    }
+    else
+    {
+        for (event = events; event != NULL; event = event->next)
+        {
+            if (event->present)
+            {
+                handler->arrived(event->path, handler->context);
+            }
+        }
+    }
+
+    if (handler->done != NULL)
+    {
+        handler->done(handler->context);
+    }
+}
+
+static void _discovery_run(struct discovery *discovery)
+{
+    ULONGLONG debounce_us = discovery->debounce_ms * 1000ULL;
+
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&discovery->lock);
+        BOOL closing = discovery->closing;
+        BOOL queued = discovery->queued;
+        ULONGLONG now_us = timer_now_us();
+
+        // Due once the burst has gone quiet, or has been going on for too long.
+        ULONGLONG due_us = discovery->last_us + debounce_us;
+        ULONGLONG limit_us = discovery->first_us + DISCOVERY_MAX_DEBOUNCE_FACTOR * debounce_us;
+        if (due_us > limit_us)
+        {
+            due_us = limit_us;
+        }
+
+        struct discovery_event *events = NULL;
+        BOOL rescan = FALSE;
+        if (queued && now_us >= due_us)
+        {
+            events = discovery->events;
+            rescan = discovery->rescan;
+            discovery->events = NULL;
+            discovery->rescan = FALSE;
+            discovery->queued = FALSE;
+        }
+        ReleaseSRWLockExclusive(&discovery->lock);
+
+        if (closing)
+        {
+            _discovery_free_events(events);
+            break;
+        }
+        if (!queued)
+        {
+            WaitForSingleObject(discovery->wake_event, INFINITE);
+            continue;
+        }
+        if (now_us < due_us)
+        {
+            WaitForSingleObject(discovery->wake_event, (DWORD)((due_us - now_us + 999) / 1000));
+            continue;
+        }
+
+        _discovery_pass(discovery, events, rescan);
+        _discovery_free_events(events);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _discovery_thread(LPVOID lparam)
+{
+    _discovery_run((struct discovery *)lparam);
+    return 0;
+}
+#else
+static void *_discovery_thread(void *arg)
+{
+    _discovery_run((struct discovery *)arg);
+    return NULL;
+}
+#endif /* _WIN32 */
+
+struct discovery *discovery_create(const struct discovery_handler *handler, DWORD debounce_ms)
+{
+    struct discovery *discovery = (struct discovery *)malloc(sizeof(struct discovery));
+    discovery->handler = *handler;
+    discovery->debounce_ms = debounce_ms;
+    discovery->events = NULL;
+    discovery->rescan = FALSE;
+    discovery->queued = FALSE;
+    discovery->first_us = 0;
+    discovery->last_us = 0;
+    discovery->closing = FALSE;
+    InitializeSRWLock(&discovery->lock);
+
+    discovery->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (discovery->wake_event == NULL)
+    {
+        free(discovery);
+        return NULL;
+    }
+
+#ifdef _WIN32
+    discovery->thread = CreateThread(NULL, 0, _discovery_thread, discovery, 0, NULL);
+    if (discovery->thread == NULL)
+#else
+    if (pthread_create(&discovery->thread, NULL, _discovery_thread, discovery) != 0)
+#endif /* _WIN32 */
+    {
+        CloseHandle(discovery->wake_event);
+        free(discovery);
+        return NULL;
+    }
+
+    return discovery;
+}
+
+void discovery_notify(struct discovery *discovery, UINT op, LPTSTR path)
+{
+    AcquireSRWLockExclusive(&discovery->lock);
+
+    if (op == DISCOVERY_RESCAN)
+    {
+        discovery->rescan = TRUE;
+    }
+    else
+    {
+        struct discovery_event **cur = &discovery->events;
+        while (*cur != NULL && _tcsicmp((*cur)->path, path) != 0)
+        {
+            cur = &(*cur)->next;
+        }
+        if (*cur == NULL)
+        {
+            struct discovery_event *event = (struct discovery_event *)malloc(sizeof(struct discovery_event));
+            event->path = (LPTSTR)malloc((_tcslen(path) + 1) * sizeof(TCHAR));
+            _tcscpy(event->path, path);
+            event->removed = FALSE;
+            event->present = FALSE;
+            event->next = NULL;
+            *cur = event;
+        }
+
+        // A removal sticks for the pass, only the last word decides whether the path is present.
+        (*cur)->removed |= op == DISCOVERY_REMOVED;
+        (*cur)->present = op == DISCOVERY_ARRIVED;
+    }
+
+    ULONGLONG now_us = timer_now_us();
+    if (!discovery->queued)
+    {
+        discovery->queued = TRUE;
+        discovery->first_us = now_us;
+    }
+    discovery->last_us = now_us;
+
+    ReleaseSRWLockExclusive(&discovery->lock);
+
+    SetEvent(discovery->wake_event);
+}
+
+void discovery_destroy(struct discovery *discovery)
+{
+    AcquireSRWLockExclusive(&discovery->lock);
+    discovery->closing = TRUE;
+    ReleaseSRWLockExclusive(&discovery->lock);
+    SetEvent(discovery->wake_event);
+
+#ifdef _WIN32
+    WaitForSingleObject(discovery->thread, INFINITE);
+    CloseHandle(discovery->thread);
+#else
+    pthread_join(discovery->thread, NULL);
+#endif /* _WIN32 */
+
+    _discovery_free_events(discovery->events);
+    CloseHandle(discovery->wake_event);
+    free(discovery);
+}
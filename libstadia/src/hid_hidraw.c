@@ -0,0 +1,324 @@
+/*
+ * hid_hidraw.c -- HID transport over Linux hidraw nodes.
+ */
+
+#include "hid.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/*
+ * hidraw hands out whole reports (prefixed with their identifier when the device numbers them)
+ * and takes output reports of any length, so only the read buffers need a fixed size.
+ */
+#define HIDRAW_MAX_REPORT_SIZE 64
+
+// How often a worker blocked on a full descriptor checks whether the device is closing.
+#define HIDRAW_CLOSE_POLL_MS 100
+
+struct hid_hidraw_device
+{
+    struct hid_device base;
+
+    int fd;
+    struct io_handle io;
+
+    // Writes block whatever the descriptor flags: output reports are a synchronous transfer to the
+    // pad, and feature reports a blocking ioctl that over Bluetooth waits for the pad's handshake.
+    // A worker started on the first one issues them off the engine thread, each kind oldest first.
+    SRWLOCK write_lock;
+    struct io_request *outputs;
+    struct io_request *features;
+    BOOL worker;
+    BOOL closing;
+    pthread_t worker_thread;
+    HANDLE worker_event;
+};
+
+// Waits until the descriptor takes a write, which the engine leaves non-blocking. FALSE once closing.
+static BOOL _hid_hidraw_wait_writable(struct hid_hidraw_device *dev)
+{
+    struct pollfd pfd = {.fd = dev->fd, .events = POLLOUT};
+
+    for (;;)
+    {
+        AcquireSRWLockShared(&dev->write_lock);
+        BOOL closing = dev->closing;
+        ReleaseSRWLockShared(&dev->write_lock);
+        if (closing)
+        {
+            return FALSE;
+        }
+        if (poll(&pfd, 1, HIDRAW_CLOSE_POLL_MS) != 0)
+        {
+            return TRUE;
+        }
+    }
+}
+
+static INT _hid_hidraw_write_output_report(struct hid_hidraw_device *dev, struct io_request *request, BOOL *closed)
+{
+    for (;;)
+    {
+        if (!_hid_hidraw_wait_writable(dev))
+        {
+            *closed = TRUE;
+            return IO_CANCELLED;
+        }
+        ssize_t bytes_written = write(dev->fd, request->buffer, request->length);
+        if (bytes_written >= 0)
+        {
+            return (INT)bytes_written;
+        }
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            return IO_FAILED;
+        }
+    }
+}
+
+static void *_hid_hidraw_write_thread(void *arg)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)arg;
+
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&dev->write_lock);
+        BOOL closing = dev->closing;
+        BOOL feature = dev->features != NULL;
+        struct io_request **list = feature ? &dev->features : &dev->outputs;
+        struct io_request *request = *list;
+        if (request != NULL && !closing)
+        {
+            *list = request->next;
+        }
+        ReleaseSRWLockExclusive(&dev->write_lock);
+
+        if (closing)
+        {
+            break;
+        }
+        if (request == NULL)
+        {
+            WaitForSingleObject(dev->worker_event, INFINITE);
+            continue;
+        }
+
+        INT result;
+        if (feature)
+        {
+            DWORD length = request->length < dev->base.feature_report_size ? request->length
+                                                                             : dev->base.feature_report_size;
+            result = ioctl(dev->fd, HIDIOCSFEATURE(length), request->buffer) < 0 ? IO_FAILED : (INT)length;
+        }
+        else
+        {
+            BOOL closed = FALSE;
+            result = _hid_hidraw_write_output_report(dev, request, &closed);
+            if (closed)
+            {
+                break;
+            }
+        }
+        io_post(dev->io.engine, request, result);
+    }
+
+    return NULL;
+}
+
+static struct hid_device *_hid_hidraw_open(LPTSTR path, BOOL access_rw, BOOL shared, const struct hid_caps *caps)
+{
+    (void)shared;
+
+    int fd = open(path, (access_rw ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    // Report sizes are fixed here, the bus is all there is to learn.
+    INT bus;
+    if (caps != NULL)
+    {
+        bus = caps->bus;
+    }
+    else
+    {
+        struct hidraw_devinfo info;
+        if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0)
+        {
+            close(fd);
+            return NULL;
+        }
+        bus = info.bustype == BUS_USB         ? HID_BUS_USB
+              : info.bustype == BUS_BLUETOOTH ? HID_BUS_BLUETOOTH
+                                              : HID_BUS_UNKNOWN;
+    }
+
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)malloc(sizeof(struct hid_hidraw_device));
+    dev->base.bus = bus;
+    dev->base.input_report_size = HIDRAW_MAX_REPORT_SIZE;
+    dev->base.output_report_size = HIDRAW_MAX_REPORT_SIZE;
+    dev->base.feature_report_size = HIDRAW_MAX_REPORT_SIZE;
+    dev->fd = fd;
+    InitializeSRWLock(&dev->write_lock);
+    dev->outputs = NULL;
+    dev->features = NULL;
+    dev->worker = FALSE;
+    dev->closing = FALSE;
+
+    return &dev->base;
+}
+
+static BOOL _hid_hidraw_attach(struct hid_device *device, struct io_engine *engine)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    return io_engine_attach(engine, &dev->io, dev->fd);
+}
+
+static void _hid_hidraw_detach(struct hid_device *device)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    io_engine_detach(&dev->io);
+}
+
+static BOOL _hid_hidraw_read_async(struct hid_device *device, struct io_request *request)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    return io_read(&dev->io, request);
+}
+
+// Queues the request for the worker, starting it on the first write.
+static BOOL _hid_hidraw_queue_write(struct hid_hidraw_device *dev, struct io_request **list,
+                                    struct io_request *request)
+{
+    request->next = NULL;
+
+    AcquireSRWLockExclusive(&dev->write_lock);
+    if (!dev->worker)
+    {
+        dev->worker_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (dev->worker_event == NULL)
+        {
+            ReleaseSRWLockExclusive(&dev->write_lock);
+            return FALSE;
+        }
+        if (pthread_create(&dev->worker_thread, NULL, _hid_hidraw_write_thread, dev) != 0)
+        {
+            CloseHandle(dev->worker_event);
+            ReleaseSRWLockExclusive(&dev->write_lock);
+            return FALSE;
+        }
+        dev->worker = TRUE;
+    }
+
+    struct io_request **tail = list;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = request;
+    ReleaseSRWLockExclusive(&dev->write_lock);
+
+    SetEvent(dev->worker_event);
+    return TRUE;
+}
+
+static BOOL _hid_hidraw_write_output(struct hid_device *device, struct io_request *request)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    return _hid_hidraw_queue_write(dev, &dev->outputs, request);
+}
+
+// Moves the matching requests (all of them for NULL) of the list onto the cancelled one.
+static void _hid_hidraw_take_writes(struct io_request **list, struct io_request *request,
+                                    struct io_request **cancelled)
+{
+    struct io_request **cur = list;
+    while (*cur != NULL)
+    {
+        if (request == NULL || *cur == request)
+        {
+            struct io_request *found = *cur;
+            *cur = found->next;
+            found->next = *cancelled;
+            *cancelled = found;
+        }
+        else
+        {
+            cur = &(*cur)->next;
+        }
+    }
+}
+
+static void _hid_hidraw_cancel(struct hid_device *device, struct io_request *request)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+    struct io_request *cancelled = NULL;
+
+    io_cancel(&dev->io, request);
+
+    // Writes the worker has not taken yet. One it is already issuing completes as usual.
+    AcquireSRWLockExclusive(&dev->write_lock);
+    _hid_hidraw_take_writes(&dev->outputs, request, &cancelled);
+    _hid_hidraw_take_writes(&dev->features, request, &cancelled);
+    ReleaseSRWLockExclusive(&dev->write_lock);
+
+    while (cancelled != NULL)
+    {
+        struct io_request *next = cancelled->next;
+        io_post(dev->io.engine, cancelled, IO_CANCELLED);
+        cancelled = next;
+    }
+}
+
+static BOOL _hid_hidraw_write_feature(struct hid_device *device, struct io_request *request)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    return _hid_hidraw_queue_write(dev, &dev->features, request);
+}
+
+static void _hid_hidraw_close(struct hid_device *device)
+{
+    struct hid_hidraw_device *dev = (struct hid_hidraw_device *)device;
+
+    if (dev->worker)
+    {
+        AcquireSRWLockExclusive(&dev->write_lock);
+        dev->closing = TRUE;
+        ReleaseSRWLockExclusive(&dev->write_lock);
+        SetEvent(dev->worker_event);
+
+        pthread_join(dev->worker_thread, NULL);
+        CloseHandle(dev->worker_event);
+    }
+
+    close(dev->fd);
+}
+
+const struct hid_backend hid_hidraw_backend = {
+    .name = "hidraw",
+    .open = _hid_hidraw_open,
+    .attach = _hid_hidraw_attach,
+    .detach = _hid_hidraw_detach,
+    .read_async = _hid_hidraw_read_async,
+    .write_output = _hid_hidraw_write_output,
+    .write_feature = _hid_hidraw_write_feature,
+    .cancel = _hid_hidraw_cancel,
+    .close = _hid_hidraw_close};
+
+#endif /* __linux__ */
@@ -0,0 +1,300 @@
+/*
+ * hid_replay.c -- HID transport replaying input reports from a capture file.
+ */
+
+#include "hid.h"
+
+#include "capture.h"
+#include "timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif /* _WIN32 */
+
+/*
+ * Largest report handed out, longer records are truncated.
+ */
+#define HID_REPLAY_MAX_REPORT_SIZE 64
+
+struct hid_replay_device
+{
+    struct hid_device base;
+
+    struct capture_reader *reader;
+    struct io_engine *engine;
+    double speed;
+
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif /* _WIN32 */
+    HANDLE wake_event;
+
+    // Reads waiting for the feeder, oldest first, and the feeder's stop request.
+    SRWLOCK lock;
+    struct io_request *reads;
+    BOOL closing;
+};
+
+static void _hid_replay_feed(struct hid_replay_device *dev)
+{
+    BYTE report[CAPTURE_MAX_REPORT_SIZE];
+    INT report_length = 0;
+    ULONGLONG report_us = 0;
+    BOOL staged = FALSE;
+    ULONGLONG start_us = 0;
+    BOOL started = FALSE;
+
+    for (;;)
+    {
+        AcquireSRWLockShared(&dev->lock);
+        BOOL closing = dev->closing;
+        BOOL waiting = dev->reads != NULL;
+        ReleaseSRWLockShared(&dev->lock);
+
+        if (closing)
+        {
+            break;
+        }
+        if (!waiting)
+        {
+            WaitForSingleObject(dev->wake_event, INFINITE);
+            continue;
+        }
+
+        if (!staged)
+        {
+            report_length = capture_reader_next(dev->reader, &report_us, report, sizeof(report));
+            staged = TRUE;
+        }
+
+        // Paced against the capture timeline. The remainder under a millisecond is spun away, timed
+        // waits are far too coarse for it.
+        if (report_length > 0 && dev->speed > 0)
+        {
+            ULONGLONG offset_us = (ULONGLONG)(report_us / dev->speed);
+            ULONGLONG now_us = timer_now_us();
+            if (!started)
+            {
+                start_us = now_us - offset_us;
+                started = TRUE;
+            }
+            if (start_us + offset_us > now_us)
+            {
+                if (start_us + offset_us - now_us >= 1000)
+                {
+                    WaitForSingleObject(dev->wake_event, (DWORD)((start_us + offset_us - now_us) / 1000));
+                }
+                continue;
+            }
+        }
+
+        AcquireSRWLockExclusive(&dev->lock);
+        struct io_request *request = dev->reads;
+        if (request != NULL)
+        {
+            dev->reads = request->next;
+        }
+        ReleaseSRWLockExclusive(&dev->lock);
+
+        if (request == NULL)
+        {
+            continue;
+        }
+
+        // Past the end every read fails, as if the device had been unplugged.
+        INT result = IO_FAILED;
+        if (report_length > 0)
+        {
+            result = (DWORD)report_length < request->length ? report_length : (INT)request->length;
+            memcpy(request->buffer, report, result);
+            staged = FALSE;
+        }
+        io_post(dev->engine, request, result);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _hid_replay_thread(LPVOID lparam)
+{
+    _hid_replay_feed((struct hid_replay_device *)lparam);
+    return 0;
+}
+#else
+static void *_hid_replay_thread(void *arg)
+{
+    _hid_replay_feed((struct hid_replay_device *)arg);
+    return NULL;
+}
+#endif /* _WIN32 */
+
+static struct hid_device *_hid_replay_open(LPTSTR path, BOOL access_rw, BOOL shared, const struct hid_caps *caps)
+{
+    (void)access_rw;
+    (void)shared;
+    (void)caps;
+
+    struct capture_reader *reader = capture_reader_open(path);
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+
+    struct hid_replay_device *dev = (struct hid_replay_device *)malloc(sizeof(struct hid_replay_device));
+    dev->base.bus = HID_BUS_UNKNOWN;
+    dev->base.input_report_size = HID_REPLAY_MAX_REPORT_SIZE;
+    dev->base.output_report_size = HID_REPLAY_MAX_REPORT_SIZE;
+    dev->base.feature_report_size = HID_REPLAY_MAX_REPORT_SIZE;
+    dev->reader = reader;
+    dev->engine = NULL;
+    dev->speed = 1.0;
+    dev->reads = NULL;
+    dev->closing = FALSE;
+    InitializeSRWLock(&dev->lock);
+
+    dev->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (dev->wake_event == NULL)
+    {
+        capture_reader_close(reader);
+        free(dev);
+        return NULL;
+    }
+
+#ifdef _WIN32
+    dev->thread = CreateThread(NULL, 0, _hid_replay_thread, dev, 0, NULL);
+    if (dev->thread == NULL)
+#else
+    if (pthread_create(&dev->thread, NULL, _hid_replay_thread, dev) != 0)
+#endif /* _WIN32 */
+    {
+        CloseHandle(dev->wake_event);
+        capture_reader_close(reader);
+        free(dev);
+        return NULL;
+    }
+
+    return &dev->base;
+}
+
+static BOOL _hid_replay_attach(struct hid_device *device, struct io_engine *engine)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    dev->engine = engine;
+    return TRUE;
+}
+
+static void _hid_replay_detach(struct hid_device *device)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    dev->engine = NULL;
+}
+
+static BOOL _hid_replay_read_async(struct hid_device *device, struct io_request *request)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    request->next = NULL;
+
+    AcquireSRWLockExclusive(&dev->lock);
+    struct io_request **tail = &dev->reads;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = request;
+    ReleaseSRWLockExclusive(&dev->lock);
+
+    SetEvent(dev->wake_event);
+    return TRUE;
+}
+
+static BOOL _hid_replay_write_output(struct hid_device *device, struct io_request *request)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    io_post(dev->engine, request, (INT)request->length);
+    return TRUE;
+}
+
+static BOOL _hid_replay_write_feature(struct hid_device *device, struct io_request *request)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    io_post(dev->engine, request, (INT)request->length);
+    return TRUE;
+}
+
+static void _hid_replay_cancel(struct hid_device *device, struct io_request *request)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+    struct io_request *cancelled = NULL;
+
+    AcquireSRWLockExclusive(&dev->lock);
+    struct io_request **cur = &dev->reads;
+    while (*cur != NULL)
+    {
+        if (request == NULL || *cur == request)
+        {
+            struct io_request *found = *cur;
+            *cur = found->next;
+            found->next = cancelled;
+            cancelled = found;
+        }
+        else
+        {
+            cur = &(*cur)->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&dev->lock);
+
+    while (cancelled != NULL)
+    {
+        struct io_request *next = cancelled->next;
+        io_post(dev->engine, cancelled, IO_CANCELLED);
+        cancelled = next;
+    }
+}
+
+static void _hid_replay_close(struct hid_device *device)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    AcquireSRWLockExclusive(&dev->lock);
+    dev->closing = TRUE;
+    ReleaseSRWLockExclusive(&dev->lock);
+    SetEvent(dev->wake_event);
+
+#ifdef _WIN32
+    WaitForSingleObject(dev->thread, INFINITE);
+    CloseHandle(dev->thread);
+#else
+    pthread_join(dev->thread, NULL);
+#endif /* _WIN32 */
+
+    CloseHandle(dev->wake_event);
+    capture_reader_close(dev->reader);
+}
+
+void hid_replay_set_speed(struct hid_device *device, double speed)
+{
+    struct hid_replay_device *dev = (struct hid_replay_device *)device;
+
+    dev->speed = speed;
+}
+
+const struct hid_backend hid_replay_backend = {
+    .name = "replay",
+    .open = _hid_replay_open,
+    .attach = _hid_replay_attach,
+    .detach = _hid_replay_detach,
+    .read_async = _hid_replay_read_async,
+    .write_output = _hid_replay_write_output,
+    .write_feature = _hid_replay_write_feature,
+    .cancel = _hid_replay_cancel,
+    .close = _hid_replay_close};
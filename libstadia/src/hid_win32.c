@@ -0,0 +1,403 @@
+/*
+ * hid_win32.c -- HID transport over the Win32 HID stack.
+ */
+
+#include "hid.h"
+
+#ifdef _WIN32
+
+#include "utils.h"
+
+#include <tchar.h>
+#include <initguid.h>
+#include <windows.h>
+#include <winioctl.h>
+#include <hidclass.h>
+#include <hidsdi.h>
+#include <setupapi.h>
+#include <devpkey.h>
+#include <cfgmgr32.h>
+
+#pragma comment(lib, "kernel32.lib")
+#pragma comment(lib, "hid.lib")
+#pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "cfgmgr32.lib")
+
+struct hid_win32_device
+{
+    struct hid_device base;
+
+    HANDLE handle;
+    struct io_handle io;
+};
+
+static BOOL got_hid_class = FALSE;
+static GUID hid_class;
+
+GUID hid_get_class()
+{
+    if (!got_hid_class)
+    {
+        HidD_GetHidGuid(&hid_class);
+        got_hid_class = TRUE;
+    }
+    return hid_class;
+}
+
+struct hid_device_info *hid_enumerate(const LPTSTR *path_filters)
+{
+    struct hid_device_info *root_dev = NULL;
+    struct hid_device_info *cur_dev = NULL;
+
+    GUID class_guid = hid_get_class();
+    SP_DEVINFO_DATA devinfo_data;
+    SP_DEVICE_INTERFACE_DATA device_interface_data;
+    SP_DEVICE_INTERFACE_DETAIL_DATA *device_interface_detail_data = NULL;
+    DWORD detail_size = 0;
+    TCHAR instance_id[MAX_DEVICE_ID_LEN];
+    HDEVINFO device_info_set = INVALID_HANDLE_VALUE;
+    DWORD required_size = 0;
+    DEVPROPTYPE prop_type;
+    LPTSTR desc_buffer = NULL;
+    LPWSTR desc_buffer_w = NULL;
+
+    memset(&devinfo_data, 0x0, sizeof(devinfo_data));
+    devinfo_data.cbSize = sizeof(SP_DEVINFO_DATA);
+    device_interface_data.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    device_info_set = SetupDiGetClassDevs(&class_guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info_set == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    DWORD device_index = 0;
+    while (SetupDiEnumDeviceInfo(device_info_set, device_index, &devinfo_data))
+    {
+        // Interface paths are built from the instance ID, so a device whose ID matches no filter has
+        // no matching interface either and is passed over without querying anything else.
+        if (path_filters != NULL &&
+            (!SetupDiGetDeviceInstanceId(device_info_set, &devinfo_data, instance_id, MAX_DEVICE_ID_LEN, NULL) ||
+             !hid_match_filters(instance_id, path_filters)))
+        {
+            device_index++;
+            continue;
+        }
+
+        DWORD device_interface_index = 0;
+        while (SetupDiEnumDeviceInterfaces(device_info_set, &devinfo_data, &class_guid, device_interface_index, &device_interface_data))
+        {
+            // One detail buffer for the whole enumeration, only grown (and the query repeated) when an
+            // interface needs more than it holds.
+            BOOL got_detail;
+            required_size = 0;
+            if (device_interface_detail_data != NULL)
+            {
+                device_interface_detail_data->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+            }
+            got_detail = SetupDiGetDeviceInterfaceDetail(device_info_set, &device_interface_data, device_interface_detail_data,
+                                                         detail_size, &required_size, NULL);
+            if (!got_detail && required_size > detail_size)
+            {
+                free(device_interface_detail_data);
+                device_interface_detail_data = (SP_DEVICE_INTERFACE_DETAIL_DATA *)malloc(required_size);
+                device_interface_detail_data->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+                detail_size = required_size;
+                got_detail = SetupDiGetDeviceInterfaceDetail(device_info_set, &device_interface_data, device_interface_detail_data,
+                                                             detail_size, NULL, NULL);
+            }
+
+            if (got_detail)
+            {
+                if (hid_match_filters(device_interface_detail_data->DevicePath, path_filters))
+                {
+                    desc_buffer = NULL;
+
+                    if (SetupDiGetDevicePropertyW(device_info_set, &devinfo_data, &DEVPKEY_Device_BusReportedDeviceDesc,
+                                                  &prop_type, NULL, 0, &required_size, 0))
+                    {
+                        desc_buffer_w = (LPWSTR)malloc(required_size);
+                        memset(desc_buffer_w, 0, required_size);
+                        SetupDiGetDevicePropertyW(device_info_set, &devinfo_data, &DEVPKEY_Device_BusReportedDeviceDesc,
+                                                  &prop_type, (PBYTE)desc_buffer_w, required_size, NULL, 0);
+#ifdef UNICODE
+                        desc_buffer = desc_buffer_w;
+#else
+                        int desc_buffer_size = WideCharToMultiByte(CP_ACP, 0, desc_buffer_w, -1, desc_buffer, 0, NULL, NULL);
+                        desc_buffer = (LPSTR)malloc(desc_buffer_size);
+                        WideCharToMultiByte(CP_ACP, 0, desc_buffer_w, -1, desc_buffer, desc_buffer_size, NULL, NULL);
+                        free(desc_buffer_w);
+#endif /* UNICODE */
+                    }
+
+                    if (desc_buffer == NULL || _tcslen(desc_buffer) == 0)
+                    {
+                        if (desc_buffer != NULL)
+                        {
+                            free(desc_buffer);
+                        }
+                        if (SetupDiGetDeviceRegistryProperty(device_info_set, &devinfo_data, SPDRP_DEVICEDESC,
+                                                             NULL, NULL, 0, &required_size) ||
+                            GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+                        {
+                            desc_buffer = (LPTSTR)malloc(required_size);
+                            memset(desc_buffer, 0, required_size);
+                            SetupDiGetDeviceRegistryProperty(device_info_set, &devinfo_data, SPDRP_DEVICEDESC,
+                                                             NULL, (PBYTE)desc_buffer, required_size, NULL);
+                        }
+                    }
+
+                    struct hid_device_info *dev = (struct hid_device_info *)malloc(sizeof(struct hid_device_info));
+                    dev->path = (LPTSTR)malloc((_tcslen(device_interface_detail_data->DevicePath) + 1) * sizeof(TCHAR));
+                    _tcscpy(dev->path, device_interface_detail_data->DevicePath);
+                    dev->description = desc_buffer;
+                    dev->next = NULL;
+
+                    if (root_dev == NULL)
+                    {
+                        root_dev = dev;
+                    }
+                    else
+                    {
+                        cur_dev->next = dev;
+                    }
+                    cur_dev = dev;
+                }
+            }
+
+            device_interface_index++;
+        }
+
+        device_index++;
+    }
+
+    free(device_interface_detail_data);
+    SetupDiDestroyDeviceInfoList(device_info_set);
+
+    return root_dev;
+}
+
+BOOL hid_reenable_device(LPTSTR path)
+{
+    GUID class_guid = hid_get_class();
+    SP_DEVINFO_DATA devinfo_data;
+    HDEVINFO device_info_set = INVALID_HANDLE_VALUE;
+    DWORD required_size = 0;
+    LPWSTR path_w;
+    LPTSTR inst_id = NULL;
+
+    memset(&devinfo_data, 0x0, sizeof(devinfo_data));
+    devinfo_data.cbSize = sizeof(SP_DEVINFO_DATA);
+
+#ifdef UNICODE
+    path_w = path;
+#else
+    int path_length = strlen(path);
+    path_w = malloc((path_length + 1) * sizeof(WCHAR));
+    MultiByteToWideChar(CP_ACP, 0, path, -1, path_w, path_length + 1);
+#endif /* UNICODE */
+
+    DEVPROPTYPE prop_type;
+    CM_Get_Device_Interface_PropertyW(path_w, &DEVPKEY_Device_InstanceId, &prop_type, NULL, &required_size, 0);
+    LPWSTR inst_id_w = (LPWSTR)malloc(required_size);
+    if (CM_Get_Device_Interface_PropertyW(path_w, &DEVPKEY_Device_InstanceId, &prop_type, (PBYTE)inst_id_w, &required_size, 0) != CR_SUCCESS)
+    {
+        free(inst_id_w);
+        return FALSE;
+    }
+
+#ifdef UNICODE
+    inst_id = inst_id_w;
+#else
+    free(path_w);
+    int inst_id_size = WideCharToMultiByte(CP_ACP, 0, inst_id_w, -1, inst_id, 0, NULL, NULL);
+    inst_id = (LPSTR)malloc(inst_id_size);
+    WideCharToMultiByte(CP_ACP, 0, inst_id_w, -1, inst_id, inst_id_size, NULL, NULL);
+    free(inst_id_w);
+#endif /* UNICODE */
+
+    device_info_set = SetupDiGetClassDevs(&class_guid, inst_id, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info_set == INVALID_HANDLE_VALUE)
+    {
+        free(inst_id);
+        return FALSE;
+    }
+
+    if (!SetupDiEnumDeviceInfo(device_info_set, 0, &devinfo_data) || SetupDiEnumDeviceInfo(device_info_set, 1, &devinfo_data))
+    {
+        free(inst_id);
+        SetupDiDestroyDeviceInfoList(device_info_set);
+        return FALSE;
+    }
+
+    SP_PROPCHANGE_PARAMS pc_params =
+        {
+            .ClassInstallHeader =
+                {
+                    .cbSize = sizeof(SP_CLASSINSTALL_HEADER),
+                    .InstallFunction = DIF_PROPERTYCHANGE},
+            .StateChange = DICS_DISABLE,
+            .Scope = DICS_FLAG_GLOBAL,
+            .HwProfile = 0};
+    BOOL res;
+    res = SetupDiSetClassInstallParams(device_info_set, &devinfo_data, (PSP_CLASSINSTALL_HEADER)&pc_params,
+                                       sizeof(SP_PROPCHANGE_PARAMS));
+    res = res && SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, device_info_set, &devinfo_data);
+    pc_params.StateChange = DICS_ENABLE;
+    res = res && SetupDiSetClassInstallParams(device_info_set, &devinfo_data, (PSP_CLASSINSTALL_HEADER)&pc_params,
+                                              sizeof(SP_PROPCHANGE_PARAMS));
+    res = res && SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, device_info_set, &devinfo_data);
+
+    free(inst_id);
+    SetupDiDestroyDeviceInfoList(device_info_set);
+    return res;
+}
+
+BOOL check_vendor_and_product(LPTSTR path, USHORT vendor_id, USHORT product_id)
+{
+    HANDLE dev_handle = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (dev_handle != INVALID_HANDLE_VALUE)
+    {
+        BOOL matched = FALSE;
+        HIDD_ATTRIBUTES attributes =
+            {
+                .Size = sizeof(HIDD_ATTRIBUTES)};
+        if (HidD_GetAttributes(dev_handle, &attributes))
+        {
+            matched = (vendor_id == 0x0 || attributes.VendorID == vendor_id) && (product_id == 0x0 || attributes.ProductID == product_id);
+        }
+        CloseHandle(dev_handle);
+        return matched;
+    }
+    else
+    {
+        return FALSE;
+    }
+}
+
+static struct hid_device *_hid_win32_open(LPTSTR path, BOOL access_rw, BOOL shared, const struct hid_caps *caps)
+{
+    DWORD desired_access = access_rw ? (GENERIC_WRITE | GENERIC_READ) : 0;
+    DWORD share_mode = shared ? (FILE_SHARE_READ | FILE_SHARE_WRITE) : 0;
+    SECURITY_ATTRIBUTES security =
+        {
+            .nLength = sizeof(SECURITY_ATTRIBUTES),
+            .lpSecurityDescriptor = NULL,
+            .bInheritHandle = TRUE};
+    HANDLE handle = CreateFile(path, desired_access, share_mode, &security, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, 0);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    struct hid_caps queried_caps;
+    if (caps == NULL)
+    {
+        PHIDP_PREPARSED_DATA pp_data = NULL;
+        if (!HidD_GetPreparsedData(handle, &pp_data))
+        {
+            CloseHandle(handle);
+            return NULL;
+        }
+
+        HIDP_CAPS hidp_caps;
+        NTSTATUS status = HidP_GetCaps(pp_data, &hidp_caps);
+        HidD_FreePreparsedData(pp_data);
+        if (status != HIDP_STATUS_SUCCESS)
+        {
+            CloseHandle(handle);
+            return NULL;
+        }
+
+        queried_caps.bus = HID_BUS_UNKNOWN;
+        queried_caps.input_report_size = hidp_caps.InputReportByteLength;
+        queried_caps.output_report_size = hidp_caps.OutputReportByteLength;
+        queried_caps.feature_report_size = hidp_caps.FeatureReportByteLength;
+        caps = &queried_caps;
+    }
+
+    struct hid_win32_device *dev = (struct hid_win32_device *)malloc(sizeof(struct hid_win32_device));
+    dev->base.bus = caps->bus;
+    dev->base.input_report_size = caps->input_report_size;
+    dev->base.output_report_size = caps->output_report_size;
+    dev->base.feature_report_size = caps->feature_report_size;
+    dev->handle = handle;
+
+    return &dev->base;
+}
+
+static BOOL _hid_win32_attach(struct hid_device *device, struct io_engine *engine)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    return io_engine_attach(engine, &dev->io, dev->handle);
+}
+
+static void _hid_win32_detach(struct hid_device *device)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    io_engine_detach(&dev->io);
+}
+
+static BOOL _hid_win32_read_async(struct hid_device *device, struct io_request *request)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    return io_read(&dev->io, request);
+}
+
+static void _hid_win32_pad_request(struct io_request *request, USHORT report_size)
+{
+    // The HID class driver only accepts reports of exactly the report size.
+    if (request->length < report_size)
+    {
+        memset(request->buffer + request->length, 0x0, report_size - request->length);
+    }
+    request->length = report_size;
+}
+
+static BOOL _hid_win32_write_output(struct hid_device *device, struct io_request *request)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    _hid_win32_pad_request(request, device->output_report_size);
+    return io_write(&dev->io, request);
+}
+
+static BOOL _hid_win32_write_feature(struct hid_device *device, struct io_request *request)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    // The overlapped counterpart of HidD_SetFeature, completing on the engine like any write.
+    _hid_win32_pad_request(request, device->feature_report_size);
+    return io_control(&dev->io, IOCTL_HID_SET_FEATURE, request);
+}
+
+static void _hid_win32_cancel(struct hid_device *device, struct io_request *request)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    io_cancel(&dev->io, request);
+}
+
+static void _hid_win32_close(struct hid_device *device)
+{
+    struct hid_win32_device *dev = (struct hid_win32_device *)device;
+
+    CancelIoEx(dev->handle, NULL);
+    CloseHandle(dev->handle);
+}
+
+const struct hid_backend hid_win32_backend = {
+    .name = "win32",
+    .open = _hid_win32_open,
+    .attach = _hid_win32_attach,
+    .detach = _hid_win32_detach,
+    .read_async = _hid_win32_read_async,
+    .write_output = _hid_win32_write_output,
+    .write_feature = _hid_win32_write_feature,
+    .cancel = _hid_win32_cancel,
+    .close = _hid_win32_close};
+
+#endif /* _WIN32 */
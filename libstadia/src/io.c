@@ -0,0 +1,593 @@
+/*
+ * io.c -- Shared I/O completion engine.
+ */
+
+#include "io.h"
+
+#include "timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void _io_timer_insert(struct io_request **timers, struct io_request *request)
+{
+    // Kept sorted by due time, requests due at the same time complete in scheduling order.
+    while (*timers != NULL && (*timers)->due_us <= request->due_us)
+    {
+        timers = &(*timers)->next;
+    }
+    request->next = *timers;
+    *timers = request;
+}
+
+static DWORD _io_timer_timeout(struct io_request *timers)
+{
+    if (timers == NULL)
+    {
+        return INFINITE;
+    }
+
+    // Rounded up, waking early would only mean another wait.
+    ULONGLONG now_us = timer_now_us();
+    return timers->due_us > now_us ? (DWORD)((timers->due_us - now_us + 999) / 1000) : 0;
+}
+
+static void _io_timer_fire(struct io_request **timers)
+{
+    ULONGLONG now_us = timer_now_us();
+    struct io_request *expired = *timers;
+    struct io_request **tail = timers;
+
+    // Taken off the list first, so completions may schedule again without being fired right away.
+    while (*tail != NULL && (*tail)->due_us <= now_us)
+    {
+        tail = &(*tail)->next;
+    }
+    if (tail == timers)
+    {
+        return;
+    }
+    *timers = *tail;
+    *tail = NULL;
+
+    while (expired != NULL)
+    {
+        struct io_request *next = expired->next;
+        expired->complete(expired, 0);
+        expired = next;
+    }
+}
+
+#ifdef _WIN32
+
+#pragma comment(lib, "kernel32.lib")
+
+#define IO_KEY_HANDLE 0
+#define IO_KEY_POSTED 1
+#define IO_KEY_QUIT 2
+
+struct io_engine
+{
+    HANDLE port;
+    HANDLE thread;
+    DWORD thread_id;
+
+    // Scheduled requests, soonest first. Only touched from the engine thread.
+    struct io_request *timers;
+};
+
+static DWORD WINAPI _io_engine_thread(LPVOID lparam)
+{
+    struct io_engine *engine = (struct io_engine *)lparam;
+    DWORD bytes_transferred;
+    ULONG_PTR key;
+    LPOVERLAPPED ol;
+
+    for (;;)
+    {
+        BOOL success = GetQueuedCompletionStatus(engine->port, &bytes_transferred, &key, &ol,
+                                                 _io_timer_timeout(engine->timers));
+        if (ol == NULL)
+        {
+            if (!success && GetLastError() == WAIT_TIMEOUT)
+            {
+                _io_timer_fire(&engine->timers);
+                continue;
+            }
+            if (key == IO_KEY_QUIT || !success)
+            {
+                break;
+            }
+            continue;
+        }
+
+        struct io_request *request = CONTAINING_RECORD(ol, struct io_request, ol);
+        INT result;
+        if (key == IO_KEY_POSTED)
+        {
+            result = request->result;
+        }
+        else if (success)
+        {
+            result = (INT)bytes_transferred;
+        }
+        else
+        {
+            result = GetLastError() == ERROR_OPERATION_ABORTED ? IO_CANCELLED : IO_FAILED;
+        }
+
+        request->complete(request, result);
+
+        // A busy port never times out, so due timers are also fired between completions.
+        _io_timer_fire(&engine->timers);
+    }
+
+    return 0;
+}
+
+struct io_engine *io_engine_create()
+{
+    struct io_engine *engine = (struct io_engine *)malloc(sizeof(struct io_engine));
+
+    engine->timers = NULL;
+    engine->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (engine->port == NULL)
+    {
+        free(engine);
+        return NULL;
+    }
+
+    engine->thread = CreateThread(NULL, 0, _io_engine_thread, engine, 0, &engine->thread_id);
+    if (engine->thread == NULL)
+    {
+        CloseHandle(engine->port);
+        free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void io_engine_destroy(struct io_engine *engine)
+{
+    PostQueuedCompletionStatus(engine->port, 0, IO_KEY_QUIT, NULL);
+    WaitForSingleObject(engine->thread, INFINITE);
+
+    CloseHandle(engine->thread);
+    CloseHandle(engine->port);
+    free(engine);
+}
+
+BOOL io_engine_is_current(struct io_engine *engine)
+{
+    return GetCurrentThreadId() == engine->thread_id;
+}
+
+BOOL io_engine_attach(struct io_engine *engine, struct io_handle *handle, IO_NATIVE_HANDLE native)
+{
+    handle->native = native;
+    handle->engine = engine;
+
+    return CreateIoCompletionPort(native, engine->port, IO_KEY_HANDLE, 0) != NULL;
+}
+
+void io_engine_detach(struct io_handle *handle)
+{
+    // The association with the port ends when the native handle is closed.
+    handle->engine = NULL;
+}
+
+BOOL io_read(struct io_handle *handle, struct io_request *request)
+{
+    memset(&request->ol, 0, sizeof(OVERLAPPED));
+    if (!ReadFile(handle->native, request->buffer, request->length, NULL, &request->ol))
+    {
+        return GetLastError() == ERROR_IO_PENDING;
+    }
+    return TRUE;
+}
+
+BOOL io_write(struct io_handle *handle, struct io_request *request)
+{
+    memset(&request->ol, 0, sizeof(OVERLAPPED));
+    if (!WriteFile(handle->native, request->buffer, request->length, NULL, &request->ol))
+    {
+        return GetLastError() == ERROR_IO_PENDING;
+    }
+    return TRUE;
+}
+
+BOOL io_control(struct io_handle *handle, DWORD code, struct io_request *request)
+{
+    memset(&request->ol, 0, sizeof(OVERLAPPED));
+    if (!DeviceIoControl(handle->native, code, request->buffer, request->length, NULL, 0, NULL, &request->ol))
+    {
+        return GetLastError() == ERROR_IO_PENDING;
+    }
+    return TRUE;
+}
+
+void io_cancel(struct io_handle *handle, struct io_request *request)
+{
+    CancelIoEx(handle->native, request != NULL ? &request->ol : NULL);
+}
+
+void io_post(struct io_engine *engine, struct io_request *request, INT result)
+{
+    memset(&request->ol, 0, sizeof(OVERLAPPED));
+    request->result = result;
+    PostQueuedCompletionStatus(engine->port, 0, IO_KEY_POSTED, &request->ol);
+}
+
+void io_schedule(struct io_engine *engine, struct io_request *request, ULONGLONG due_us)
+{
+    request->due_us = due_us;
+    _io_timer_insert(&engine->timers, request);
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct io_engine
+{
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    BOOL quit;
+    struct io_request *posted;
+    struct io_request *posted_tail;
+
+    // Scheduled requests, soonest first. Only touched from the engine thread.
+    struct io_request *timers;
+};
+
+static void _io_wake(struct io_engine *engine)
+{
+    uint64_t one = 1;
+
+    // A failed write can only mean the counter is saturated, i.e. a wakeup is already pending.
+    ssize_t written = write(engine->wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+static void _io_watch(struct io_handle *handle)
+{
+    if (handle->hung_up)
+    {
+        return;
+    }
+
+    struct epoll_event event = {.events = handle->reads != NULL ? EPOLLIN : 0, .data.ptr = handle};
+    epoll_ctl(handle->engine->epoll_fd, EPOLL_CTL_MOD, handle->native, &event);
+}
+
+/*
+ * Stops watching a descriptor epoll keeps reporting as hung up or failed, whether reads are pending
+ * or not, and fails the reads. Called with the engine lock held.
+ */
+static struct io_request *_io_hang_up(struct io_handle *handle)
+{
+    struct io_request *failed = handle->reads;
+
+    epoll_ctl(handle->engine->epoll_fd, EPOLL_CTL_DEL, handle->native, NULL);
+    handle->hung_up = TRUE;
+    handle->reads = NULL;
+    return failed;
+}
+
+// Returns whether the engine was asked to quit.
+static BOOL _io_complete_posted(struct io_engine *engine)
+{
+    uint64_t count;
+    struct io_request *request;
+    BOOL quit;
+
+    if (read(engine->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    quit = engine->quit;
+    request = engine->posted;
+    engine->posted = NULL;
+    engine->posted_tail = NULL;
+    pthread_mutex_unlock(&engine->lock);
+
+    while (request != NULL)
+    {
+        struct io_request *next = request->next;
+        request->complete(request, request->result);
+        request = next;
+    }
+
+    return quit;
+}
+
+static void _io_complete_read(struct io_engine *engine, struct io_handle *handle, uint32_t events)
+{
+    BOOL hung_up = (events & (EPOLLHUP | EPOLLERR)) != 0;
+    struct io_request *failed = NULL;
+
+    pthread_mutex_lock(&engine->lock);
+    struct io_request *request = handle->reads;
+    if (request == NULL)
+    {
+        // Reported even with no events asked for, so it would wake the engine over and over.
+        if (hung_up)
+        {
+            _io_hang_up(handle);
+        }
+        pthread_mutex_unlock(&engine->lock);
+        return;
+    }
+
+    // Whatever was received before the hang-up is still handed out.
+    ssize_t bytes_read = read(handle->native, request->buffer, request->length);
+    if (bytes_read < 0 && (errno == EINTR || (errno == EAGAIN && !hung_up)))
+    {
+        pthread_mutex_unlock(&engine->lock);
+        return;
+    }
+    if (bytes_read <= 0 && hung_up)
+    {
+        failed = _io_hang_up(handle);
+        pthread_mutex_unlock(&engine->lock);
+
+        // Posted like cancelled reads, as a completion routine may free the handle and its requests.
+        while (failed != NULL)
+        {
+            struct io_request *next = failed->next;
+            io_post(engine, failed, IO_FAILED);
+            failed = next;
+        }
+        return;
+    }
+
+    handle->reads = request->next;
+    if (handle->reads == NULL)
+    {
+        _io_watch(handle);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    // End of file means the device (or the writer standing in for it) is gone.
+    request->complete(request, bytes_read > 0 ? (INT)bytes_read : IO_FAILED);
+}
+
+static void *_io_engine_thread(void *arg)
+{
+    struct io_engine *engine = (struct io_engine *)arg;
+    struct epoll_event event;
+
+    for (;;)
+    {
+        // One event per wait, so a completion routine may detach and free any handle without
+        // leaving stale events behind in a batch.
+        DWORD timeout = _io_timer_timeout(engine->timers);
+        int count = epoll_wait(engine->epoll_fd, &event, 1, timeout == INFINITE ? -1 : (int)timeout);
+        if (count < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (count <= 0)
+        {
+            _io_timer_fire(&engine->timers);
+            continue;
+        }
+
+        if (event.data.ptr == NULL)
+        {
+            // The flag is set under the lock before the wakeup, so it is only looked at here.
+            if (_io_complete_posted(engine))
+            {
+                break;
+            }
+        }
+        else
+        {
+            _io_complete_read(engine, (struct io_handle *)event.data.ptr, event.events);
+        }
+
+        // A busy engine never times out, so due timers are also fired between events.
+        _io_timer_fire(&engine->timers);
+    }
+
+    return NULL;
+}
+
+struct io_engine *io_engine_create()
+{
+    struct io_engine *engine = (struct io_engine *)malloc(sizeof(struct io_engine));
+
+    engine->quit = FALSE;
+    engine->posted = NULL;
+    engine->posted_tail = NULL;
+    engine->timers = NULL;
+    pthread_mutex_init(&engine->lock, NULL);
+
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (engine->epoll_fd < 0 || engine->wake_fd < 0 ||
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->wake_fd, &event) != 0 ||
+        pthread_create(&engine->thread, NULL, _io_engine_thread, engine) != 0)
+    {
+        if (engine->epoll_fd >= 0)
+        {
+            close(engine->epoll_fd);
+        }
+        if (engine->wake_fd >= 0)
+        {
+            close(engine->wake_fd);
+        }
+        pthread_mutex_destroy(&engine->lock);
+        free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void io_engine_destroy(struct io_engine *engine)
+{
+    pthread_mutex_lock(&engine->lock);
+    engine->quit = TRUE;
+    pthread_mutex_unlock(&engine->lock);
+
+    _io_wake(engine);
+    pthread_join(engine->thread, NULL);
+
+    close(engine->wake_fd);
+    close(engine->epoll_fd);
+    pthread_mutex_destroy(&engine->lock);
+    free(engine);
+}
+
+BOOL io_engine_is_current(struct io_engine *engine)
+{
+    return pthread_equal(pthread_self(), engine->thread);
+}
+
+BOOL io_engine_attach(struct io_engine *engine, struct io_handle *handle, IO_NATIVE_HANDLE native)
+{
+    handle->native = native;
+    handle->engine = engine;
+    handle->reads = NULL;
+    handle->hung_up = FALSE;
+
+    int flags = fcntl(native, F_GETFL);
+    if (flags < 0 || fcntl(native, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        return FALSE;
+    }
+
+    struct epoll_event event = {.events = 0, .data.ptr = handle};
+    return epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, native, &event) == 0;
+}
+
+void io_engine_detach(struct io_handle *handle)
+{
+    if (!handle->hung_up)
+    {
+        epoll_ctl(handle->engine->epoll_fd, EPOLL_CTL_DEL, handle->native, NULL);
+    }
+    handle->engine = NULL;
+}
+
+BOOL io_read(struct io_handle *handle, struct io_request *request)
+{
+    struct io_engine *engine = handle->engine;
+
+    request->next = NULL;
+
+    pthread_mutex_lock(&engine->lock);
+    if (handle->hung_up)
+    {
+        pthread_mutex_unlock(&engine->lock);
+
+        // No longer watched, what is left to read is read in place like a write.
+        ssize_t bytes_read = read(handle->native, request->buffer, request->length);
+        io_post(engine, request, bytes_read > 0 ? (INT)bytes_read : IO_FAILED);
+        return TRUE;
+    }
+    struct io_request **tail = &handle->reads;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = request;
+    if (handle->reads == request)
+    {
+        _io_watch(handle);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    return TRUE;
+}
+
+BOOL io_write(struct io_handle *handle, struct io_request *request)
+{
+    // Attached descriptors are non-blocking, so the write is done in place and only its completion is
+    // queued. Devices whose writes block regardless, as hidraw's do, write from a thread of their own.
+    ssize_t bytes_written = write(handle->native, request->buffer, request->length);
+    if (bytes_written < 0)
+    {
+        return FALSE;
+    }
+
+    io_post(handle->engine, request, (INT)bytes_written);
+    return TRUE;
+}
+
+void io_cancel(struct io_handle *handle, struct io_request *request)
+{
+    struct io_engine *engine = handle->engine;
+    struct io_request *cancelled = NULL;
+
+    pthread_mutex_lock(&engine->lock);
+    struct io_request **cur = &handle->reads;
+    while (*cur != NULL)
+    {
+        if (request == NULL || *cur == request)
+        {
+            struct io_request *found = *cur;
+            *cur = found->next;
+            found->next = cancelled;
+            cancelled = found;
+        }
+        else
+        {
+            cur = &(*cur)->next;
+        }
+    }
+    if (cancelled != NULL && handle->reads == NULL)
+    {
+        _io_watch(handle);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    while (cancelled != NULL)
+    {
+        struct io_request *next = cancelled->next;
+        io_post(engine, cancelled, IO_CANCELLED);
+        cancelled = next;
+    }
+}
+
+void io_post(struct io_engine *engine, struct io_request *request, INT result)
+{
+    request->result = result;
+    request->next = NULL;
+
+    pthread_mutex_lock(&engine->lock);
+    if (engine->posted_tail != NULL)
+    {
+        engine->posted_tail->next = request;
+    }
+    else
+    {
+        engine->posted = request;
+    }
+    engine->posted_tail = request;
+    pthread_mutex_unlock(&engine->lock);
+
+    _io_wake(engine);
+}
+
+void io_schedule(struct io_engine *engine, struct io_request *request, ULONGLONG due_us)
+{
+    request->due_us = due_us;
+    _io_timer_insert(&engine->timers, request);
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,96 @@
+/*
+ * latency.c -- Lock-free latency histograms.
+ */
+
+#include "latency.h"
+
+#define LATENCY_LINEAR_LIMIT 8
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_FIRST_MSB 3
+
+static INT _latency_bucket(ULONGLONG elapsed_us)
+{
+    if (elapsed_us < LATENCY_LINEAR_LIMIT)
+    {
+        return (INT)elapsed_us;
+    }
+
+    INT msb = LATENCY_FIRST_MSB;
+    while ((elapsed_us >> (msb + 1)) != 0)
+    {
+        msb++;
+    }
+
+    INT sub = (INT)(elapsed_us >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1);
+    INT bucket = LATENCY_LINEAR_LIMIT + (msb - LATENCY_FIRST_MSB) * LATENCY_SUB_BUCKETS + sub;
+    return bucket < LATENCY_BUCKET_COUNT ? bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+static LONG _latency_bucket_upper(INT bucket)
+{
+    if (bucket < LATENCY_LINEAR_LIMIT)
+    {
+        return bucket;
+    }
+
+    INT msb = LATENCY_FIRST_MSB + (bucket - LATENCY_LINEAR_LIMIT) / LATENCY_SUB_BUCKETS;
+    INT sub = (bucket - LATENCY_LINEAR_LIMIT) % LATENCY_SUB_BUCKETS;
+    return ((LONG)(LATENCY_SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+void latency_histogram_reset(struct latency_histogram *histogram)
+{
+    for (INT i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        InterlockedExchange(&histogram->buckets[i], 0);
+    }
+    InterlockedExchange(&histogram->max_us, 0);
+}
+
+void latency_histogram_record(struct latency_histogram *histogram, ULONGLONG elapsed_us)
+{
+    LONG clamped = elapsed_us < 0x7FFFFFFF ? (LONG)elapsed_us : 0x7FFFFFFF;
+
+    InterlockedIncrement(&histogram->buckets[_latency_bucket(elapsed_us)]);
+
+    // Only the writer raises the maximum, so no compare-and-swap loop is needed.
+    if (clamped > histogram->max_us)
+    {
+        InterlockedExchange(&histogram->max_us, clamped);
+    }
+}
+
+static LONG _latency_percentile(const LONG *buckets, LONG count, LONG max_us, LONG percent)
+{
+    LONG target = (LONG)(((LONGLONG)count * percent + 99) / 100);
+    LONG seen = 0;
+
+    for (INT i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+        {
+            LONG upper = _latency_bucket_upper(i);
+            return upper < max_us ? upper : max_us;
+        }
+    }
+    return max_us;
+}
+
+void latency_histogram_summarize(const struct latency_histogram *histogram, struct latency_summary *summary)
+{
+    LONG buckets[LATENCY_BUCKET_COUNT];
+    LONG count = 0;
+
+    // Counted from the snapshot rather than read separately, so the percentiles stay consistent.
+    for (INT i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        buckets[i] = histogram->buckets[i];
+        count += buckets[i];
+    }
+
+    summary->count = count;
+    summary->max_us = histogram->max_us;
+    summary->p50_us = count > 0 ? _latency_percentile(buckets, count, summary->max_us, 50) : 0;
+    summary->p99_us = count > 0 ? _latency_percentile(buckets, count, summary->max_us, 99) : 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * report.c -- Decoding of Stadia controller input reports.
+ */
+
+#include "report.h"
+
+#include "table.h"
+
+/*
+ * Byte 1 carries the d-pad hat switch (0 = up, clockwise, 8 = released).
+ */
+#define DPAD_BUTTONS(v)                                                  \
+    ((v) == 0   ? STADIA_BUTTON_UP                                       \
+     : (v) == 1 ? STADIA_BUTTON_UP | STADIA_BUTTON_RIGHT                 \
+     : (v) == 2 ? STADIA_BUTTON_RIGHT                                    \
+     : (v) == 3 ? STADIA_BUTTON_RIGHT | STADIA_BUTTON_DOWN               \
+     : (v) == 4 ? STADIA_BUTTON_DOWN                                     \
+     : (v) == 5 ? STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT                \
+     : (v) == 6 ? STADIA_BUTTON_LEFT                                     \
+     : (v) == 7 ? STADIA_BUTTON_LEFT | STADIA_BUTTON_UP                  \
+                : STADIA_BUTTON_NONE)
+
+#define BYTE2_BUTTONS(v)                                                 \
+    ((((v) & (1 << 7)) != 0 ? STADIA_BUTTON_RS : 0) |                    \
+     (((v) & (1 << 6)) != 0 ? STADIA_BUTTON_OPTIONS : 0) |               \
+     (((v) & (1 << 5)) != 0 ? STADIA_BUTTON_MENU : 0) |                  \
+     (((v) & (1 << 4)) != 0 ? STADIA_BUTTON_STADIA_BTN : 0))
+
+#define BYTE3_BUTTONS(v)                                                 \
+    ((((v) & (1 << 6)) != 0 ? STADIA_BUTTON_A : 0) |                     \
+     (((v) & (1 << 5)) != 0 ? STADIA_BUTTON_B : 0) |                     \
+     (((v) & (1 << 4)) != 0 ? STADIA_BUTTON_X : 0) |                     \
+     (((v) & (1 << 3)) != 0 ? STADIA_BUTTON_Y : 0) |                     \
+     (((v) & (1 << 2)) != 0 ? STADIA_BUTTON_LB : 0) |                    \
+     (((v) & (1 << 1)) != 0 ? STADIA_BUTTON_RB : 0) |                    \
+     (((v) & (1 << 0)) != 0 ? STADIA_BUTTON_LS : 0))
+
+static const DWORD dpad_map[256] = {TABLE_256(DPAD_BUTTONS)};
+static const DWORD byte2_map[256] = {TABLE_256(BYTE2_BUTTONS)};
+static const DWORD byte3_map[256] = {TABLE_256(BYTE3_BUTTONS)};
+
+BOOL stadia_decode_report(const BYTE *buf, size_t len, struct stadia_state *out)
+{
+    // check packet header
+    if (len < STADIA_INPUT_REPORT_MIN_SIZE || buf[0] != STADIA_INPUT_REPORT_ID)
+    {
+        return FALSE;
+    }
+
+    out->buttons = dpad_map[buf[1]] | byte2_map[buf[2]] | byte3_map[buf[3]];
+
+    out->left_stick_x = buf[4];
+    out->left_stick_y = buf[5];
+
+    out->right_stick_x = buf[6];
+    out->right_stick_y = buf[7];
+
+    out->left_trigger = buf[8];
+    out->right_trigger = buf[9];
+
+    return TRUE;
+}
@@ -0,0 +1,120 @@
+/*
+ * slot_table.c -- Growable table of pointers with stable slots and checked handles.
+ */
+
+#include "slot_table.h"
+
+#include <stdlib.h>
+
+// The generation takes the upper half of a handle and never reads 0, so neither does the handle.
+#define _SLOT_TABLE_HANDLE(index, generation) (((DWORD)(generation) << 16) | (DWORD)((index) + 1))
+#define _SLOT_TABLE_GENERATION(handle) ((USHORT)((handle) >> 16))
+
+BOOL slot_table_init(struct slot_table *table, INT initial_capacity, INT limit)
+{
+    if (limit < 1 || limit > SLOT_TABLE_MAX_LIMIT)
+    {
+        return FALSE;
+    }
+    if (initial_capacity < 1 || initial_capacity > limit)
+    {
+        initial_capacity = limit;
+    }
+
+    table->entries = (struct slot_table_entry *)malloc(initial_capacity * sizeof(struct slot_table_entry));
+    if (table->entries == NULL)
+    {
+        return FALSE;
+    }
+
+    table->capacity = initial_capacity;
+    table->used = 0;
+    table->count = 0;
+    table->limit = limit;
+    table->free_head = -1;
+    return TRUE;
+}
+
+void slot_table_free(struct slot_table *table)
+{
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->used = 0;
+    table->count = 0;
+    table->free_head = -1;
+}
+
+DWORD slot_table_add(struct slot_table *table, void *value)
+{
+    if (table->count == table->limit)
+    {
+        return SLOT_TABLE_INVALID_HANDLE;
+    }
+
+    INT index;
+    if (table->free_head >= 0)
+    {
+        index = table->free_head;
+        table->free_head = table->entries[index].next_free;
+    }
+    else
+    {
+        if (table->used == table->capacity)
+        {
+            INT capacity = table->capacity * 2 < table->limit ? table->capacity * 2 : table->limit;
+            struct slot_table_entry *entries = (struct slot_table_entry *)realloc(
+                table->entries, capacity * sizeof(struct slot_table_entry));
+            if (entries == NULL)
+            {
+                return SLOT_TABLE_INVALID_HANDLE;
+            }
+            table->entries = entries;
+            table->capacity = capacity;
+        }
+
+        index = table->used++;
+        table->entries[index].generation = 1;
+    }
+
+    table->entries[index].value = value;
+    table->entries[index].next_free = -1;
+    table->count++;
+
+    return _SLOT_TABLE_HANDLE(index, table->entries[index].generation);
+}
+
+void *slot_table_get(struct slot_table *table, DWORD handle)
+{
+    INT index = SLOT_TABLE_INDEX(handle);
+    if (index < 0 || index >= table->used)
+    {
+        return NULL;
+    }
+
+    struct slot_table_entry *entry = &table->entries[index];
+    if (entry->value == NULL || entry->generation != _SLOT_TABLE_GENERATION(handle))
+    {
+        return NULL;
+    }
+    return entry->value;
+}
+
+void *slot_table_remove(struct slot_table *table, DWORD handle)
+{
+    void *value = slot_table_get(table, handle);
+    if (value == NULL)
+    {
+        return NULL;
+    }
+
+    INT index = SLOT_TABLE_INDEX(handle);
+    struct slot_table_entry *entry = &table->entries[index];
+    entry->value = NULL;
+    entry->generation = entry->generation == 0xFFFF ? 1 : entry->generation + 1;
+    entry->next_free = table->free_head;
+    table->free_head = index;
+    table->count--;
+
+    return value;
+}
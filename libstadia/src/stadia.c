@@ -4,247 +4,611 @@
 
 #include "stadia.h"
 
+#include "capture.h"
 #include "hid.h"
+#include "seqlock.h"
+#include "timer.h"
 #include "utils.h"
 
-#include <stdio.h>
-#include <synchapi.h>
-#include <tchar.h>
-#include <windows.h>
-
-#pragma comment(lib, "kernel32.lib")
-
-#define STADIA_READ_TIMEOUT 10
+#include <stdlib.h>
+#include <string.h>
 
 /*
  * Stadia controller vibration output report identifier.
  */
 #define STADIA_VIBRATION_IDENTIFIER 0x05
 
-static const BYTE init_vibration[5] = {STADIA_VIBRATION_IDENTIFIER, 0x00, 0x00, 0x00, 0x00};
+static int last_error = 0;
 
-static const DWORD dpad_map[8] =
+static void _stadia_release(struct stadia_controller *controller)
+{
+    if (InterlockedDecrement(&controller->refs) == 0)
     {
-        STADIA_BUTTON_UP,
-        STADIA_BUTTON_UP | STADIA_BUTTON_RIGHT,
-        STADIA_BUTTON_RIGHT,
-        STADIA_BUTTON_RIGHT | STADIA_BUTTON_DOWN,
-        STADIA_BUTTON_DOWN,
-        STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT,
-        STADIA_BUTTON_LEFT,
-        STADIA_BUTTON_LEFT | STADIA_BUTTON_UP};
-
-static int last_error = 0;
+        CloseHandle(controller->stopped_event);
+        free(controller->read_buffers);
+        free(controller->write_buffers);
+        free(controller);
+    }
+}
 
-static DWORD WINAPI _stadia_input_thread(LPVOID lparam)
+static void _stadia_finish(struct stadia_controller *controller)
 {
-    struct stadia_controller *controller = (struct stadia_controller *)lparam;
-    INT bytes_read = 0;
+    hid_detach_device(controller->device);
 
-    while (controller->active)
+    controller->stopped = TRUE;
+    while (controller->subscribers != NULL)
     {
-        while ((bytes_read = hid_get_input_report(controller->device, STADIA_READ_TIMEOUT)) == 0)
-            ;
-
-        if (bytes_read < 0)
+        struct stadia_subscriber *subscriber = controller->subscribers;
+        controller->subscribers = subscriber->next;
+        if (subscriber->destroy != NULL)
         {
-            break;
+            subscriber->destroy(controller, subscriber->context);
         }
+    }
 
-        // check packet header
-        if (controller->device->input_buffer[0] != 0x03)
-        {
-            continue;
-        }
+    SetEvent(controller->stopped_event);
+    _stadia_release(controller);
+}
 
-        AcquireSRWLockExclusive(&controller->state_lock);
+static void _stadia_request_done(struct stadia_controller *controller)
+{
+    if (--controller->pending == 0 && controller->stopping)
+    {
+        _stadia_finish(controller);
+    }
+}
 
-        controller->state.buttons = STADIA_BUTTON_NONE;
+static void _stadia_write_vibration(struct stadia_controller *controller)
+{
+    BYTE vibration[STADIA_VIBRATION_REPORT_SIZE] = {STADIA_VIBRATION_IDENTIFIER, 0x0, 0x0, 0x0, 0x0};
 
-        controller->state.buttons |= controller->device->input_buffer[1] < 8 ? dpad_map[controller->device->input_buffer[1]] : 0;
+    if (controller->write_free_count == 0)
+    {
+        // Sent with the newest values once a write completes.
+        controller->vibration_dirty = TRUE;
+        return;
+    }
 
-        controller->state.buttons |= (controller->device->input_buffer[2] & (1 << 7)) != 0 ? STADIA_BUTTON_RS : 0;
-        controller->state.buttons |= (controller->device->input_buffer[2] & (1 << 6)) != 0 ? STADIA_BUTTON_OPTIONS : 0;
-        controller->state.buttons |= (controller->device->input_buffer[2] & (1 << 5)) != 0 ? STADIA_BUTTON_MENU : 0;
-        controller->state.buttons |= (controller->device->input_buffer[2] & (1 << 4)) != 0 ? STADIA_BUTTON_STADIA_BTN : 0;
+    ULONGLONG now_us = timer_now_us();
+    if (!controller->stopping)
+    {
+        // Held back until the interval has passed, by then it goes out with whatever is newest.
+        ULONGLONG due_us = controller->vibration_sent_us + controller->vibration_interval * 1000ULL;
+        if (now_us < due_us)
+        {
+            if (!controller->vibration_scheduled)
+            {
+                controller->vibration_scheduled = TRUE;
+                controller->pending++;
+                io_schedule(controller->engine, &controller->vibration_timer, due_us);
+            }
+            return;
+        }
 
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 6)) != 0 ? STADIA_BUTTON_A : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 5)) != 0 ? STADIA_BUTTON_B : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 4)) != 0 ? STADIA_BUTTON_X : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 3)) != 0 ? STADIA_BUTTON_Y : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 2)) != 0 ? STADIA_BUTTON_LB : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 1)) != 0 ? STADIA_BUTTON_RB : 0;
-        controller->state.buttons |= (controller->device->input_buffer[3] & (1 << 0)) != 0 ? STADIA_BUTTON_LS : 0;
+        AcquireSRWLockExclusive(&controller->vibration_lock);
 
-        controller->state.left_stick_x = controller->device->input_buffer[4];
-        controller->state.left_stick_y = controller->device->input_buffer[5];
+        vibration[2] = controller->big_motor;
+        vibration[4] = controller->small_motor;
+        controller->vibration_unsent = FALSE;
 
-        controller->state.right_stick_x = controller->device->input_buffer[6];
-        controller->state.right_stick_y = controller->device->input_buffer[7];
+        ReleaseSRWLockExclusive(&controller->vibration_lock);
+    }
+    controller->vibration_sent_us = now_us;
 
-        controller->state.left_trigger = controller->device->input_buffer[8];
-        controller->state.right_trigger = controller->device->input_buffer[9];
+    INT slot = controller->write_free[--controller->write_free_count];
+    struct io_request *request = &controller->write_requests[slot];
+    memcpy(request->buffer, vibration, sizeof(vibration));
+    request->length = sizeof(vibration);
 
-        ReleaseSRWLockExclusive(&controller->state_lock);
+    // Over Bluetooth the pad only takes rumble as a feature report.
+    BOOL issued = controller->bluetooth ? hid_write_feature_report(controller->device, request)
+                                        : hid_write_output_report(controller->device, request);
+    if (!issued)
+    {
+        controller->write_free[controller->write_free_count++] = slot;
+        last_error = STADIA_ERROR_IO_FAILURE;
+        return;
+    }
+    controller->pending++;
+}
 
-        stadia_update_callback(controller, &controller->state);
+static void _stadia_stop(struct stadia_controller *controller)
+{
+    if (controller->stopping)
+    {
+        return;
     }
 
-    stadia_controller_destroy(controller);
+    controller->stopping = TRUE;
 
-    return 0;
+    // Leave the motors off, then let the pending reads complete as cancelled.
+    _stadia_write_vibration(controller);
+    for (INT i = 0; i < STADIA_READ_QUEUE_DEPTH; i++)
+    {
+        hid_cancel_request(controller->device, &controller->read_requests[i]);
+    }
 }
 
-static DWORD WINAPI _stadia_output_thread(LPVOID lparam)
+static void _stadia_count_report(struct stadia_controller *controller)
 {
-    struct stadia_controller *controller = (struct stadia_controller *)lparam;
+    ULONGLONG now = controller->report_time_us / 1000;
 
-    BYTE vibration[5] = {STADIA_VIBRATION_IDENTIFIER, 0x0, 0x0, 0x0, 0x0};
+    InterlockedIncrement(&controller->reports_handled);
 
-    HANDLE wait_events[2] = {controller->output_event, controller->stopping_event};
+    controller->report_window_count++;
+    if (now - controller->report_window_start >= 1000)
+    {
+        InterlockedExchange(&controller->reports_per_second,
+                            (LONG)(controller->report_window_count * 1000 / (now - controller->report_window_start)));
+        controller->report_window_start = now;
+        controller->report_window_count = 0;
+    }
 
-    while (controller->active)
+    if (now - controller->stats_window_start >= STADIA_STATS_INTERVAL)
     {
-        DWORD wait_result = WaitForMultipleObjects(2, wait_events, FALSE, INFINITE);
-        if (wait_result == WAIT_OBJECT_0 + 1)
+        controller->stats_window_start = now;
+        for (struct stadia_subscriber *subscriber = controller->subscribers; subscriber != NULL;
+             subscriber = subscriber->next)
         {
-            break;
+            if (subscriber->stats != NULL)
+            {
+                subscriber->stats(controller, subscriber->context);
+            }
         }
+    }
+}
 
-        AcquireSRWLockShared(&controller->vibration_lock);
+static void _stadia_capture_report(struct stadia_controller *controller, const BYTE *report, INT length)
+{
+    // Checked unlocked first so the tap costs nothing while no capture is set.
+    if (controller->capture == NULL)
+    {
+        return;
+    }
 
-        vibration[2] = controller->big_motor;
-        vibration[4] = controller->small_motor;
+    AcquireSRWLockShared(&controller->capture_lock);
+    if (controller->capture != NULL)
+    {
+        capture_writer_write(controller->capture, controller->report_time_us, report, length);
+    }
+    ReleaseSRWLockShared(&controller->capture_lock);
+}
 
-        ReleaseSRWLockShared(&controller->vibration_lock);
+static void _stadia_handle_report(struct stadia_controller *controller, const BYTE *report, INT length)
+{
+    struct stadia_subscriber *subscriber;
+    BOOL decode = FALSE;
 
-        INT result;
-        if (controller->bluetooth)
+    // Subscribers only change from the engine thread, so none come or go while this walks the list.
+    for (subscriber = controller->subscribers; subscriber != NULL; subscriber = subscriber->next)
+    {
+        if (subscriber->report != NULL)
         {
-            result = hid_send_feature_report(controller->device, vibration, sizeof(vibration));
+            subscriber->report(controller, report, length, subscriber->context);
         }
-        else
+        decode |= subscriber->update != NULL;
+    }
+
+    struct stadia_state state;
+    if (!decode || !stadia_decode_report(report, length, &state))
+    {
+        return;
+    }
+
+    seqlock_write_begin(&controller->state_sequence);
+    controller->state = state;
+    seqlock_write_end(&controller->state_sequence);
+
+    latency_histogram_record(&controller->latency.decode, timer_now_us() - controller->report_time_us);
+
+    for (subscriber = controller->subscribers; subscriber != NULL; subscriber = subscriber->next)
+    {
+        if (subscriber->update != NULL)
         {
-            result = hid_send_output_report(controller->device, vibration, sizeof(vibration), STADIA_READ_TIMEOUT);
+            subscriber->update(controller, &controller->state, subscriber->context);
         }
-        printf("send vibration small=%u big=%u ret=%d via %s\n", vibration[4], vibration[2], result,
-               controller->bluetooth ? "bt" : "usb");
+    }
+}
+
+static void _stadia_read_complete(struct io_request *request, INT result)
+{
+    struct stadia_controller *controller = (struct stadia_controller *)request->context;
+
+    if (result > 0 && !controller->stopping)
+    {
+        controller->report_time_us = timer_now_us();
+
+        _stadia_count_report(controller);
+        _stadia_capture_report(controller, request->buffer, result);
+        _stadia_handle_report(controller, request->buffer, result);
 
-        ResetEvent(controller->output_event);
+        // Re-armed right away, an idle pad costs nothing until its next report.
+        if (!controller->stopping && hid_read_input_report(controller->device, request))
+        {
+            return;
+        }
     }
 
-    if (controller->bluetooth)
+    _stadia_stop(controller);
+    _stadia_request_done(controller);
+}
+
+static void _stadia_write_complete(struct io_request *request, INT result)
+{
+    struct stadia_controller *controller = (struct stadia_controller *)request->context;
+
+    controller->write_free[controller->write_free_count++] = (INT)(request - controller->write_requests);
+    if (result < 0)
     {
-        hid_send_feature_report(controller->device, init_vibration, sizeof(init_vibration));
+        last_error = STADIA_ERROR_IO_FAILURE;
     }
     else
     {
-        hid_send_output_report(controller->device, init_vibration, sizeof(init_vibration), STADIA_READ_TIMEOUT);
+        InterlockedIncrement(&controller->vibrations_sent);
+    }
+
+    if (controller->vibration_dirty)
+    {
+        controller->vibration_dirty = FALSE;
+        _stadia_write_vibration(controller);
+    }
+
+    _stadia_request_done(controller);
+}
+
+static void _stadia_vibration_posted(struct io_request *request, INT result)
+{
+    struct stadia_controller *controller = (struct stadia_controller *)request->context;
+    (void)result;
+
+    InterlockedExchange(&controller->vibration_queued, FALSE);
+    if (!controller->stopping)
+    {
+        _stadia_write_vibration(controller);
     }
 
-    return 0;
+    _stadia_release(controller);
 }
 
-struct stadia_controller *stadia_controller_create(struct hid_device *device)
+static void _stadia_vibration_due(struct io_request *request, INT result)
 {
-    BOOL bluetooth = _tcsistr(device->path, STADIA_BLT_HW_FILTER) != NULL;
+    struct stadia_controller *controller = (struct stadia_controller *)request->context;
+    (void)result;
 
-    if (bluetooth)
+    controller->vibration_scheduled = FALSE;
+    if (!controller->stopping)
     {
-        if (hid_send_feature_report(device, init_vibration, sizeof(init_vibration)) <= 0)
+        _stadia_write_vibration(controller);
+    }
+
+    _stadia_request_done(controller);
+}
+
+static void _stadia_stop_posted(struct io_request *request, INT result)
+{
+    struct stadia_controller *controller = (struct stadia_controller *)request->context;
+    (void)result;
+
+    _stadia_stop(controller);
+    _stadia_release(controller);
+}
+
+static void _stadia_subscribe_posted(struct io_request *request, INT result)
+{
+    struct stadia_subscriber *subscriber = (struct stadia_subscriber *)request->context;
+    struct stadia_controller *controller = subscriber->controller;
+    (void)result;
+
+    if (controller->stopped)
+    {
+        if (subscriber->destroy != NULL)
         {
-            last_error = STADIA_ERROR_VIBRATION_INIT_FAILURE;
+            subscriber->destroy(controller, subscriber->context);
         }
     }
     else
     {
-        if (hid_send_output_report(device, init_vibration, sizeof(init_vibration), STADIA_READ_TIMEOUT) <= 0)
+        // Appended, so subscribers are called in the order they subscribed.
+        struct stadia_subscriber **tail = &controller->subscribers;
+        while (*tail != NULL)
         {
-            last_error = STADIA_ERROR_VIBRATION_INIT_FAILURE;
+            tail = &(*tail)->next;
         }
+        subscriber->next = NULL;
+        *tail = subscriber;
     }
 
-    SECURITY_ATTRIBUTES security = {.nLength = sizeof(SECURITY_ATTRIBUTES),
-                                    .lpSecurityDescriptor = NULL,
-                                    .bInheritHandle = TRUE};
+    _stadia_release(controller);
+}
+
+static void _stadia_unsubscribe_posted(struct io_request *request, INT result)
+{
+    struct stadia_subscriber *subscriber = (struct stadia_subscriber *)request->context;
+    struct stadia_controller *controller = subscriber->controller;
+    (void)result;
+
+    // Not found once the controller has stopped, its destroy callback has already run then.
+    for (struct stadia_subscriber **cur = &controller->subscribers; *cur != NULL; cur = &(*cur)->next)
+    {
+        if (*cur == subscriber)
+        {
+            *cur = subscriber->next;
+            if (subscriber->destroy != NULL)
+            {
+                subscriber->destroy(controller, subscriber->context);
+            }
+            break;
+        }
+    }
+
+    _stadia_release(controller);
+}
+
+static void _stadia_init_request(void *context, struct io_request *request, io_complete_fn complete)
+{
+    memset(request, 0, sizeof(struct io_request));
+    request->complete = complete;
+    request->context = context;
+}
+
+static void _stadia_init_subscriber(struct stadia_controller *controller, struct stadia_subscriber *subscriber)
+{
+    subscriber->controller = controller;
+    subscriber->next = NULL;
+    _stadia_init_request(subscriber, &subscriber->subscribe_request, _stadia_subscribe_posted);
+    _stadia_init_request(subscriber, &subscriber->unsubscribe_request, _stadia_unsubscribe_posted);
+}
+
+struct stadia_controller *stadia_controller_create(struct io_engine *engine, struct hid_device *device,
+                                                   struct stadia_subscriber *subscriber)
+{
+    BOOL bluetooth = device->bus == HID_BUS_BLUETOOTH || _tcsistr(device->path, STADIA_BLT_HW_FILTER) != NULL;
 
     struct stadia_controller *controller = (struct stadia_controller *)malloc(sizeof(struct stadia_controller));
     controller->device = device;
+    controller->engine = engine;
     controller->bluetooth = bluetooth;
-    controller->active = TRUE;
+    controller->subscribers = NULL;
+    controller->stopping = FALSE;
+    controller->stopped = FALSE;
+    controller->pending = 0;
+    controller->write_free_count = 0;
+    controller->vibration_dirty = FALSE;
+    controller->vibration_queued = FALSE;
+    controller->stop_queued = FALSE;
+    controller->small_motor = 0;
+    controller->big_motor = 0;
+    controller->vibration_unsent = FALSE;
+    controller->vibration_interval = bluetooth ? STADIA_BLT_VIBRATION_INTERVAL : STADIA_USB_VIBRATION_INTERVAL;
+    controller->vibrations_sent = 0;
+    controller->vibrations_dropped = 0;
+    controller->vibration_scheduled = FALSE;
+    controller->report_time_us = timer_now_us();
+    controller->report_window_start = controller->report_time_us / 1000;
+    controller->stats_window_start = controller->report_window_start;
+    controller->vibration_sent_us = 0;
+    controller->report_window_count = 0;
+    controller->reports_handled = 0;
+    controller->reports_per_second = 0;
+    controller->capture = NULL;
+    stadia_controller_reset_latency(controller);
+    controller->state_sequence = 0;
+    memset(&controller->state, 0, sizeof(struct stadia_state));
+
+    // The engine holds one reference until the destroy callback has run, the caller the other.
+    controller->refs = 2;
 
     // Create locks.
-    InitializeSRWLock(&controller->state_lock);
     InitializeSRWLock(&controller->vibration_lock);
+    InitializeSRWLock(&controller->capture_lock);
 
     // Create events.
-    controller->stopping_event = CreateEvent(&security, TRUE, FALSE, NULL);
-    controller->output_event = CreateEvent(&security, TRUE, FALSE, NULL);
+    controller->stopped_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    // Create requests.
+    controller->read_buffers = (BYTE *)malloc(STADIA_READ_QUEUE_DEPTH * device->input_report_size);
+    for (INT i = 0; i < STADIA_READ_QUEUE_DEPTH; i++)
+    {
+        _stadia_init_request(controller, &controller->read_requests[i], _stadia_read_complete);
+        controller->read_requests[i].buffer = &controller->read_buffers[i * device->input_report_size];
+        controller->read_requests[i].length = device->input_report_size;
+    }
+    // Sized for whichever report carries rumble on this transport, backends may pad it in place.
+    USHORT write_size = bluetooth ? device->feature_report_size : device->output_report_size;
+    if (write_size < STADIA_VIBRATION_REPORT_SIZE)
+    {
+        write_size = STADIA_VIBRATION_REPORT_SIZE;
+    }
+    controller->write_buffers = (BYTE *)malloc(STADIA_WRITE_QUEUE_DEPTH * write_size);
+    for (INT i = 0; i < STADIA_WRITE_QUEUE_DEPTH; i++)
+    {
+        _stadia_init_request(controller, &controller->write_requests[i], _stadia_write_complete);
+        controller->write_requests[i].buffer = &controller->write_buffers[i * write_size];
+        controller->write_free[controller->write_free_count++] = i;
+    }
+    _stadia_init_request(controller, &controller->vibration_request, _stadia_vibration_posted);
+    _stadia_init_request(controller, &controller->vibration_timer, _stadia_vibration_due);
+    _stadia_init_request(controller, &controller->stop_request, _stadia_stop_posted);
+    if (subscriber != NULL)
+    {
+        _stadia_init_subscriber(controller, subscriber);
+        controller->subscribers = subscriber;
+    }
+
+    if (controller->stopped_event == NULL || !hid_attach_device(device, engine))
+    {
+        if (controller->stopped_event != NULL)
+        {
+            CloseHandle(controller->stopped_event);
+        }
+        free(controller->read_buffers);
+        free(controller->write_buffers);
+        free(controller);
 
-    // Create threads.
-    controller->input_thread = CreateThread(&security, 0, _stadia_input_thread, controller, CREATE_SUSPENDED, NULL);
-    controller->output_thread = CreateThread(&security, 0, _stadia_output_thread, controller, CREATE_SUSPENDED, NULL);
+        last_error = STADIA_ERROR_IO_FAILURE;
+        return NULL;
+    }
 
-    if (controller->input_thread == NULL || controller->output_thread == NULL)
+    // Start reading. Reads can complete on the engine thread while later ones are still being issued,
+    // so the pending count covers all of them up front.
+    controller->pending = STADIA_READ_QUEUE_DEPTH;
+    if (!hid_read_input_report(device, &controller->read_requests[0]))
     {
-        stadia_controller_destroy(controller);
+        hid_detach_device(device);
+        CloseHandle(controller->stopped_event);
+        free(controller->read_buffers);
+        free(controller->write_buffers);
+        free(controller);
 
-        last_error = STADIA_ERROR_THREAD_CREATE_FAILURE;
+        last_error = STADIA_ERROR_IO_FAILURE;
         return NULL;
     }
+    for (INT i = 1; i < STADIA_READ_QUEUE_DEPTH; i++)
+    {
+        if (!hid_read_input_report(device, &controller->read_requests[i]))
+        {
+            // Completes as failed on the engine thread, which stops the controller.
+            io_post(engine, &controller->read_requests[i], IO_FAILED);
+        }
+    }
 
-    ResumeThread(controller->input_thread);
-    ResumeThread(controller->output_thread);
+    // Start with the motors off, the first vibration report also wakes the pad's rumble.
+    controller->vibration_queued = TRUE;
+    InterlockedIncrement(&controller->refs);
+    io_post(engine, &controller->vibration_request, 0);
 
     return controller;
 }
 
-void stadia_controller_set_vibration(struct stadia_controller *controller, BYTE small_motor, BYTE big_motor)
+void stadia_controller_subscribe(struct stadia_controller *controller, struct stadia_subscriber *subscriber)
 {
-    AcquireSRWLockExclusive(&controller->vibration_lock);
+    _stadia_init_subscriber(controller, subscriber);
 
-    controller->small_motor = small_motor;
-    controller->big_motor = big_motor;
+    InterlockedIncrement(&controller->refs);
+    io_post(controller->engine, &subscriber->subscribe_request, 0);
+}
 
-    ReleaseSRWLockExclusive(&controller->vibration_lock);
+void stadia_controller_unsubscribe(struct stadia_controller *controller, struct stadia_subscriber *subscriber)
+{
+    InterlockedIncrement(&controller->refs);
+    io_post(controller->engine, &subscriber->unsubscribe_request, 0);
+}
 
-    SetEvent(controller->output_event);
+void stadia_controller_retain(struct stadia_controller *controller)
+{
+    InterlockedIncrement(&controller->refs);
 }
 
-void stadia_controller_destroy(struct stadia_controller *controller)
+void stadia_controller_release(struct stadia_controller *controller)
 {
-    CancelIoEx(controller->device->handle, &controller->device->input_ol);
+    _stadia_release(controller);
+}
 
-    controller->active = FALSE;
-    SetEvent(controller->stopping_event);
+LONG stadia_controller_get_report_rate(struct stadia_controller *controller)
+{
+    return InterlockedCompareExchange(&controller->reports_per_second, 0, 0);
+}
 
-    HANDLE threads[2];
-    INT thread_count = 0;
+void stadia_controller_get_state(struct stadia_controller *controller, struct stadia_state *state)
+{
+    LONG sequence;
 
-    if (controller->input_thread != NULL)
+    do
     {
-        threads[thread_count++] = controller->input_thread;
-    }
+        sequence = seqlock_read_begin(&controller->state_sequence);
+        *state = controller->state;
+    } while (seqlock_read_retry(&controller->state_sequence, sequence));
+}
+
+ULONGLONG stadia_controller_get_report_time(struct stadia_controller *controller)
+{
+    return controller->report_time_us;
+}
 
-    if (controller->output_thread != NULL)
+void stadia_controller_record_submit(struct stadia_controller *controller, ULONGLONG start_us, ULONGLONG end_us)
+{
+    stadia_controller_record_submit_at(controller, controller->report_time_us, start_us, end_us);
+}
+
+void stadia_controller_record_submit_at(struct stadia_controller *controller, ULONGLONG report_time_us,
+                                        ULONGLONG start_us, ULONGLONG end_us)
+{
+    latency_histogram_record(&controller->latency.dispatch, start_us - report_time_us);
+    latency_histogram_record(&controller->latency.submit, end_us - start_us);
+    latency_histogram_record(&controller->latency.total, end_us - report_time_us);
+}
+
+void stadia_controller_get_latency(struct stadia_controller *controller, struct stadia_latency_summary *summary)
+{
+    latency_histogram_summarize(&controller->latency.decode, &summary->decode);
+    latency_histogram_summarize(&controller->latency.dispatch, &summary->dispatch);
+    latency_histogram_summarize(&controller->latency.submit, &summary->submit);
+    latency_histogram_summarize(&controller->latency.total, &summary->total);
+}
+
+void stadia_controller_reset_latency(struct stadia_controller *controller)
+{
+    latency_histogram_reset(&controller->latency.decode);
+    latency_histogram_reset(&controller->latency.dispatch);
+    latency_histogram_reset(&controller->latency.submit);
+    latency_histogram_reset(&controller->latency.total);
+}
+
+void stadia_controller_set_capture(struct stadia_controller *controller, struct capture_writer *capture)
+{
+    AcquireSRWLockExclusive(&controller->capture_lock);
+    controller->capture = capture;
+    ReleaseSRWLockExclusive(&controller->capture_lock);
+}
+
+void stadia_controller_set_vibration(struct stadia_controller *controller, BYTE small_motor, BYTE big_motor)
+{
+    AcquireSRWLockExclusive(&controller->vibration_lock);
+
+    if (controller->vibration_unsent)
     {
-        threads[thread_count++] = controller->output_thread;
+        InterlockedIncrement(&controller->vibrations_dropped);
     }
+    controller->small_motor = small_motor;
+    controller->big_motor = big_motor;
+    controller->vibration_unsent = TRUE;
 
-    if (thread_count > 0)
+    ReleaseSRWLockExclusive(&controller->vibration_lock);
+
+    // Only one wakeup is queued at a time, it picks up whatever values are newest by then.
+    if (!InterlockedExchange(&controller->vibration_queued, TRUE))
     {
-        WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+        InterlockedIncrement(&controller->refs);
+        io_post(controller->engine, &controller->vibration_request, 0);
     }
+}
 
-    CloseHandle(controller->stopping_event);
-    CloseHandle(controller->output_event);
+void stadia_controller_set_vibration_interval(struct stadia_controller *controller, DWORD interval_ms)
+{
+    InterlockedExchange(&controller->vibration_interval, (LONG)interval_ms);
+}
+
+void stadia_controller_get_vibration_stats(struct stadia_controller *controller, LONG *sent, LONG *dropped)
+{
+    *sent = InterlockedCompareExchange(&controller->vibrations_sent, 0, 0);
+    *dropped = InterlockedCompareExchange(&controller->vibrations_dropped, 0, 0);
+}
 
-    for (INT i = 0; i < thread_count; i++)
+void stadia_controller_destroy(struct stadia_controller *controller)
+{
+    InterlockedIncrement(&controller->refs);
+
+    if (!InterlockedExchange(&controller->stop_queued, TRUE))
     {
-        CloseHandle(threads[i]);
+        InterlockedIncrement(&controller->refs);
+        io_post(controller->engine, &controller->stop_request, 0);
     }
 
-    stadia_destroy_callback(controller);
+    // From the engine thread itself (i.e. from a callback) the stop completes asynchronously.
+    if (!io_engine_is_current(controller->engine))
+    {
+        WaitForSingleObject(controller->stopped_event, INFINITE);
+    }
 
-    free(controller);
-}
\ No newline at end of file
+    _stadia_release(controller);
+}
@@ -0,0 +1,41 @@
+/*
+ * timer.c -- High resolution monotonic clock.
+ */
+
+#include "timer.h"
+
+#ifdef _WIN32
+
+static LONGLONG timer_frequency = 0;
+
+ULONGLONG timer_now_us()
+{
+    LARGE_INTEGER counter;
+
+    if (timer_frequency == 0)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        timer_frequency = frequency.QuadPart;
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    // Split to keep counter * 1000000 from overflowing on long uptimes.
+    return (ULONGLONG)(counter.QuadPart / timer_frequency) * 1000000 +
+           (ULONGLONG)(counter.QuadPart % timer_frequency) * 1000000 / timer_frequency;
+}
+
+#else
+
+#include <time.h>
+
+ULONGLONG timer_now_us()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 1000000 + (ULONGLONG)now.tv_nsec / 1000;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,109 @@
+/*
+ * mapping.h -- Translation of Stadia input into virtual gamepad reports.
+ */
+
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "profile.h"
+
+// The bundled header puts FORCEINLINE after the return type, which MSVC takes and gcc warns about.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-declaration"
+#endif
+#include <ViGEm/Common.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+/*
+ * Byte to XUSB axis value tables: center on 128, clamp to -127 and scale to 32767. The inverted
+ * table is used for the Stadia Y axes, which grow downwards while XUSB ones grow upwards.
+ */
+extern const SHORT mapping_axis_map[256];
+extern const SHORT mapping_axis_inverted_map[256];
+
+/*
+ * Converts the four stick bytes, in report order (left X, left Y, right X, right Y), into the XUSB
+ * thumb values through the profile tables. A NULL or linear profile uses the default mapping,
+ * converting all four at once with SSE2 where available.
+ */
+void mapping_translate_sticks(const struct mapping_profile *profile, const BYTE *sticks, XUSB_REPORT *out);
+void mapping_translate_triggers(const struct mapping_profile *profile, BYTE left, BYTE right, XUSB_REPORT *out);
+
+/*
+ * Translates a raw Stadia input report straight into an XUSB report, without going through
+ * struct stadia_state. Returns FALSE (leaving the report untouched) for anything that is not a
+ * complete input report.
+ */
+BOOL mapping_translate_xusb(const struct mapping_profile *profile, const BYTE *buf, size_t len, XUSB_REPORT *out);
+
+/*
+ * Centered sticks, released d-pad and no finger on the touchpad.
+ */
+void mapping_ds4_report_init(DS4_REPORT_EX *report);
+
+/*
+ * Translates a raw Stadia input report straight into a DS4 report. The DS4 uses byte axes that
+ * grow downwards like the Stadia ones, so with a NULL or linear profile the sticks and triggers are
+ * copied as they are. Options maps to Share, Menu to Options and the Stadia button to PS; the
+ * digital L2/R2 bits follow the triggers. Only the fields filled here are touched. Returns FALSE
+ * (leaving the report untouched) for anything that is not a complete input report.
+ */
+BOOL mapping_translate_ds4(const struct mapping_profile *profile, const BYTE *buf, size_t len, DS4_REPORT_EX *out);
+
+#define MAPPING_DS4_OUTPUT_RUMBLE 0x01
+#define MAPPING_DS4_OUTPUT_LIGHTBAR 0x02
+
+/*
+ * What a DS4 output report asks for. Flags tell which of the parts the report sets.
+ */
+struct mapping_ds4_output
+{
+    UINT flags;
+
+    BYTE small_motor;
+    BYTE big_motor;
+    DS4_LIGHTBAR_COLOR lightbar;
+};
+
+/*
+ * Parses a DS4 output report, in either its USB (0x05) or Bluetooth (0x11) layout. Returns FALSE
+ * for anything else.
+ */
+BOOL mapping_parse_ds4_output(const BYTE *buf, size_t len, struct mapping_ds4_output *out);
+
+/*
+ * Holds back XUSB or DS4 reports identical to the last one submitted, so a pad sitting still costs no
+ * target updates. An unchanged report is still let through once keep_alive_us has passed since the
+ * last submission, 0 never lets it through. Counters may be read from any thread.
+ */
+struct mapping_filter
+{
+    ULONGLONG keep_alive_us;
+
+    BOOL primed;
+    union
+    {
+        XUSB_REPORT xusb;
+        DS4_REPORT_EX ds4;
+    } last;
+    ULONGLONG last_submit_us;
+
+    volatile LONG submitted;
+    volatile LONG suppressed;
+};
+
+void mapping_filter_init(struct mapping_filter *filter, ULONGLONG keep_alive_us);
+
+/*
+ * Returns TRUE when the report should be submitted, and then remembers it as the last one.
+ */
+BOOL mapping_filter_check(struct mapping_filter *filter, const XUSB_REPORT *report, ULONGLONG now_us);
+BOOL mapping_filter_check_ds4(struct mapping_filter *filter, const DS4_REPORT_EX *report, ULONGLONG now_us);
+
+#endif /* MAPPING_H */
@@ -0,0 +1,108 @@
+/*
+ * profile.h -- Per-device stick and trigger response settings baked into lookup tables.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "compat.h"
+
+#define PROFILE_DEADZONE_NONE 0
+#define PROFILE_DEADZONE_AXIAL 1
+#define PROFILE_DEADZONE_RADIAL 2
+
+#define PROFILE_CURVE_LINEAR 0
+#define PROFILE_CURVE_EXPONENTIAL 1
+#define PROFILE_CURVE_CUSTOM 2
+
+#define PROFILE_CURVE_MAX_POINTS 8
+
+/*
+ * Response curve applied to the deflection left after the deadzones, both in [0, 1]. Custom curves
+ * are piecewise linear through the given points, with (0, 0) and (1, 1) implied at the ends.
+ */
+struct curve_settings
+{
+    UINT type;
+    float exponent;
+
+    UINT point_count;
+    float points_x[PROFILE_CURVE_MAX_POINTS];
+    float points_y[PROFILE_CURVE_MAX_POINTS];
+};
+
+/*
+ * All amounts are fractions of full deflection. Input below deadzone reads as zero, input above
+ * outer_deadzone reads as full deflection, and anti_deadzone is the smallest non-zero output.
+ */
+struct response_settings
+{
+    UINT deadzone_type;
+    float deadzone;
+    float outer_deadzone;
+    float anti_deadzone;
+
+    struct curve_settings curve;
+};
+
+struct profile_settings
+{
+    struct response_settings left_stick;
+    struct response_settings right_stick;
+
+    struct response_settings left_trigger;
+    struct response_settings right_trigger;
+};
+
+struct stick_axes
+{
+    SHORT x;
+    SHORT y;
+};
+
+struct stick_table
+{
+    SHORT x[256];
+    SHORT y[256];
+
+    // 256 x 256 entries indexed by x | (y << 8), only present for radial deadzones.
+    struct stick_axes *radial;
+};
+
+/*
+ * Tables compiled from a struct profile_settings. A profile is immutable once created, so when
+ * settings change a new one is created and swapped in. Linear profiles carry no useful tables and
+ * are translated through the shared default mapping instead.
+ */
+struct mapping_profile
+{
+    BOOL linear;
+
+    struct stick_table left_stick;
+    struct stick_table right_stick;
+
+    BYTE left_trigger[256];
+    BYTE right_trigger[256];
+};
+
+void profile_settings_init(struct profile_settings *settings);
+
+/*
+ * Reads settings from a text file of "key = value" lines grouped under [left_stick], [right_stick],
+ * [left_trigger] and [right_trigger], or [sticks] and [triggers] to set both at once. The keys are
+ * those of struct response_settings:
+ *  - deadzone_type: none, axial or radial (sticks only),
+ *  - deadzone, outer_deadzone and anti_deadzone,
+ *  - curve: linear, exponential or custom, with exponent for exponential curves and points, a list
+ *    of "x:y" pairs in increasing x, for custom ones.
+ * Blank lines and lines starting with '#' or ';' are skipped, keys not given keep their value.
+ *
+ * Returns FALSE, leaving settings untouched, when the file cannot be read or a line is not
+ * understood. Line (if not NULL) is then the number of that line, or 0 when the file could not be
+ * read.
+ */
+BOOL profile_settings_load(LPTSTR path, struct profile_settings *settings, INT *line);
+struct mapping_profile *mapping_profile_create(const struct profile_settings *settings);
+void mapping_profile_free(struct mapping_profile *profile);
+
+#endif /* PROFILE_H */
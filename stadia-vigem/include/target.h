@@ -0,0 +1,124 @@
+/*
+ * target.h -- Virtual gamepads fed with translated Stadia input.
+ *
+ * Targets are created on a sink: the ViGEmBus driver, an in-process loopback that keeps what it is
+ * given, or a socket stand-in that sends reports to a peer. Everything above the sink only sees
+ * struct target, reports going in and rumble coming back.
+ */
+
+#ifndef TARGET_H
+#define TARGET_H
+
+#include "compat.h"
+
+// The bundled header puts FORCEINLINE after the return type, which MSVC takes and gcc warns about.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-declaration"
+#endif
+#include <ViGEm/Common.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#define TARGET_TYPE_X360 0
+#define TARGET_TYPE_DS4 1
+
+#define TARGET_ERROR_NONE 0
+// Nothing to connect to, e.g. the bus driver is not installed.
+#define TARGET_ERROR_NOT_FOUND 1
+#define TARGET_ERROR_VERSION_MISMATCH 2
+#define TARGET_ERROR_CONNECT_FAILURE 3
+
+struct target_sink;
+struct target;
+
+/*
+ * Rumble asked for by whoever reads the target. Runs on a thread of the sink, never once
+ * target_remove has returned.
+ */
+typedef void (*target_rumble_cb)(struct target *target, BYTE small_motor, BYTE big_motor, void *context);
+
+struct target_backend
+{
+    const char *name;
+
+    // The address means whatever the backend makes of it, NULL for its default.
+    struct target_sink *(*connect)(LPTSTR address, INT *error);
+    void (*disconnect)(struct target_sink *sink);
+
+    // Plugs a new pad of the given type in.
+    struct target *(*add)(struct target_sink *sink, UINT type);
+    // Starts passing rumble on. Called at most once per target.
+    BOOL (*listen)(struct target *target);
+    // Each only for targets of its type. Reports are submitted from one thread at a time.
+    BOOL (*submit_xusb)(struct target *target, const XUSB_REPORT *report);
+    BOOL (*submit_ds4)(struct target *target, const DS4_REPORT_EX *report);
+    // Unplugs the pad and frees the target.
+    void (*remove)(struct target *target);
+};
+
+struct target_sink
+{
+    const struct target_backend *backend;
+};
+
+struct target
+{
+    struct target_sink *sink;
+    UINT type;
+
+    target_rumble_cb rumble;
+    void *context;
+};
+
+#ifdef _WIN32
+extern const struct target_backend target_vigem_backend;
+#endif /* _WIN32 */
+
+#ifndef _WIN32
+/*
+ * Sends every report as a UDP datagram to the peer at the "host:port" address (127.0.0.1:26760 by
+ * default): the target's identifier (DWORD), its type (BYTE), then the raw report. The peer asks
+ * for rumble with datagrams holding the identifier, the small and the big motor values.
+ */
+extern const struct target_backend target_socket_backend;
+#endif /* _WIN32 */
+
+/*
+ * Keeps the last report of each target in memory and plays rumble back on request, to drive the
+ * whole input path without any driver.
+ */
+extern const struct target_backend target_loopback_backend;
+
+/*
+ * Copies the last report submitted to a loopback target, returns how many have been submitted.
+ * Safe from any thread.
+ */
+LONG target_loopback_get_xusb(struct target *target, XUSB_REPORT *report);
+LONG target_loopback_get_ds4(struct target *target, DS4_REPORT_EX *report);
+
+/*
+ * Plays the part of a game asking a loopback target for rumble. The rumble callback, if listening,
+ * runs on the calling thread.
+ */
+void target_loopback_rumble(struct target *target, BYTE small_motor, BYTE big_motor);
+
+/*
+ * On failure, error (if not NULL) tells why and NULL is returned.
+ */
+struct target_sink *target_sink_connect(const struct target_backend *backend, LPTSTR address, INT *error);
+void target_sink_disconnect(struct target_sink *sink);
+
+struct target *target_add(struct target_sink *sink, UINT type);
+
+/*
+ * Rumble is only passed on from here, so the callback may rely on whatever the caller sets up
+ * between adding the target and listening to it.
+ */
+BOOL target_listen(struct target *target, target_rumble_cb rumble, void *context);
+BOOL target_submit_xusb(struct target *target, const XUSB_REPORT *report);
+BOOL target_submit_ds4(struct target *target, const DS4_REPORT_EX *report);
+void target_remove(struct target *target);
+
+#endif /* TARGET_H */
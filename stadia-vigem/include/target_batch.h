@@ -0,0 +1,77 @@
+/*
+ * target_batch.h -- Submission of the reports of all targets together, once per window.
+ *
+ * Reports queued within the window are held back and submitted in one pass from the engine thread
+ * when it closes. Only the newest report of a target goes out, each one it superseded is a
+ * submission saved, and no report waits longer than the window (to within the engine's timer
+ * resolution).
+ */
+
+#ifndef TARGET_BATCH_H
+#define TARGET_BATCH_H
+
+#include "compat.h"
+#include "io.h"
+#include "stadia.h"
+#include "target.h"
+
+/*
+ * One target's place in the batch, owned by whoever feeds the target.
+ */
+struct target_batch_entry
+{
+    struct target *target;
+
+    // Only touched from the engine thread.
+    struct stadia_controller *controller;
+    // Of the queued report, the controller may have handled others by the time it goes out.
+    ULONGLONG report_time_us;
+    union
+    {
+        XUSB_REPORT xusb;
+        DS4_REPORT_EX ds4;
+    } report;
+    BOOL queued;
+    struct target_batch_entry *next;
+};
+
+/*
+ * Everything but the counters is only touched from the engine thread. Counters may be read from any
+ * thread.
+ */
+struct target_batch
+{
+    struct io_engine *engine;
+    ULONGLONG window_us;
+
+    // Oldest first, each entry at most once.
+    struct target_batch_entry *head;
+    struct target_batch_entry **tail;
+    BOOL scheduled;
+    struct io_request flush_request;
+
+    volatile LONG flushes;
+    volatile LONG queued;
+    volatile LONG submitted;
+};
+
+void target_batch_init(struct target_batch *batch, struct io_engine *engine, ULONGLONG window_us);
+void target_batch_entry_init(struct target_batch_entry *entry, struct target *target);
+
+/*
+ * Queue the report for the next flush, replacing the one the target already has queued, if any. The
+ * submission is recorded to the controller's latency once it is made, timed from the report being
+ * handled now. Only from the engine thread, from the controller's update or report callbacks.
+ */
+void target_batch_queue_xusb(struct target_batch *batch, struct target_batch_entry *entry,
+                             struct stadia_controller *controller, const XUSB_REPORT *report);
+void target_batch_queue_ds4(struct target_batch *batch, struct target_batch_entry *entry,
+                            struct stadia_controller *controller, const DS4_REPORT_EX *report);
+
+/*
+ * Drops the report the target has queued, if any. Only from the engine thread, the entry and its
+ * target may go once it returns.
+ */
+void target_batch_cancel(struct target_batch *batch, struct target_batch_entry *entry);
+
+#endif /* TARGET_BATCH_H */
@@ -43,4 +43,9 @@ void tray_exit();
 void tray_register_device_notification(GUID filter, void (*cb)(UINT, LPTSTR));
 void tray_show_notification(UINT type, LPTSTR title, LPTSTR text);
 
+/*
+ * Runs cb on the thread running the tray loop, from any thread. Dropped once the tray has exited.
+ */
+void tray_invoke(void (*cb)(void *), void *context);
+
 #endif /* TRAY_H */
@@ -8,34 +8,103 @@
 #include <windows.h>
 #include <synchapi.h>
 
-#include <ViGEm/Client.h>
-
 #include "tray.h"
+#include "capture.h"
+#include "device_cache.h"
+#include "discovery.h"
 #include "hid.h"
+#include "mapping.h"
+#include "slot_table.h"
 #include "stadia.h"
+#include "target.h"
+#include "target_batch.h"
+#include "timer.h"
 
 #ifndef _DEBUG
 #pragma comment(linker, "/SUBSYSTEM:windows /ENTRY:mainCRTStartup")
 #endif
 
-#define MAX_ACTIVE_DEVICE_COUNT 4
-#define DEVICE_COUNT_TEMPLATE TEXT("%d/4 device(s) connected")
+// XInput only sees four pads, more are still useful to applications reading them another way.
+#define DEFAULT_MAX_ACTIVE_DEVICE_COUNT 4
+#define MAX_ACTIVE_DEVICE_COUNT_VARIABLE TEXT("STADIA_VIGEM_MAX_DEVICES")
+#define DEVICE_COUNT_TEMPLATE TEXT("%d/%d device(s) connected")
+
+// When set, the input of every device is recorded to a capture file in this directory.
+#define CAPTURE_DIR_VARIABLE TEXT("STADIA_VIGEM_CAPTURE_DIR")
+#define CAPTURE_FILE_TEMPLATE TEXT("%s\\stadia-%lu-%ld.stcap")
+
+// How each known device was last opened, kept in the local application data directory.
+#define DEVICE_CACHE_DIR_VARIABLE TEXT("LOCALAPPDATA")
+#define DEVICE_CACHE_FILE_TEMPLATE TEXT("%s\\stadia-vigem-devices.bin")
+
+// Stick and trigger response settings of all devices (see profile.h), next to the device cache.
+#define PROFILE_FILE_TEMPLATE TEXT("%s\\stadia-vigem-profile.ini")
+#define PROFILE_ERROR_TEMPLATE TEXT("Error in profile file on line %d")
+
+// Per-device settings kept in the device cache.
+#define DEVICE_SETTING_DS4_TARGET 0x1
+#define DEVICE_MENU_TEMPLATE TEXT("Device %d")
+
+// When set to "loopback", targets are kept in memory instead of going to ViGEmBus, e.g. to time
+// the input path on a machine without the driver.
+#define TARGET_SINK_VARIABLE TEXT("STADIA_VIGEM_TARGET_SINK")
+#define TARGET_SINK_LOOPBACK TEXT("loopback")
+
+// Bursts of device notifications are handled together once quiet for this long, in milliseconds.
+#define HOTPLUG_DEBOUNCE_INTERVAL 250
+
+// Unchanged target reports are still resent this often, in milliseconds.
+#define TARGET_KEEP_ALIVE_INTERVAL 1000
+
+// When set, target reports of all devices are held back and submitted together once per this many
+// milliseconds, trading up to that much latency for fewer submissions. Unset or 0 submits each
+// report right away.
+#define BATCH_WINDOW_VARIABLE TEXT("STADIA_VIGEM_BATCH_WINDOW")
+#define MAX_BATCH_WINDOW 50
 
 struct active_device
 {
+    // One reference for the device table, released by the destroy callback, one for add_device.
+    LONG refs;
+    // Entry in active_devices, SLOT_TABLE_INVALID_HANDLE once removed from it.
+    DWORD handle;
+
     struct hid_device *src_device;
     struct stadia_controller *controller;
-    PVIGEM_TARGET tgt_device;
+    // Feeds the virtual pad, either from decoded state or straight from the raw reports.
+    struct stadia_subscriber subscriber;
+    // Either an Xbox 360 or a DualShock 4 pad, fixed for as long as the device stays connected.
+    BOOL ds4;
+    // NULL when there is nothing to emulate it on.
+    struct target *target;
     XUSB_REPORT tgt_report;
+    DS4_REPORT_EX ds4_report;
+    struct mapping_filter tgt_filter;
+    // Only used when batching.
+    struct target_batch_entry batch_entry;
+    struct mapping_profile *profile;
+    struct capture_writer *capture;
 };
 
-static int active_device_count = 0;
-static struct active_device *active_devices[MAX_ACTIVE_DEVICE_COUNT];
+static struct slot_table active_devices;
 static SRWLOCK active_devices_lock = SRWLOCK_INIT;
-static PVIGEM_CLIENT vigem_client;
-static BOOL vigem_connected = FALSE;
+static LPTSTR stadia_hw_path_filters[3] = {STADIA_USB_HW_FILTER, STADIA_BLT_HW_FILTER, NULL};
+static struct io_engine *io_engine;
+static struct discovery *discovery;
+// The discovery worker opens devices, the tray thread changes their settings.
+static struct device_cache *device_cache;
+static SRWLOCK device_cache_lock = SRWLOCK_INIT;
+// NULL when the sink could not be connected.
+static struct target_sink *target_sink;
+static BOOL direct_translation = TRUE;
+static DWORD batch_window;
+static struct target_batch target_batch;
+// The discovery worker bakes profiles from the settings, the tray thread reloads them.
+static struct profile_settings profile_settings;
+static SRWLOCK profile_settings_lock = SRWLOCK_INIT;
 
 static struct tray_menu tray_menu_device_count;
+static struct tray_menu tray_menu_ds4_target = {.text = TEXT("DualShock 4 target")};
 
 static void attach_parent_console()
 {
@@ -51,15 +120,26 @@ static void attach_parent_console()
 }
 
 // future declarations
-static void stadia_controller_update_cb(struct stadia_controller *controller, struct stadia_state *state);
-static void stadia_controller_stop_cb(struct stadia_controller *controller);
-static void CALLBACK x360_notification_cb(PVIGEM_CLIENT client, PVIGEM_TARGET target, UCHAR large_motor,
-                                          UCHAR small_motor, UCHAR led_number, LPVOID user_data);
+static void stadia_controller_update_cb(struct stadia_controller *controller, const struct stadia_state *state,
+                                       void *context);
+static void stadia_controller_report_cb(struct stadia_controller *controller, const BYTE *report, size_t length,
+                                       void *context);
+static void stadia_controller_ds4_report_cb(struct stadia_controller *controller, const BYTE *report, size_t length,
+                                           void *context);
+static void stadia_controller_stop_cb(struct stadia_controller *controller, void *context);
+static void stadia_controller_stats_cb(struct stadia_controller *controller, void *context);
+static void target_rumble_cb(struct target *target, BYTE small_motor, BYTE big_motor, void *context);
+static void set_translation(struct active_device *active_device, BOOL direct);
 static void refresh_cb(struct tray_menu *item);
+static void direct_translation_cb(struct tray_menu *item);
+static void ds4_target_cb(struct tray_menu *item);
+static void reload_profile_cb(struct tray_menu *item);
 static void quit_cb(struct tray_menu *item);
 
 static const struct tray_menu tray_menu_refresh = {.text = TEXT("Refresh"), .cb = refresh_cb};
+static const struct tray_menu tray_menu_reload_profile = {.text = TEXT("Reload profile"), .cb = reload_profile_cb};
 static const struct tray_menu tray_menu_quit = {.text = TEXT("Quit"), .cb = quit_cb};
+static struct tray_menu tray_menu_direct_translation = {.text = TEXT("Direct translation"), .cb = direct_translation_cb};
 static const struct tray_menu tray_menu_separator = {.text = TEXT("-")};
 static const struct tray_menu tray_menu_terminator = {.text = NULL};
 static struct tray tray =
@@ -68,41 +148,80 @@ static struct tray tray =
         .tip = TEXT("Stadia Controller"),
         .menu = NULL};
 
-SHORT FORCEINLINE _map_byte_to_short(BYTE value, BOOL inverted)
+// One entry per device, checked when it has a DS4 target. Under active_devices_lock.
+static struct tray_menu *build_ds4_target_menu()
 {
-    CHAR centered = value - 128;
-    if (centered < -127)
+    struct tray_menu *menu = (struct tray_menu *)malloc((active_devices.count + 1) * sizeof(struct tray_menu));
+    int index = 0;
+
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
     {
-        centered = -127;
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device == NULL)
+        {
+            continue;
+        }
+
+        INT text_length = _sctprintf(DEVICE_MENU_TEMPLATE, i);
+        memset(&menu[index], 0, sizeof(struct tray_menu));
+        menu[index].text = (LPTSTR)malloc((text_length + 1) * sizeof(TCHAR));
+        _stprintf(menu[index].text, DEVICE_MENU_TEMPLATE, i);
+        menu[index].checked = active_device->ds4;
+        menu[index].cb = ds4_target_cb;
+        // The handle, unlike the entry, stays safe to use once the device is gone.
+        menu[index++].context = (void *)(ULONG_PTR)active_device->handle;
+    }
+
+    menu[index].text = NULL;
+    return menu;
+}
+
+static void free_ds4_target_menu(struct tray_menu *menu)
+{
+    if (menu == NULL)
+    {
+        return;
     }
-    if (inverted)
+
+    for (struct tray_menu *item = menu; item->text != NULL; item++)
     {
-        centered = -centered;
+        free(item->text);
     }
-    return (SHORT)(32767 * centered / 127);
+    free(menu);
 }
 
 static void rebuild_tray_menu()
 {
     struct tray_menu *prev_menu = tray.menu;
     
-    struct tray_menu *new_menu = (struct tray_menu *)malloc(5 * sizeof(struct tray_menu));
+    struct tray_menu *new_menu = (struct tray_menu *)malloc(9 * sizeof(struct tray_menu));
     int index = 0;
 
     AcquireSRWLockShared(&active_devices_lock);
 
+    struct tray_menu *old_ds4_target_menu = tray_menu_ds4_target.submenu;
+    tray_menu_ds4_target.submenu = build_ds4_target_menu();
+    // Settings can only be changed when they can be remembered.
+    tray_menu_ds4_target.disabled = active_devices.count == 0 || device_cache == NULL;
+
     LPTSTR old_device_count_text = tray_menu_device_count.text;
 
-    INT tray_text_length = _sctprintf(DEVICE_COUNT_TEMPLATE, active_device_count);
+    INT tray_text_length = _sctprintf(DEVICE_COUNT_TEMPLATE, active_devices.count, active_devices.limit);
     tray_menu_device_count.text = (LPTSTR)malloc((tray_text_length + 1) * sizeof(TCHAR));
-    _stprintf(tray_menu_device_count.text, DEVICE_COUNT_TEMPLATE, active_device_count);
+    _stprintf(tray_menu_device_count.text, DEVICE_COUNT_TEMPLATE, active_devices.count, active_devices.limit);
 
     free(old_device_count_text);
+    free_ds4_target_menu(old_ds4_target_menu);
 
     ReleaseSRWLockShared(&active_devices_lock);
 
     new_menu[index++] = tray_menu_device_count;
     new_menu[index++] = tray_menu_separator;
+    tray_menu_direct_translation.checked = direct_translation;
+    new_menu[index++] = tray_menu_direct_translation;
+    new_menu[index++] = tray_menu_ds4_target;
+    new_menu[index++] = tray_menu_reload_profile;
+    new_menu[index++] = tray_menu_separator;
     new_menu[index++] = tray_menu_refresh;
     new_menu[index++] = tray_menu_quit;
     new_menu[index++] = tray_menu_terminator;
@@ -111,70 +230,341 @@ static void rebuild_tray_menu()
     free(prev_menu);
 }
 
-static BOOL add_device(LPTSTR path)
+static void update_tray_cb(void *context)
+{
+    (void)context;
+    rebuild_tray_menu();
+    tray_update(&tray);
+}
+
+// The menu is only rebuilt on the tray thread, other threads ask for it here.
+static void post_tray_update()
 {
-    if (active_device_count == MAX_ACTIVE_DEVICE_COUNT)
+    tray_invoke(update_tray_cb, NULL);
+}
+
+static struct capture_writer *open_capture()
+{
+    static LONG capture_index = 0;
+    TCHAR dir[MAX_PATH];
+    TCHAR path[MAX_PATH];
+
+    DWORD length = GetEnvironmentVariable(CAPTURE_DIR_VARIABLE, dir, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return NULL;
+    }
+
+    if (_sntprintf(path, MAX_PATH, CAPTURE_FILE_TEMPLATE, dir, GetCurrentProcessId(),
+                   InterlockedIncrement(&capture_index)) < 0)
+    {
+        return NULL;
+    }
+    path[MAX_PATH - 1] = 0;
+
+    return capture_writer_open(path, TRUE);
+}
+
+static INT get_max_active_device_count()
+{
+    TCHAR value[16];
+
+    DWORD length = GetEnvironmentVariable(MAX_ACTIVE_DEVICE_COUNT_VARIABLE, value, 16);
+    if (length == 0 || length >= 16)
+    {
+        return DEFAULT_MAX_ACTIVE_DEVICE_COUNT;
+    }
+
+    INT count = _ttoi(value);
+    if (count < 1 || count > SLOT_TABLE_MAX_LIMIT)
+    {
+        return DEFAULT_MAX_ACTIVE_DEVICE_COUNT;
+    }
+    return count;
+}
+
+static DWORD get_batch_window()
+{
+    TCHAR value[16];
+
+    DWORD length = GetEnvironmentVariable(BATCH_WINDOW_VARIABLE, value, 16);
+    if (length == 0 || length >= 16)
+    {
+        return 0;
+    }
+
+    INT window = _ttoi(value);
+    if (window < 0 || window > MAX_BATCH_WINDOW)
+    {
+        return 0;
+    }
+    return (DWORD)window;
+}
+
+static const struct target_backend *get_target_backend()
+{
+    TCHAR value[16];
+
+    DWORD length = GetEnvironmentVariable(TARGET_SINK_VARIABLE, value, 16);
+    if (length != 0 && length < 16 && _tcsicmp(value, TARGET_SINK_LOOPBACK) == 0)
+    {
+        return &target_loopback_backend;
+    }
+    return &target_vigem_backend;
+}
+
+static struct device_cache *load_device_cache()
+{
+    TCHAR dir[MAX_PATH];
+    TCHAR path[MAX_PATH];
+
+    DWORD length = GetEnvironmentVariable(DEVICE_CACHE_DIR_VARIABLE, dir, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return NULL;
+    }
+
+    if (_sntprintf(path, MAX_PATH, DEVICE_CACHE_FILE_TEMPLATE, dir) < 0)
+    {
+        return NULL;
+    }
+    path[MAX_PATH - 1] = 0;
+
+    return device_cache_load(path);
+}
+
+// FALSE with line 0 when there is no profile file.
+static BOOL load_profile_settings(struct profile_settings *settings, INT *line)
+{
+    TCHAR dir[MAX_PATH];
+    TCHAR path[MAX_PATH];
+
+    *line = 0;
+    DWORD length = GetEnvironmentVariable(DEVICE_CACHE_DIR_VARIABLE, dir, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return FALSE;
+    }
+
+    if (_sntprintf(path, MAX_PATH, PROFILE_FILE_TEMPLATE, dir) < 0)
     {
-        tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
-                               TEXT("Device count limit reached"));
         return FALSE;
     }
+    path[MAX_PATH - 1] = 0;
+
+    return profile_settings_load(path, settings, line);
+}
+
+static void show_profile_error(INT line)
+{
+    TCHAR text[64];
+
+    _sntprintf(text, 64, PROFILE_ERROR_TEMPLATE, line);
+    text[63] = 0;
+    tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"), text);
+}
+
+/*
+ * Exclusive access is tried first, then again after re-enabling the device to evict whoever holds
+ * it, then shared access. A device remembered as shared skips the slow re-enable, and a remembered
+ * device skips the capability queries.
+ */
+static struct hid_device *open_device(LPTSTR path)
+{
+    struct hid_caps caps;
+    UINT open_mode = DEVICE_CACHE_OPEN_EXCLUSIVE;
+    AcquireSRWLockExclusive(&device_cache_lock);
+    BOOL cached = device_cache != NULL && device_cache_lookup(device_cache, path, &caps, &open_mode);
+    ReleaseSRWLockExclusive(&device_cache_lock);
+    const struct hid_caps *known_caps = cached ? &caps : NULL;
+    BOOL reenable = open_mode != DEVICE_CACHE_OPEN_SHARED;
 
-    struct hid_device *device = hid_open_device(path, TRUE, FALSE);
+    struct hid_device *device = hid_open_device(&hid_win32_backend, path, TRUE, FALSE, known_caps);
+    open_mode = DEVICE_CACHE_OPEN_EXCLUSIVE;
+    if (device == NULL && reenable && hid_reenable_device(path))
+    {
+        device = hid_open_device(&hid_win32_backend, path, TRUE, FALSE, known_caps);
+        open_mode = DEVICE_CACHE_OPEN_REENABLED;
+    }
     if (device == NULL)
     {
-        if (hid_reenable_device(path))
-        {
-            device = hid_open_device(path, TRUE, FALSE);
-            if (device == NULL)
-            {
-                device = hid_open_device(path, TRUE, TRUE);
-            }
-        }
-        else
-        {
-            device = hid_open_device(path, TRUE, TRUE);
-        }
+        device = hid_open_device(&hid_win32_backend, path, TRUE, TRUE, known_caps);
+        open_mode = DEVICE_CACHE_OPEN_SHARED;
     }
 
     if (device == NULL)
+    {
+        return NULL;
+    }
+
+    if (device_cache != NULL)
+    {
+        hid_get_caps(device, &caps);
+        AcquireSRWLockExclusive(&device_cache_lock);
+        device_cache_store(device_cache, path, &caps, open_mode);
+        ReleaseSRWLockExclusive(&device_cache_lock);
+    }
+
+    return device;
+}
+
+static void release_active_device(struct active_device *active_device)
+{
+    if (InterlockedDecrement(&active_device->refs) != 0)
+    {
+        return;
+    }
+
+    if (active_device->target != NULL)
+    {
+        target_remove(active_device->target);
+    }
+
+    if (active_device->controller != NULL)
+    {
+        stadia_controller_release(active_device->controller);
+    }
+
+    hid_close_device(active_device->src_device);
+    hid_free_device(active_device->src_device);
+
+    if (active_device->profile != NULL)
+    {
+        mapping_profile_free(active_device->profile);
+    }
+    if (active_device->capture != NULL)
+    {
+        capture_writer_close(active_device->capture);
+    }
+    free(active_device);
+}
+
+static BOOL remove_device(struct active_device *active_device)
+{
+    BOOL removed = FALSE;
+
+    AcquireSRWLockExclusive(&active_devices_lock);
+
+    if (slot_table_remove(&active_devices, active_device->handle) != NULL)
+    {
+        active_device->handle = SLOT_TABLE_INVALID_HANDLE;
+        removed = TRUE;
+    }
+
+    ReleaseSRWLockExclusive(&active_devices_lock);
+
+    return removed;
+}
+
+static BOOL add_device(LPTSTR path)
+{
+    AcquireSRWLockShared(&active_devices_lock);
+    BOOL full = active_devices.count == active_devices.limit;
+    ReleaseSRWLockShared(&active_devices_lock);
+
+    if (full)
     {
         tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
-                               TEXT("Error opening new device"));
+                               TEXT("Device count limit reached"));
         return FALSE;
     }
 
-    struct stadia_controller *controller = stadia_controller_create(device);
-    if (controller == NULL)
+    struct hid_device *device = open_device(path);
+    if (device == NULL)
     {
         tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
-                               TEXT("Error initializing new device"));
-        hid_close_device(device);
-        hid_free_device(device);
+                               TEXT("Error opening new device"));
         return FALSE;
     }
 
+    DWORD settings = 0;
+    if (device_cache != NULL)
+    {
+        AcquireSRWLockExclusive(&device_cache_lock);
+        settings = device_cache_get_settings(device_cache, path);
+        ReleaseSRWLockExclusive(&device_cache_lock);
+    }
+
     struct active_device *active_device = (struct active_device *)malloc(sizeof(struct active_device));
+    active_device->refs = 2;
     active_device->src_device = device;
-    active_device->controller = controller;
+    active_device->controller = NULL;
+    active_device->ds4 = (settings & DEVICE_SETTING_DS4_TARGET) != 0;
+    set_translation(active_device, direct_translation);
+    active_device->subscriber.stats = stadia_controller_stats_cb;
+    active_device->subscriber.destroy = stadia_controller_stop_cb;
+    active_device->subscriber.context = active_device;
+    active_device->capture = open_capture();
+    mapping_filter_init(&active_device->tgt_filter, TARGET_KEEP_ALIVE_INTERVAL * 1000ULL);
+
+    active_device->target = target_sink != NULL
+                                ? target_add(target_sink, active_device->ds4 ? TARGET_TYPE_DS4 : TARGET_TYPE_X360)
+                                : NULL;
+    target_batch_entry_init(&active_device->batch_entry, active_device->target);
+    XUSB_REPORT_INIT(&active_device->tgt_report);
+    mapping_ds4_report_init(&active_device->ds4_report);
+
+    // Listed before the controller starts, so its destroy callback always finds the entry. Baked and
+    // listed under the settings lock, so a reload either happened before or finds the device.
+    AcquireSRWLockShared(&profile_settings_lock);
+    active_device->profile = mapping_profile_create(&profile_settings);
+    AcquireSRWLockExclusive(&active_devices_lock);
+    active_device->handle = slot_table_add(&active_devices, active_device);
+    ReleaseSRWLockExclusive(&active_devices_lock);
+    ReleaseSRWLockShared(&profile_settings_lock);
 
-    if (vigem_connected)
+    if (active_device->handle == SLOT_TABLE_INVALID_HANDLE)
     {
-        active_device->tgt_device = vigem_target_x360_alloc();
-        vigem_target_add(vigem_client, active_device->tgt_device);
-        XUSB_REPORT_INIT(&active_device->tgt_report);
-        vigem_target_x360_register_notification(vigem_client, active_device->tgt_device, x360_notification_cb,
-                                                (LPVOID)active_device);
+        tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
+                               TEXT("Device count limit reached"));
+        release_active_device(active_device);
+        release_active_device(active_device);
+        return FALSE;
     }
 
+    struct stadia_controller *controller = stadia_controller_create(io_engine, device, &active_device->subscriber);
+    if (controller == NULL)
+    {
+        tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
+                               TEXT("Error initializing new device"));
+        // Whatever was remembered about it did not help, next time it is opened from scratch.
+        if (device_cache != NULL)
+        {
+            AcquireSRWLockExclusive(&device_cache_lock);
+            device_cache_forget(device_cache, path);
+            ReleaseSRWLockExclusive(&device_cache_lock);
+        }
+        if (remove_device(active_device))
+        {
+            release_active_device(active_device);
+        }
+        release_active_device(active_device);
+        return FALSE;
+    }
+
+    // The creation reference is released with the entry, so a late vibration notification never sees
+    // a freed controller.
     AcquireSRWLockExclusive(&active_devices_lock);
-    active_devices[active_device_count++] = active_device;
+    active_device->controller = controller;
+    BOOL listed = active_device->handle != SLOT_TABLE_INVALID_HANDLE;
     ReleaseSRWLockExclusive(&active_devices_lock);
+    // The release below may be the last one if the controller already stopped.
+    BOOL emulated = active_device->target != NULL;
 
-    rebuild_tray_menu();
-    tray_update(&tray);
+    if (listed)
+    {
+        if (active_device->capture != NULL)
+        {
+            stadia_controller_set_capture(controller, active_device->capture);
+        }
+        if (active_device->target != NULL)
+        {
+            target_listen(active_device->target, target_rumble_cb, active_device);
+        }
+    }
+    release_active_device(active_device);
 
-    if (!vigem_connected)
+    if (!emulated)
     {
         tray_show_notification(NT_TRAY_WARNING, TEXT("Stadia Controller error"),
                                TEXT("Device added, but emulation doesn't work due to ViGEmBus problem"));
@@ -183,136 +573,189 @@ static BOOL add_device(LPTSTR path)
     return TRUE;
 }
 
-static BOOL remove_device(struct stadia_controller *controller)
+// Device notifications and SetupAPI may disagree on the case of a path, so paths are compared
+// case-insensitively. Only under active_devices_lock.
+static struct active_device *find_device(LPTSTR path)
 {
-    BOOL removed = FALSE;
-
-    AcquireSRWLockExclusive(&active_devices_lock);
-
-    for (int i = 0; i < active_device_count; i++)
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
     {
-        if (active_devices[i]->controller == controller)
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device != NULL && _tcsicmp(active_device->src_device->path, path) == 0)
         {
-            hid_close_device(active_devices[i]->src_device);
-            hid_free_device(active_devices[i]->src_device);
-
-            if (vigem_connected)
-            {
-                vigem_target_x360_unregister_notification(active_devices[i]->tgt_device);
-                vigem_target_remove(vigem_client, active_devices[i]->tgt_device);
-                vigem_target_free(active_devices[i]->tgt_device);
-            }
+            return active_device;
+        }
+    }
+    return NULL;
+}
 
-            free(active_devices[i]);
+static struct hid_device_info *enumerate_devices(void *context)
+{
+    (void)context;
+    return hid_enumerate(stadia_hw_path_filters);
+}
 
-            if (i < active_device_count - 1)
-            {
-                memmove(&active_devices[i], &active_devices[i + 1],
-                        sizeof(struct active_device *) * (active_device_count - i - 1));
-            }
+static void device_arrived(LPTSTR path, void *context)
+{
+    (void)context;
 
-            active_device_count--;
-            removed = TRUE;
+    AcquireSRWLockShared(&active_devices_lock);
+    BOOL found = find_device(path) != NULL;
+    ReleaseSRWLockShared(&active_devices_lock);
 
-            break;
-        }
+    if (!found)
+    {
+        add_device(path);
     }
+}
 
-    ReleaseSRWLockExclusive(&active_devices_lock);
-
-    return removed;
+static void destroy_controllers(struct stadia_controller **controllers, int count)
+{
+    // the destroy callback removes the device under the exclusive lock, so destroy outside of it
+    for (int i = 0; i < count; i++)
+    {
+        stadia_controller_destroy(controllers[i]);
+        stadia_controller_release(controllers[i]);
+    }
 }
 
-static void refresh_devices()
+/*
+ * Retains the controllers of the listed devices that are not in the present list, or of every
+ * device when all is set. The returned array is as large as the table and must be freed.
+ */
+static struct stadia_controller **collect_controllers(const struct hid_device_info *present, BOOL all, int *count)
 {
-    LPTSTR stadia_hw_path_filters[3] = {STADIA_USB_HW_FILTER, STADIA_BLT_HW_FILTER, NULL};
-    struct hid_device_info *device_info = hid_enumerate(stadia_hw_path_filters);
-    struct hid_device_info *cur;
-    BOOL found = FALSE;
+    *count = 0;
 
-    // remove missing devices
     AcquireSRWLockShared(&active_devices_lock);
-
-    for (int i = 0; i < active_device_count; i++)
+    struct stadia_controller **controllers = (struct stadia_controller **)malloc(
+        (active_devices.count + 1) * sizeof(struct stadia_controller *));
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
     {
-        found = FALSE;
-        cur = device_info;
-
-        while (cur != NULL)
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device == NULL || active_device->controller == NULL)
         {
-            if (_tcscmp(active_devices[i]->src_device->path, cur->path) == 0)
-            {
-                found = TRUE;
-                break;
-            }
+            continue;
+        }
 
+        const struct hid_device_info *cur = all ? NULL : present;
+        while (cur != NULL && _tcsicmp(active_device->src_device->path, cur->path) != 0)
+        {
             cur = cur->next;
         }
 
-        if (!found)
+        if (cur == NULL)
         {
-            stadia_controller_destroy(active_devices[i]->controller);
+            controllers[*count] = active_device->controller;
+            stadia_controller_retain(controllers[(*count)++]);
         }
     }
+    ReleaseSRWLockShared(&active_devices_lock);
+
+    return controllers;
+}
+
+static void device_removed(LPTSTR path, void *context)
+{
+    struct stadia_controller *controller = NULL;
+    (void)context;
 
+    AcquireSRWLockShared(&active_devices_lock);
+    struct active_device *active_device = find_device(path);
+    if (active_device != NULL && active_device->controller != NULL)
+    {
+        controller = active_device->controller;
+        stadia_controller_retain(controller);
+    }
     ReleaseSRWLockShared(&active_devices_lock);
 
-    // add new devices
-    cur = device_info;
-    while (cur != NULL)
+    destroy_controllers(&controller, controller != NULL ? 1 : 0);
+}
+
+static void prune_devices(const struct hid_device_info *present, void *context)
+{
+    int missing_count;
+    (void)context;
+
+    struct stadia_controller **missing = collect_controllers(present, FALSE, &missing_count);
+    destroy_controllers(missing, missing_count);
+    free(missing);
+}
+
+static void discovery_done(void *context)
+{
+    (void)context;
+    post_tray_update();
+}
+
+static const struct discovery_handler discovery_handler = {
+    .enumerate = enumerate_devices,
+    .arrived = device_arrived,
+    .removed = device_removed,
+    .prune = prune_devices,
+    .done = discovery_done};
+
+static void device_change_cb(UINT op, LPTSTR path)
+{
+    // Other events (e.g. DBT_DEVNODES_CHANGED, broadcast for any device) say nothing about ours.
+    if (op == DO_TRAY_UNKNOWN)
     {
-        found = FALSE;
-        AcquireSRWLockShared(&active_devices_lock);
-        for (int i = 0; i < active_device_count; i++)
-        {
-            if (_tcscmp(cur->path, active_devices[i]->src_device->path) == 0)
-            {
-                found = TRUE;
-                break;
-            }
-        }
-        ReleaseSRWLockShared(&active_devices_lock);
-        if (!found)
-        {
-            add_device(cur->path);
-        }
-        cur = cur->next;
+        return;
     }
 
-    // free hid_device_info list
-    while (device_info)
+    // Only the reported interface is looked at, the full rescan is left for events without one.
+    if (path == NULL)
+    {
+        discovery_notify(discovery, DISCOVERY_RESCAN, NULL);
+        return;
+    }
+    if (!hid_match_filters(path, stadia_hw_path_filters))
     {
-        cur = device_info->next;
-        hid_free_device_info(device_info);
-        device_info = cur;
+        return;
     }
+
+    discovery_notify(discovery, op == DO_TRAY_DEV_ATTACHED ? DISCOVERY_ARRIVED : DISCOVERY_REMOVED, path);
 }
 
-static void device_change_cb(UINT op, LPTSTR path)
+// DS4 targets always take the raw reports, their translation never needs the decoded state. Once
+// subscribed, the callbacks are only swapped from the engine thread (see translation_swap_cb).
+static void set_translation(struct active_device *active_device, BOOL direct)
 {
-    refresh_devices();
+    if (active_device->ds4)
+    {
+        active_device->subscriber.update = NULL;
+        active_device->subscriber.report = stadia_controller_ds4_report_cb;
+    }
+    else
+    {
+        active_device->subscriber.update = direct ? NULL : stadia_controller_update_cb;
+        active_device->subscriber.report = direct ? stadia_controller_report_cb : NULL;
+    }
 }
 
-static void stadia_controller_update_cb(struct stadia_controller *controller, struct stadia_state *state)
+static void submit_target(struct stadia_controller *controller, struct active_device *active_device)
 {
-    struct active_device *active_device = NULL;
-    AcquireSRWLockShared(&active_devices_lock);
-    for (int i = 0; i < active_device_count; i++)
+    ULONGLONG submit_start = timer_now_us();
+    if (!mapping_filter_check(&active_device->tgt_filter, &active_device->tgt_report, submit_start))
     {
-        if (active_devices[i]->controller == controller)
-        {
-            active_device = active_devices[i];
-            break;
-        }
+        return;
     }
-    ReleaseSRWLockShared(&active_devices_lock);
 
-    if (active_device == NULL)
+    if (batch_window != 0)
     {
+        target_batch_queue_xusb(&target_batch, &active_device->batch_entry, controller, &active_device->tgt_report);
         return;
     }
 
-    if (vigem_connected)
+    target_submit_xusb(active_device->target, &active_device->tgt_report);
+    stadia_controller_record_submit(controller, submit_start, timer_now_us());
+}
+
+static void stadia_controller_update_cb(struct stadia_controller *controller, const struct stadia_state *state,
+                                       void *context)
+{
+    struct active_device *active_device = (struct active_device *)context;
+
+    if (active_device->target != NULL)
     {
         active_device->tgt_report.wButtons = 0;
         active_device->tgt_report.wButtons |= (state->buttons & STADIA_BUTTON_UP) != 0 ? XUSB_GAMEPAD_DPAD_UP : 0;
@@ -330,38 +773,285 @@ static void stadia_controller_update_cb(struct stadia_controller *controller, st
         active_device->tgt_report.wButtons |= (state->buttons & STADIA_BUTTON_X) != 0 ? XUSB_GAMEPAD_X : 0;
         active_device->tgt_report.wButtons |= (state->buttons & STADIA_BUTTON_Y) != 0 ? XUSB_GAMEPAD_Y : 0;
         active_device->tgt_report.wButtons |= (state->buttons & STADIA_BUTTON_STADIA_BTN) != 0 ? XUSB_GAMEPAD_GUIDE : 0;
-        active_device->tgt_report.bLeftTrigger = state->left_trigger;
-        active_device->tgt_report.bRightTrigger = state->right_trigger;
-        active_device->tgt_report.sThumbLX = _map_byte_to_short(state->left_stick_x, FALSE);
-        active_device->tgt_report.sThumbLY = _map_byte_to_short(state->left_stick_y, TRUE);
-        active_device->tgt_report.sThumbRX = _map_byte_to_short(state->right_stick_x, FALSE);
-        active_device->tgt_report.sThumbRY = _map_byte_to_short(state->right_stick_y, TRUE);
-        vigem_target_x360_update(vigem_client, active_device->tgt_device, active_device->tgt_report);
+        BYTE sticks[4] = {state->left_stick_x, state->left_stick_y, state->right_stick_x, state->right_stick_y};
+        mapping_translate_sticks(active_device->profile, sticks, &active_device->tgt_report);
+        mapping_translate_triggers(active_device->profile, state->left_trigger, state->right_trigger,
+                                   &active_device->tgt_report);
+        submit_target(controller, active_device);
     }
 }
 
-static void stadia_controller_stop_cb(struct stadia_controller *controller)
+static void stadia_controller_report_cb(struct stadia_controller *controller, const BYTE *report, size_t length,
+                                       void *context)
 {
-    LPTSTR ntf_text;
-    if (remove_device(controller))
+    struct active_device *active_device = (struct active_device *)context;
+
+    if (active_device->target != NULL &&
+        mapping_translate_xusb(active_device->profile, report, length, &active_device->tgt_report))
+    {
+        submit_target(controller, active_device);
+    }
+}
+
+static void stadia_controller_ds4_report_cb(struct stadia_controller *controller, const BYTE *report, size_t length,
+                                           void *context)
+{
+    struct active_device *active_device = (struct active_device *)context;
+
+    if (active_device->target == NULL ||
+        !mapping_translate_ds4(active_device->profile, report, length, &active_device->ds4_report))
+    {
+        return;
+    }
+
+    ULONGLONG submit_start = timer_now_us();
+    if (!mapping_filter_check_ds4(&active_device->tgt_filter, &active_device->ds4_report, submit_start))
+    {
+        return;
+    }
+
+    if (batch_window != 0)
+    {
+        target_batch_queue_ds4(&target_batch, &active_device->batch_entry, controller, &active_device->ds4_report);
+        return;
+    }
+
+    target_submit_ds4(active_device->target, &active_device->ds4_report);
+    stadia_controller_record_submit(controller, submit_start, timer_now_us());
+}
+
+static void stadia_controller_stop_cb(struct stadia_controller *controller, void *context)
+{
+    struct active_device *active_device = (struct active_device *)context;
+    // No more reports come in, and the target may go as soon as the entry is released.
+    target_batch_cancel(&target_batch, &active_device->batch_entry);
+    if (remove_device(active_device))
+    {
+        release_active_device(active_device);
+        post_tray_update();
+    }
+}
+
+static void target_rumble_cb(struct target *target, BYTE small_motor, BYTE big_motor, void *context)
+{
+    struct active_device *active_device = (struct active_device *)context;
+    (void)target;
+    stadia_controller_set_vibration(active_device->controller, small_motor, big_motor);
+}
+
+static void print_latency(const char *stage, const struct latency_summary *summary)
+{
+    printf("  %-8s n=%ld p50=%ldus p99=%ldus max=%ldus\n", stage, summary->count, summary->p50_us, summary->p99_us,
+           summary->max_us);
+}
+
+static void print_controller_stats(int slot, struct stadia_controller *controller, const struct mapping_filter *filter)
+{
+    struct stadia_latency_summary latency;
+    stadia_controller_get_latency(controller, &latency);
+
+    printf("device %d: %ld reports/s\n", slot, stadia_controller_get_report_rate(controller));
+    print_latency("decode", &latency.decode);
+    print_latency("dispatch", &latency.dispatch);
+    print_latency("submit", &latency.submit);
+    print_latency("total", &latency.total);
+    printf("  target   submitted=%ld suppressed=%ld\n", filter->submitted, filter->suppressed);
+
+    LONG vibrations_sent, vibrations_dropped;
+    stadia_controller_get_vibration_stats(controller, &vibrations_sent, &vibrations_dropped);
+    printf("  rumble   sent=%ld dropped=%ld\n", vibrations_sent, vibrations_dropped);
+}
+
+static void print_device_stats()
+{
+    AcquireSRWLockShared(&active_devices_lock);
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
     {
-        rebuild_tray_menu();
-        tray_update(&tray);
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device != NULL && active_device->controller != NULL)
+        {
+            print_controller_stats(i, active_device->controller, &active_device->tgt_filter);
+        }
+    }
+    ReleaseSRWLockShared(&active_devices_lock);
+
+    if (batch_window != 0)
+    {
+        // Every queued report that did not go out was superseded by a newer one of its target.
+        LONG queued = target_batch.queued;
+        LONG submitted = target_batch.submitted;
+        printf("batch: window=%lums flushes=%ld submitted=%ld saved=%ld\n", batch_window, target_batch.flushes,
+               submitted, queued - submitted);
     }
 }
 
-static void CALLBACK x360_notification_cb(PVIGEM_CLIENT client, PVIGEM_TARGET target, UCHAR large_motor,
-                                          UCHAR small_motor, UCHAR led_number, LPVOID user_data)
+static void stadia_controller_stats_cb(struct stadia_controller *controller, void *context)
 {
-    struct active_device *active_device = (struct active_device *)user_data;
-    stadia_controller_set_vibration(active_device->controller, small_motor, large_motor);
+    struct active_device *active_device = (struct active_device *)context;
+
+    AcquireSRWLockShared(&active_devices_lock);
+    print_controller_stats(SLOT_TABLE_INDEX(active_device->handle), controller, &active_device->tgt_filter);
+    ReleaseSRWLockShared(&active_devices_lock);
 }
 
 static void refresh_cb(struct tray_menu *item)
 {
     (void)item;
+    print_device_stats();
     fflush(stdout);
-    refresh_devices();
+    discovery_notify(discovery, DISCOVERY_RESCAN, NULL);
+}
+
+struct translation_swap
+{
+    struct io_request request;
+    struct active_device *active_device;
+    BOOL direct;
+};
+
+// Between two reports, so each one reaches either the old or the new callbacks.
+static void translation_swap_cb(struct io_request *request, INT result)
+{
+    struct translation_swap *swap = (struct translation_swap *)request->context;
+    (void)result;
+
+    set_translation(swap->active_device, swap->direct);
+    release_active_device(swap->active_device);
+    free(swap);
+}
+
+static void direct_translation_cb(struct tray_menu *item)
+{
+    (void)item;
+    direct_translation = !direct_translation;
+
+    AcquireSRWLockShared(&active_devices_lock);
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
+    {
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device == NULL)
+        {
+            continue;
+        }
+
+        struct translation_swap *swap = (struct translation_swap *)malloc(sizeof(struct translation_swap));
+        memset(swap, 0, sizeof(struct translation_swap));
+
+        // Keeps the device around until the swap has run.
+        InterlockedIncrement(&active_device->refs);
+        swap->active_device = active_device;
+        swap->direct = direct_translation;
+        swap->request.complete = translation_swap_cb;
+        swap->request.context = swap;
+        io_post(io_engine, &swap->request, 0);
+    }
+    ReleaseSRWLockShared(&active_devices_lock);
+    rebuild_tray_menu();
+    tray_update(&tray);
+}
+
+// The target type is remembered for the device, which is then reconnected to pick it up.
+static void ds4_target_cb(struct tray_menu *item)
+{
+    DWORD handle = (DWORD)(ULONG_PTR)item->context;
+    LPTSTR path = NULL;
+    BOOL ds4 = FALSE;
+
+    AcquireSRWLockShared(&active_devices_lock);
+    struct active_device *active_device = (struct active_device *)slot_table_get(&active_devices, handle);
+    if (active_device != NULL)
+    {
+        path = (LPTSTR)malloc((_tcslen(active_device->src_device->path) + 1) * sizeof(TCHAR));
+        _tcscpy(path, active_device->src_device->path);
+        ds4 = !active_device->ds4;
+    }
+    ReleaseSRWLockShared(&active_devices_lock);
+
+    if (path == NULL || device_cache == NULL)
+    {
+        free(path);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&device_cache_lock);
+    DWORD settings = device_cache_get_settings(device_cache, path);
+    settings = ds4 ? settings | DEVICE_SETTING_DS4_TARGET : settings & ~DEVICE_SETTING_DS4_TARGET;
+    device_cache_set_settings(device_cache, path, settings);
+    ReleaseSRWLockExclusive(&device_cache_lock);
+
+    discovery_notify(discovery, DISCOVERY_REMOVED, path);
+    discovery_notify(discovery, DISCOVERY_ARRIVED, path);
+    free(path);
+}
+
+struct profile_swap
+{
+    struct io_request request;
+    struct active_device *active_device;
+    struct mapping_profile *profile;
+};
+
+// Reports are only translated on the engine thread, so the previous profile is out of use here.
+static void profile_swap_cb(struct io_request *request, INT result)
+{
+    struct profile_swap *swap = (struct profile_swap *)request->context;
+    struct mapping_profile *previous = swap->active_device->profile;
+    (void)result;
+
+    swap->active_device->profile = swap->profile;
+    if (previous != NULL)
+    {
+        mapping_profile_free(previous);
+    }
+    release_active_device(swap->active_device);
+    free(swap);
+}
+
+// Settings not in the file are back to their defaults, and every device gets freshly baked tables.
+static void reload_profile_cb(struct tray_menu *item)
+{
+    struct profile_settings settings;
+    INT line;
+    (void)item;
+
+    profile_settings_init(&settings);
+    if (!load_profile_settings(&settings, &line) && line != 0)
+    {
+        show_profile_error(line);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&profile_settings_lock);
+    profile_settings = settings;
+
+    AcquireSRWLockShared(&active_devices_lock);
+    for (INT i = 0; i < slot_table_end(&active_devices); i++)
+    {
+        struct active_device *active_device = (struct active_device *)slot_table_at(&active_devices, i);
+        if (active_device == NULL)
+        {
+            continue;
+        }
+
+        struct profile_swap *swap = (struct profile_swap *)malloc(sizeof(struct profile_swap));
+        memset(swap, 0, sizeof(struct profile_swap));
+        swap->profile = mapping_profile_create(&profile_settings);
+        if (swap->profile == NULL)
+        {
+            free(swap);
+            continue;
+        }
+
+        // Keeps the device around until the swap has run.
+        InterlockedIncrement(&active_device->refs);
+        swap->active_device = active_device;
+        swap->request.complete = profile_swap_cb;
+        swap->request.context = swap;
+        io_post(io_engine, &swap->request, 0);
+    }
+    ReleaseSRWLockShared(&active_devices_lock);
+
+    ReleaseSRWLockExclusive(&profile_settings_lock);
 }
 
 static void quit_cb(struct tray_menu *item)
@@ -374,38 +1064,71 @@ static void quit_cb(struct tray_menu *item)
 INT main()
 {
     attach_parent_console();
+    profile_settings_init(&profile_settings);
+    INT max_active_device_count = get_max_active_device_count();
+    if (!slot_table_init(&active_devices, min(max_active_device_count, DEFAULT_MAX_ACTIVE_DEVICE_COUNT),
+                         max_active_device_count))
+    {
+        printf("Failed to allocate device table\n");
+        return 1;
+    }
     rebuild_tray_menu();
     if (tray_init(&tray) < 0)
     {
         printf("Failed to create tray\n");
         return 1;
     }
-    vigem_client = vigem_alloc();
-    VIGEM_ERROR vigem_res = vigem_connect(vigem_client);
-    if (vigem_res == VIGEM_ERROR_BUS_NOT_FOUND)
+    INT profile_error_line;
+    if (!load_profile_settings(&profile_settings, &profile_error_line) && profile_error_line != 0)
+    {
+        show_profile_error(profile_error_line);
+    }
+    INT target_error;
+    target_sink = target_sink_connect(get_target_backend(), NULL, &target_error);
+    if (target_error == TARGET_ERROR_NOT_FOUND)
     {
         tray_show_notification(NT_TRAY_ERROR, TEXT("Stadia Controller error"),
                                TEXT("ViGEmBus not installed"));
     }
-    else if (vigem_res == VIGEM_ERROR_BUS_VERSION_MISMATCH)
+    else if (target_error == TARGET_ERROR_VERSION_MISMATCH)
     {
         tray_show_notification(NT_TRAY_ERROR, TEXT("Stadia Controller error"),
                                TEXT("ViGEmBus incompatible version"));
     }
-    else if (vigem_res != VIGEM_ERROR_NONE)
+    else if (target_error != TARGET_ERROR_NONE)
     {
         tray_show_notification(NT_TRAY_ERROR, TEXT("Stadia Controller error"),
                                TEXT("Error connecting to ViGEmBus"));
     }
-    else
+
+    io_engine = io_engine_create();
+    if (io_engine == NULL)
     {
-        vigem_connected = TRUE;
+        tray_show_notification(NT_TRAY_ERROR, TEXT("Stadia Controller error"),
+                               TEXT("Error starting I/O engine"));
+        tray_exit();
+        return 1;
     }
 
-    stadia_update_callback = stadia_controller_update_cb;
-    stadia_destroy_callback = stadia_controller_stop_cb;
+    batch_window = get_batch_window();
+    target_batch_init(&target_batch, io_engine, batch_window * 1000ULL);
+    device_cache = load_device_cache();
+
+    discovery = discovery_create(&discovery_handler, HOTPLUG_DEBOUNCE_INTERVAL);
+    if (discovery == NULL)
+    {
+        tray_show_notification(NT_TRAY_ERROR, TEXT("Stadia Controller error"),
+                               TEXT("Error starting device discovery"));
+        if (device_cache != NULL)
+        {
+            device_cache_free(device_cache);
+        }
+        io_engine_destroy(io_engine);
+        tray_exit();
+        return 1;
+    }
 
-    refresh_devices();
+    discovery_notify(discovery, DISCOVERY_RESCAN, NULL);
     tray_register_device_notification(hid_get_class(), device_change_cb);
 
     while (tray_loop(TRUE) == 0)
@@ -413,26 +1136,26 @@ INT main()
         ;
     }
 
-    AcquireSRWLockExclusive(&active_devices_lock);
-    for (INT i = 0; i < active_device_count; i++)
+    // No device is added or removed behind the shutdown's back from here on.
+    discovery_destroy(discovery);
+    if (device_cache != NULL)
     {
-        hid_close_device(active_devices[i]->src_device);
-        hid_free_device(active_devices[i]->src_device);
-        if (vigem_connected)
-        {
-            vigem_target_x360_unregister_notification(active_devices[i]->tgt_device);
-            vigem_target_remove(vigem_client, active_devices[i]->tgt_device);
-            vigem_target_free(active_devices[i]->tgt_device);
-        }
-        free(active_devices[i]);
+        device_cache_free(device_cache);
     }
-    active_device_count = 0;
-    ReleaseSRWLockExclusive(&active_devices_lock);
-    if (vigem_connected)
+
+    int controller_count;
+    struct stadia_controller **controllers = collect_controllers(NULL, TRUE, &controller_count);
+
+    // each destroy callback releases its device, target and profile
+    destroy_controllers(controllers, controller_count);
+    free(controllers);
+    io_engine_destroy(io_engine);
+
+    if (target_sink != NULL)
     {
-        vigem_disconnect(vigem_client);
+        target_sink_disconnect(target_sink);
     }
-    vigem_free(vigem_client);
+    slot_table_free(&active_devices);
     free(tray.menu);
     return 0;
 }
@@ -0,0 +1,323 @@
+/*
+ * mapping.c -- Translation of Stadia input into virtual gamepad reports.
+ */
+
+#include "mapping.h"
+
+#include <string.h>
+
+#include "report.h"
+#include "table.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MAPPING_SSE2
+#include <emmintrin.h>
+#endif
+
+#define XUSB_DPAD_BUTTONS(v)                                                   \
+    ((v) == 0   ? XUSB_GAMEPAD_DPAD_UP                                         \
+     : (v) == 1 ? XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_RIGHT               \
+     : (v) == 2 ? XUSB_GAMEPAD_DPAD_RIGHT                                      \
+     : (v) == 3 ? XUSB_GAMEPAD_DPAD_RIGHT | XUSB_GAMEPAD_DPAD_DOWN             \
+     : (v) == 4 ? XUSB_GAMEPAD_DPAD_DOWN                                       \
+     : (v) == 5 ? XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_LEFT              \
+     : (v) == 6 ? XUSB_GAMEPAD_DPAD_LEFT                                       \
+     : (v) == 7 ? XUSB_GAMEPAD_DPAD_LEFT | XUSB_GAMEPAD_DPAD_UP                \
+                : 0)
+
+#define XUSB_BYTE2_BUTTONS(v)                                                  \
+    ((((v) & (1 << 7)) != 0 ? XUSB_GAMEPAD_RIGHT_THUMB : 0) |                  \
+     (((v) & (1 << 6)) != 0 ? XUSB_GAMEPAD_BACK : 0) |                         \
+     (((v) & (1 << 5)) != 0 ? XUSB_GAMEPAD_START : 0) |                        \
+     (((v) & (1 << 4)) != 0 ? XUSB_GAMEPAD_GUIDE : 0))
+
+#define XUSB_BYTE3_BUTTONS(v)                                                  \
+    ((((v) & (1 << 6)) != 0 ? XUSB_GAMEPAD_A : 0) |                            \
+     (((v) & (1 << 5)) != 0 ? XUSB_GAMEPAD_B : 0) |                            \
+     (((v) & (1 << 4)) != 0 ? XUSB_GAMEPAD_X : 0) |                            \
+     (((v) & (1 << 3)) != 0 ? XUSB_GAMEPAD_Y : 0) |                            \
+     (((v) & (1 << 2)) != 0 ? XUSB_GAMEPAD_LEFT_SHOULDER : 0) |                \
+     (((v) & (1 << 1)) != 0 ? XUSB_GAMEPAD_RIGHT_SHOULDER : 0) |               \
+     (((v) & (1 << 0)) != 0 ? XUSB_GAMEPAD_LEFT_THUMB : 0))
+
+#define DS4_DPAD(v) ((v) < 8 ? (v) : DS4_BUTTON_DPAD_NONE)
+
+#define DS4_BYTE2_BUTTONS(v)                                                   \
+    ((((v) & (1 << 7)) != 0 ? DS4_BUTTON_THUMB_RIGHT : 0) |                    \
+     (((v) & (1 << 6)) != 0 ? DS4_BUTTON_SHARE : 0) |                          \
+     (((v) & (1 << 5)) != 0 ? DS4_BUTTON_OPTIONS : 0))
+
+#define DS4_BYTE3_BUTTONS(v)                                                   \
+    ((((v) & (1 << 6)) != 0 ? DS4_BUTTON_CROSS : 0) |                          \
+     (((v) & (1 << 5)) != 0 ? DS4_BUTTON_CIRCLE : 0) |                         \
+     (((v) & (1 << 4)) != 0 ? DS4_BUTTON_SQUARE : 0) |                         \
+     (((v) & (1 << 3)) != 0 ? DS4_BUTTON_TRIANGLE : 0) |                       \
+     (((v) & (1 << 2)) != 0 ? DS4_BUTTON_SHOULDER_LEFT : 0) |                  \
+     (((v) & (1 << 1)) != 0 ? DS4_BUTTON_SHOULDER_RIGHT : 0) |                 \
+     (((v) & (1 << 0)) != 0 ? DS4_BUTTON_THUMB_LEFT : 0))
+
+// Output report layouts: flags byte, then the motors and the lightbar color further on.
+#define DS4_USB_OUTPUT_REPORT_ID 0x05
+#define DS4_BLT_OUTPUT_REPORT_ID 0x11
+#define DS4_USB_OUTPUT_OFFSET 1
+#define DS4_BLT_OUTPUT_OFFSET 3
+#define DS4_OUTPUT_FLAG_RUMBLE 0x01
+#define DS4_OUTPUT_FLAG_LIGHTBAR 0x02
+
+#define AXIS_CENTERED(v) ((v) == 0 ? -127 : (v) - 128)
+#define XUSB_AXIS(v) ((SHORT)(32767 * AXIS_CENTERED(v) / 127))
+#define XUSB_AXIS_INVERTED(v) ((SHORT)(32767 * -AXIS_CENTERED(v) / 127))
+
+static const USHORT xusb_dpad_map[256] = {TABLE_256(XUSB_DPAD_BUTTONS)};
+static const USHORT xusb_byte2_map[256] = {TABLE_256(XUSB_BYTE2_BUTTONS)};
+static const USHORT xusb_byte3_map[256] = {TABLE_256(XUSB_BYTE3_BUTTONS)};
+static const USHORT ds4_dpad_map[256] = {TABLE_256(DS4_DPAD)};
+static const USHORT ds4_byte2_map[256] = {TABLE_256(DS4_BYTE2_BUTTONS)};
+static const USHORT ds4_byte3_map[256] = {TABLE_256(DS4_BYTE3_BUTTONS)};
+
+const SHORT mapping_axis_map[256] = {TABLE_256(XUSB_AXIS)};
+const SHORT mapping_axis_inverted_map[256] = {TABLE_256(XUSB_AXIS_INVERTED)};
+
+static void _translate_sticks_linear(const BYTE *sticks, XUSB_REPORT *out)
+{
+#ifdef MAPPING_SSE2
+    INT packed;
+    SHORT axes[8];
+
+    memcpy(&packed, sticks, sizeof(packed));
+
+    __m128i centered = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+    centered = _mm_sub_epi16(centered, _mm_set1_epi16(128));
+    centered = _mm_max_epi16(centered, _mm_set1_epi16(-127));
+    centered = _mm_mullo_epi16(centered, _mm_setr_epi16(1, -1, 1, -1, 0, 0, 0, 0));
+
+    // 32767 * c / 127 == 258 * c + c / 127, and for |c| <= 127 the last term is only non-zero at +-127
+    __m128i scaled = _mm_mullo_epi16(centered, _mm_set1_epi16(258));
+    scaled = _mm_sub_epi16(scaled, _mm_cmpeq_epi16(centered, _mm_set1_epi16(127)));
+    scaled = _mm_add_epi16(scaled, _mm_cmpeq_epi16(centered, _mm_set1_epi16(-127)));
+
+    _mm_storeu_si128((__m128i *)axes, scaled);
+
+    out->sThumbLX = axes[0];
+    out->sThumbLY = axes[1];
+    out->sThumbRX = axes[2];
+    out->sThumbRY = axes[3];
+#else
+    out->sThumbLX = mapping_axis_map[sticks[0]];
+    out->sThumbLY = mapping_axis_inverted_map[sticks[1]];
+    out->sThumbRX = mapping_axis_map[sticks[2]];
+    out->sThumbRY = mapping_axis_inverted_map[sticks[3]];
+#endif /* MAPPING_SSE2 */
+}
+
+static void _translate_stick(const struct stick_table *table, BYTE x, BYTE y, SHORT *out_x, SHORT *out_y)
+{
+    if (table->radial != NULL)
+    {
+        struct stick_axes axes = table->radial[x | (y << 8)];
+        *out_x = axes.x;
+        *out_y = axes.y;
+    }
+    else
+    {
+        *out_x = table->x[x];
+        *out_y = table->y[y];
+    }
+}
+
+void mapping_translate_sticks(const struct mapping_profile *profile, const BYTE *sticks, XUSB_REPORT *out)
+{
+    if (profile == NULL || profile->linear)
+    {
+        _translate_sticks_linear(sticks, out);
+        return;
+    }
+
+    _translate_stick(&profile->left_stick, sticks[0], sticks[1], &out->sThumbLX, &out->sThumbLY);
+    _translate_stick(&profile->right_stick, sticks[2], sticks[3], &out->sThumbRX, &out->sThumbRY);
+}
+
+void mapping_translate_triggers(const struct mapping_profile *profile, BYTE left, BYTE right, XUSB_REPORT *out)
+{
+    if (profile == NULL || profile->linear)
+    {
+        out->bLeftTrigger = left;
+        out->bRightTrigger = right;
+        return;
+    }
+
+    out->bLeftTrigger = profile->left_trigger[left];
+    out->bRightTrigger = profile->right_trigger[right];
+}
+
+BOOL mapping_translate_xusb(const struct mapping_profile *profile, const BYTE *buf, size_t len, XUSB_REPORT *out)
+{
+    if (len < STADIA_INPUT_REPORT_MIN_SIZE || buf[0] != STADIA_INPUT_REPORT_ID)
+    {
+        return FALSE;
+    }
+
+    out->wButtons = xusb_dpad_map[buf[1]] | xusb_byte2_map[buf[2]] | xusb_byte3_map[buf[3]];
+    mapping_translate_sticks(profile, &buf[4], out);
+    mapping_translate_triggers(profile, buf[8], buf[9], out);
+
+    return TRUE;
+}
+
+void mapping_ds4_report_init(DS4_REPORT_EX *report)
+{
+    memset(report, 0, sizeof(DS4_REPORT_EX));
+
+    report->Report.bThumbLX = 0x80;
+    report->Report.bThumbLY = 0x80;
+    report->Report.bThumbRX = 0x80;
+    report->Report.bThumbRY = 0x80;
+    report->Report.wButtons = DS4_BUTTON_DPAD_NONE;
+
+    // The up bits are active high, a zeroed touch would read as two fingers down.
+    report->Report.sCurrentTouch.bIsUpTrackingNum1 = 0x80;
+    report->Report.sCurrentTouch.bIsUpTrackingNum2 = 0x80;
+}
+
+// Back from the XUSB range of the profile tables, flipping Y to grow downwards again.
+static BYTE _ds4_axis(SHORT value)
+{
+    INT axis = (value + 32768) >> 8;
+    return (BYTE)(axis > 255 ? 255 : axis);
+}
+
+static BYTE _ds4_axis_inverted(SHORT value)
+{
+    INT axis = (32768 - value) >> 8;
+    return (BYTE)(axis > 255 ? 255 : axis);
+}
+
+static void _translate_ds4_stick(const struct stick_table *table, BYTE x, BYTE y, BYTE *out_x, BYTE *out_y)
+{
+    SHORT value_x, value_y;
+    _translate_stick(table, x, y, &value_x, &value_y);
+    *out_x = _ds4_axis(value_x);
+    *out_y = _ds4_axis_inverted(value_y);
+}
+
+BOOL mapping_translate_ds4(const struct mapping_profile *profile, const BYTE *buf, size_t len, DS4_REPORT_EX *out)
+{
+    if (len < STADIA_INPUT_REPORT_MIN_SIZE || buf[0] != STADIA_INPUT_REPORT_ID)
+    {
+        return FALSE;
+    }
+
+    if (profile == NULL || profile->linear)
+    {
+        out->Report.bThumbLX = buf[4];
+        out->Report.bThumbLY = buf[5];
+        out->Report.bThumbRX = buf[6];
+        out->Report.bThumbRY = buf[7];
+        out->Report.bTriggerL = buf[8];
+        out->Report.bTriggerR = buf[9];
+    }
+    else
+    {
+        _translate_ds4_stick(&profile->left_stick, buf[4], buf[5], &out->Report.bThumbLX, &out->Report.bThumbLY);
+        _translate_ds4_stick(&profile->right_stick, buf[6], buf[7], &out->Report.bThumbRX, &out->Report.bThumbRY);
+        out->Report.bTriggerL = profile->left_trigger[buf[8]];
+        out->Report.bTriggerR = profile->right_trigger[buf[9]];
+    }
+
+    out->Report.wButtons = ds4_dpad_map[buf[1]] | ds4_byte2_map[buf[2]] | ds4_byte3_map[buf[3]] |
+                           (out->Report.bTriggerL != 0 ? DS4_BUTTON_TRIGGER_LEFT : 0) |
+                           (out->Report.bTriggerR != 0 ? DS4_BUTTON_TRIGGER_RIGHT : 0);
+    out->Report.bSpecial = (buf[2] & (1 << 4)) != 0 ? DS4_SPECIAL_BUTTON_PS : 0;
+
+    return TRUE;
+}
+
+BOOL mapping_parse_ds4_output(const BYTE *buf, size_t len, struct mapping_ds4_output *out)
+{
+    size_t offset;
+    if (len > 0 && buf[0] == DS4_USB_OUTPUT_REPORT_ID)
+    {
+        offset = DS4_USB_OUTPUT_OFFSET;
+    }
+    else if (len > 0 && buf[0] == DS4_BLT_OUTPUT_REPORT_ID)
+    {
+        offset = DS4_BLT_OUTPUT_OFFSET;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    // Flags, two reserved bytes, right (small) and left (big) motor, then red, green and blue.
+    if (len < offset + 8)
+    {
+        return FALSE;
+    }
+
+    BYTE flags = buf[offset];
+    out->flags = ((flags & DS4_OUTPUT_FLAG_RUMBLE) != 0 ? MAPPING_DS4_OUTPUT_RUMBLE : 0) |
+                 ((flags & DS4_OUTPUT_FLAG_LIGHTBAR) != 0 ? MAPPING_DS4_OUTPUT_LIGHTBAR : 0);
+    out->small_motor = buf[offset + 3];
+    out->big_motor = buf[offset + 4];
+    out->lightbar.Red = buf[offset + 5];
+    out->lightbar.Green = buf[offset + 6];
+    out->lightbar.Blue = buf[offset + 7];
+
+    return TRUE;
+}
+
+void mapping_filter_init(struct mapping_filter *filter, ULONGLONG keep_alive_us)
+{
+    filter->keep_alive_us = keep_alive_us;
+    filter->primed = FALSE;
+    memset(&filter->last, 0, sizeof(filter->last));
+    filter->last_submit_us = 0;
+    filter->submitted = 0;
+    filter->suppressed = 0;
+}
+
+static BOOL _mapping_filter_pass(struct mapping_filter *filter, BOOL unchanged, ULONGLONG now_us)
+{
+    if (unchanged && (filter->keep_alive_us == 0 || now_us - filter->last_submit_us < filter->keep_alive_us))
+    {
+        InterlockedIncrement(&filter->suppressed);
+        return FALSE;
+    }
+
+    filter->primed = TRUE;
+    filter->last_submit_us = now_us;
+    InterlockedIncrement(&filter->submitted);
+    return TRUE;
+}
+
+BOOL mapping_filter_check(struct mapping_filter *filter, const XUSB_REPORT *report, ULONGLONG now_us)
+{
+    const XUSB_REPORT *last = &filter->last.xusb;
+
+    // Compared field by field, the struct layout is not ours to rely on.
+    BOOL unchanged = filter->primed && report->wButtons == last->wButtons &&
+                     report->bLeftTrigger == last->bLeftTrigger && report->bRightTrigger == last->bRightTrigger &&
+                     report->sThumbLX == last->sThumbLX && report->sThumbLY == last->sThumbLY &&
+                     report->sThumbRX == last->sThumbRX && report->sThumbRY == last->sThumbRY;
+
+    if (!_mapping_filter_pass(filter, unchanged, now_us))
+    {
+        return FALSE;
+    }
+    filter->last.xusb = *report;
+    return TRUE;
+}
+
+BOOL mapping_filter_check_ds4(struct mapping_filter *filter, const DS4_REPORT_EX *report, ULONGLONG now_us)
+{
+    // Tightly packed, so the raw bytes are the report.
+    BOOL unchanged = filter->primed &&
+                     memcmp(report->ReportBuffer, filter->last.ds4.ReportBuffer, sizeof(report->ReportBuffer)) == 0;
+
+    if (!_mapping_filter_pass(filter, unchanged, now_us))
+    {
+        return FALSE;
+    }
+    filter->last.ds4 = *report;
+    return TRUE;
+}
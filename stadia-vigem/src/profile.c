@@ -0,0 +1,449 @@
+/*
+ * profile.c -- Per-device stick and trigger response settings baked into lookup tables.
+ */
+
+#include "profile.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif /* _WIN32 */
+
+#define RADIAL_TABLE_SIZE (256 * 256)
+
+#define PROFILE_LINE_SIZE 256
+
+static double _clamp(double value, double min, double max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+static void _response_init(struct response_settings *settings)
+{
+    memset(settings, 0, sizeof(struct response_settings));
+    settings->deadzone_type = PROFILE_DEADZONE_NONE;
+    settings->outer_deadzone = 1.0f;
+    settings->curve.type = PROFILE_CURVE_LINEAR;
+    settings->curve.exponent = 1.0f;
+}
+
+static BOOL _response_is_linear(const struct response_settings *settings, BOOL stick)
+{
+    BOOL no_deadzone = stick ? settings->deadzone_type == PROFILE_DEADZONE_NONE || settings->deadzone <= 0.0f
+                             : settings->deadzone <= 0.0f;
+    BOOL linear_curve = settings->curve.type == PROFILE_CURVE_LINEAR ||
+                        (settings->curve.type == PROFILE_CURVE_EXPONENTIAL && settings->curve.exponent == 1.0f);
+    return no_deadzone && linear_curve && settings->outer_deadzone >= 1.0f && settings->anti_deadzone <= 0.0f;
+}
+
+static double _curve(const struct curve_settings *curve, double t)
+{
+    switch (curve->type)
+    {
+    case PROFILE_CURVE_EXPONENTIAL:
+        return pow(t, curve->exponent > 0.0f ? curve->exponent : 1.0);
+    case PROFILE_CURVE_CUSTOM:
+    {
+        double x0 = 0.0, y0 = 0.0;
+        UINT count = curve->point_count < PROFILE_CURVE_MAX_POINTS ? curve->point_count : PROFILE_CURVE_MAX_POINTS;
+        for (UINT i = 0; i <= count; i++)
+        {
+            double x1 = i < count ? _clamp(curve->points_x[i], x0, 1.0) : 1.0;
+            double y1 = i < count ? _clamp(curve->points_y[i], 0.0, 1.0) : 1.0;
+            if (t <= x1)
+            {
+                return x1 > x0 ? y0 + (y1 - y0) * (t - x0) / (x1 - x0) : y1;
+            }
+            x0 = x1;
+            y0 = y1;
+        }
+        return 1.0;
+    }
+    default:
+        return t;
+    }
+}
+
+/*
+ * Maps a deflection magnitude in [0, 1] through the deadzones and the curve.
+ */
+static double _response(const struct response_settings *settings, double deadzone, double magnitude)
+{
+    double outer = _clamp(settings->outer_deadzone, deadzone, 1.0);
+    double anti = _clamp(settings->anti_deadzone, 0.0, 1.0);
+
+    if (magnitude <= deadzone)
+    {
+        return 0.0;
+    }
+    if (magnitude >= outer)
+    {
+        return 1.0;
+    }
+
+    double t = (magnitude - deadzone) / (outer - deadzone);
+    return anti + (1.0 - anti) * _clamp(_curve(&settings->curve, t), 0.0, 1.0);
+}
+
+/*
+ * Stick bytes are centered on 128 and clamped to -127, like the default linear mapping.
+ */
+static double _normalize_axis(INT value)
+{
+    INT centered = value - 128;
+    return (centered < -127 ? -127 : centered) / 127.0;
+}
+
+static SHORT _to_axis(double value)
+{
+    return (SHORT)(32767.0 * _clamp(value, -1.0, 1.0));
+}
+
+static BOOL _bake_stick(struct stick_table *table, const struct response_settings *settings)
+{
+    double deadzone = settings->deadzone_type == PROFILE_DEADZONE_NONE ? 0.0 : _clamp(settings->deadzone, 0.0, 1.0);
+
+    for (INT v = 0; v < 256; v++)
+    {
+        double n = _normalize_axis(v);
+        double r = _response(settings, settings->deadzone_type == PROFILE_DEADZONE_AXIAL ? deadzone : 0.0, fabs(n));
+        table->x[v] = _to_axis(n < 0 ? -r : r);
+        table->y[v] = _to_axis(n < 0 ? r : -r);
+    }
+
+    table->radial = NULL;
+    if (settings->deadzone_type != PROFILE_DEADZONE_RADIAL)
+    {
+        return TRUE;
+    }
+
+    table->radial = (struct stick_axes *)malloc(RADIAL_TABLE_SIZE * sizeof(struct stick_axes));
+    if (table->radial == NULL)
+    {
+        return FALSE;
+    }
+
+    for (INT y = 0; y < 256; y++)
+    {
+        double ny = _normalize_axis(y);
+        for (INT x = 0; x < 256; x++)
+        {
+            double nx = _normalize_axis(x);
+            double magnitude = sqrt(nx * nx + ny * ny);
+            struct stick_axes *axes = &table->radial[x | (y << 8)];
+
+            if (magnitude <= 0.0)
+            {
+                axes->x = 0;
+                axes->y = 0;
+                continue;
+            }
+
+            double r = _response(settings, deadzone, magnitude > 1.0 ? 1.0 : magnitude);
+            axes->x = _to_axis(nx / magnitude * r);
+            axes->y = _to_axis(-ny / magnitude * r);
+        }
+    }
+
+    return TRUE;
+}
+
+static void _bake_trigger(BYTE *table, const struct response_settings *settings)
+{
+    double deadzone = _clamp(settings->deadzone, 0.0, 1.0);
+
+    for (INT v = 0; v < 256; v++)
+    {
+        table[v] = (BYTE)(255.0 * _response(settings, deadzone, v / 255.0) + 0.5);
+    }
+}
+
+void profile_settings_init(struct profile_settings *settings)
+{
+    _response_init(&settings->left_stick);
+    _response_init(&settings->right_stick);
+    _response_init(&settings->left_trigger);
+    _response_init(&settings->right_trigger);
+}
+
+static char *_trim(char *text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = 0;
+    return text;
+}
+
+static BOOL _parse_fraction(const char *value, float *out)
+{
+    char *end;
+    double fraction = strtod(value, &end);
+    if (end == value || *end != 0 || fraction < 0.0 || fraction > 1.0)
+    {
+        return FALSE;
+    }
+
+    *out = (float)fraction;
+    return TRUE;
+}
+
+static BOOL _parse_points(const char *value, struct curve_settings *curve)
+{
+    UINT count = 0;
+
+    while (*value != 0)
+    {
+        char *end;
+        double x = strtod(value, &end);
+        if (end == value || *end != ':' || count == PROFILE_CURVE_MAX_POINTS)
+        {
+            return FALSE;
+        }
+
+        value = end + 1;
+        double y = strtod(value, &end);
+        if (end == value || x < 0.0 || x > 1.0 || y < 0.0 || y > 1.0 ||
+            (count > 0 && x <= curve->points_x[count - 1]))
+        {
+            return FALSE;
+        }
+
+        curve->points_x[count] = (float)x;
+        curve->points_y[count++] = (float)y;
+
+        value = end;
+        while (isspace((unsigned char)*value) || *value == ',')
+        {
+            value++;
+        }
+    }
+
+    curve->point_count = count;
+    return TRUE;
+}
+
+static BOOL _apply_key(struct response_settings *settings, BOOL stick, const char *key, const char *value)
+{
+    if (strcmp(key, "deadzone_type") == 0 && stick)
+    {
+        if (strcmp(value, "none") == 0)
+        {
+            settings->deadzone_type = PROFILE_DEADZONE_NONE;
+        }
+        else if (strcmp(value, "axial") == 0)
+        {
+            settings->deadzone_type = PROFILE_DEADZONE_AXIAL;
+        }
+        else if (strcmp(value, "radial") == 0)
+        {
+            settings->deadzone_type = PROFILE_DEADZONE_RADIAL;
+        }
+        else
+        {
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if (strcmp(key, "deadzone") == 0)
+    {
+        return _parse_fraction(value, &settings->deadzone);
+    }
+    if (strcmp(key, "outer_deadzone") == 0)
+    {
+        return _parse_fraction(value, &settings->outer_deadzone);
+    }
+    if (strcmp(key, "anti_deadzone") == 0)
+    {
+        return _parse_fraction(value, &settings->anti_deadzone);
+    }
+    if (strcmp(key, "curve") == 0)
+    {
+        if (strcmp(value, "linear") == 0)
+        {
+            settings->curve.type = PROFILE_CURVE_LINEAR;
+        }
+        else if (strcmp(value, "exponential") == 0)
+        {
+            settings->curve.type = PROFILE_CURVE_EXPONENTIAL;
+        }
+        else if (strcmp(value, "custom") == 0)
+        {
+            settings->curve.type = PROFILE_CURVE_CUSTOM;
+        }
+        else
+        {
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if (strcmp(key, "exponent") == 0)
+    {
+        char *end;
+        double exponent = strtod(value, &end);
+        if (end == value || *end != 0 || exponent <= 0.0)
+        {
+            return FALSE;
+        }
+        settings->curve.exponent = (float)exponent;
+        return TRUE;
+    }
+    if (strcmp(key, "points") == 0)
+    {
+        return _parse_points(value, &settings->curve);
+    }
+    return FALSE;
+}
+
+// Points at the settings a section sets, returns how many (0 for an unknown section).
+static INT _find_section(struct profile_settings *settings, const char *name, struct response_settings **targets,
+                         BOOL *stick)
+{
+    *stick = strcmp(name, "sticks") == 0 || strcmp(name, "left_stick") == 0 || strcmp(name, "right_stick") == 0;
+
+    if (strcmp(name, "sticks") == 0 || strcmp(name, "triggers") == 0)
+    {
+        targets[0] = *stick ? &settings->left_stick : &settings->left_trigger;
+        targets[1] = *stick ? &settings->right_stick : &settings->right_trigger;
+        return 2;
+    }
+
+    targets[0] = strcmp(name, "left_stick") == 0      ? &settings->left_stick
+                 : strcmp(name, "right_stick") == 0   ? &settings->right_stick
+                 : strcmp(name, "left_trigger") == 0  ? &settings->left_trigger
+                 : strcmp(name, "right_trigger") == 0 ? &settings->right_trigger
+                                                      : NULL;
+    return targets[0] != NULL ? 1 : 0;
+}
+
+BOOL profile_settings_load(LPTSTR path, struct profile_settings *settings, INT *line)
+{
+    // Read into a copy, so a bad line leaves nothing half applied.
+    struct profile_settings loaded = *settings;
+    struct response_settings *targets[2];
+    INT target_count = 0;
+    BOOL stick = FALSE;
+    char buffer[PROFILE_LINE_SIZE];
+    INT line_number = 0;
+    BOOL success = TRUE;
+
+    if (line != NULL)
+    {
+        *line = 0;
+    }
+
+    FILE *file = _tfopen(path, TEXT("r"));
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+
+    while (success && fgets(buffer, sizeof(buffer), file) != NULL)
+    {
+        line_number++;
+        // Longer lines are not understood either.
+        if (strchr(buffer, '\n') == NULL && !feof(file))
+        {
+            success = FALSE;
+            continue;
+        }
+
+        char *text = _trim(buffer);
+        if (*text == 0 || *text == '#' || *text == ';')
+        {
+            continue;
+        }
+
+        size_t length = strlen(text);
+        if (*text == '[' && text[length - 1] == ']')
+        {
+            text[length - 1] = 0;
+            target_count = _find_section(&loaded, _trim(text + 1), targets, &stick);
+            success = target_count != 0;
+            continue;
+        }
+
+        char *separator = strchr(text, '=');
+        if (separator == NULL || target_count == 0)
+        {
+            success = FALSE;
+            continue;
+        }
+
+        *separator = 0;
+        char *key = _trim(text);
+        char *value = _trim(separator + 1);
+        for (INT i = 0; i < target_count && success; i++)
+        {
+            success = _apply_key(targets[i], stick, key, value);
+        }
+    }
+
+    success = success && !ferror(file);
+    fclose(file);
+
+    if (!success)
+    {
+        if (line != NULL)
+        {
+            *line = line_number;
+        }
+        return FALSE;
+    }
+
+    *settings = loaded;
+    return TRUE;
+}
+
+struct mapping_profile *mapping_profile_create(const struct profile_settings *settings)
+{
+    struct mapping_profile *profile = (struct mapping_profile *)malloc(sizeof(struct mapping_profile));
+    if (profile == NULL)
+    {
+        return NULL;
+    }
+
+    profile->linear = _response_is_linear(&settings->left_stick, TRUE) &&
+                      _response_is_linear(&settings->right_stick, TRUE) &&
+                      _response_is_linear(&settings->left_trigger, FALSE) &&
+                      _response_is_linear(&settings->right_trigger, FALSE);
+
+    profile->left_stick.radial = NULL;
+    profile->right_stick.radial = NULL;
+
+    if (profile->linear)
+    {
+        return profile;
+    }
+
+    if (!_bake_stick(&profile->left_stick, &settings->left_stick) ||
+        !_bake_stick(&profile->right_stick, &settings->right_stick))
+    {
+        mapping_profile_free(profile);
+        return NULL;
+    }
+
+    _bake_trigger(profile->left_trigger, &settings->left_trigger);
+    _bake_trigger(profile->right_trigger, &settings->right_trigger);
+
+    return profile;
+}
+
+void mapping_profile_free(struct mapping_profile *profile)
+{
+    free(profile->left_stick.radial);
+    free(profile->right_stick.radial);
+    free(profile);
+}
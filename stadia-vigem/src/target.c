@@ -0,0 +1,66 @@
+/*
+ * target.c -- Virtual gamepads fed with translated Stadia input.
+ */
+
+#include "target.h"
+
+#include <stdlib.h>
+
+struct target_sink *target_sink_connect(const struct target_backend *backend, LPTSTR address, INT *error)
+{
+    INT connect_error = TARGET_ERROR_NONE;
+    struct target_sink *sink = backend->connect(address, &connect_error);
+    if (error != NULL)
+    {
+        *error = sink != NULL ? TARGET_ERROR_NONE : connect_error;
+    }
+    if (sink == NULL)
+    {
+        return NULL;
+    }
+
+    sink->backend = backend;
+    return sink;
+}
+
+void target_sink_disconnect(struct target_sink *sink)
+{
+    sink->backend->disconnect(sink);
+}
+
+struct target *target_add(struct target_sink *sink, UINT type)
+{
+    struct target *target = sink->backend->add(sink, type);
+    if (target == NULL)
+    {
+        return NULL;
+    }
+
+    target->sink = sink;
+    target->type = type;
+    target->rumble = NULL;
+    target->context = NULL;
+    return target;
+}
+
+BOOL target_listen(struct target *target, target_rumble_cb rumble, void *context)
+{
+    target->rumble = rumble;
+    target->context = context;
+    return target->sink->backend->listen(target);
+}
+
+BOOL target_submit_xusb(struct target *target, const XUSB_REPORT *report)
+{
+    return target->sink->backend->submit_xusb(target, report);
+}
+
+BOOL target_submit_ds4(struct target *target, const DS4_REPORT_EX *report)
+{
+    return target->sink->backend->submit_ds4(target, report);
+}
+
+void target_remove(struct target *target)
+{
+    target->sink->backend->remove(target);
+}
@@ -0,0 +1,132 @@
+/*
+ * target_batch.c -- Submission of the reports of all targets together, once per window.
+ */
+
+#include "target_batch.h"
+#include "timer.h"
+
+static void _target_batch_flush(struct io_request *request, INT result)
+{
+    struct target_batch *batch = (struct target_batch *)request->context;
+    struct target_batch_entry *entry = batch->head;
+    LONG submitted = 0;
+    (void)result;
+
+    // Detached first, a submission never sees a half-walked queue.
+    batch->head = NULL;
+    batch->tail = &batch->head;
+    batch->scheduled = FALSE;
+
+    while (entry != NULL)
+    {
+        struct target_batch_entry *next = entry->next;
+        entry->queued = FALSE;
+        entry->next = NULL;
+
+        ULONGLONG submit_start = timer_now_us();
+        if (entry->target->type == TARGET_TYPE_DS4)
+        {
+            target_submit_ds4(entry->target, &entry->report.ds4);
+        }
+        else
+        {
+            target_submit_xusb(entry->target, &entry->report.xusb);
+        }
+        // The dispatch stage then includes the time spent waiting for the flush.
+        stadia_controller_record_submit_at(entry->controller, entry->report_time_us, submit_start, timer_now_us());
+
+        submitted++;
+        entry = next;
+    }
+
+    InterlockedIncrement(&batch->flushes);
+    InterlockedExchangeAdd(&batch->submitted, submitted);
+}
+
+// Links the entry in, unless already queued, and makes sure a flush is coming.
+static void _target_batch_enqueue(struct target_batch *batch, struct target_batch_entry *entry,
+                                  struct stadia_controller *controller)
+{
+    InterlockedIncrement(&batch->queued);
+    entry->controller = controller;
+    entry->report_time_us = stadia_controller_get_report_time(controller);
+    if (entry->queued)
+    {
+        return;
+    }
+
+    entry->queued = TRUE;
+    entry->next = NULL;
+    *batch->tail = entry;
+    batch->tail = &entry->next;
+
+    // The window opens with the first report queued, so no report waits longer than it.
+    if (!batch->scheduled)
+    {
+        batch->scheduled = TRUE;
+        io_schedule(batch->engine, &batch->flush_request, timer_now_us() + batch->window_us);
+    }
+}
+
+void target_batch_init(struct target_batch *batch, struct io_engine *engine, ULONGLONG window_us)
+{
+    batch->engine = engine;
+    batch->window_us = window_us;
+    batch->head = NULL;
+    batch->tail = &batch->head;
+    batch->scheduled = FALSE;
+
+    RtlZeroMemory(&batch->flush_request, sizeof(batch->flush_request));
+    batch->flush_request.complete = _target_batch_flush;
+    batch->flush_request.context = batch;
+
+    batch->flushes = 0;
+    batch->queued = 0;
+    batch->submitted = 0;
+}
+
+void target_batch_entry_init(struct target_batch_entry *entry, struct target *target)
+{
+    entry->target = target;
+    entry->controller = NULL;
+    entry->report_time_us = 0;
+    entry->queued = FALSE;
+    entry->next = NULL;
+}
+
+void target_batch_queue_xusb(struct target_batch *batch, struct target_batch_entry *entry,
+                             struct stadia_controller *controller, const XUSB_REPORT *report)
+{
+    entry->report.xusb = *report;
+    _target_batch_enqueue(batch, entry, controller);
+}
+
+void target_batch_queue_ds4(struct target_batch *batch, struct target_batch_entry *entry,
+                            struct stadia_controller *controller, const DS4_REPORT_EX *report)
+{
+    entry->report.ds4 = *report;
+    _target_batch_enqueue(batch, entry, controller);
+}
+
+void target_batch_cancel(struct target_batch *batch, struct target_batch_entry *entry)
+{
+    if (!entry->queued)
+    {
+        return;
+    }
+
+    struct target_batch_entry **link = &batch->head;
+    while (*link != entry)
+    {
+        link = &(*link)->next;
+    }
+
+    *link = entry->next;
+    if (batch->tail == &entry->next)
+    {
+        batch->tail = link;
+    }
+    entry->queued = FALSE;
+    entry->next = NULL;
+    // A flush left with nothing to do is harmless, the timer is not worth taking back.
+}
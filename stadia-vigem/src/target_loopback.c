@@ -0,0 +1,129 @@
+/*
+ * target_loopback.c -- In-process target sink keeping the last report of each target.
+ */
+
+#include "target.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct target_loopback
+{
+    struct target base;
+
+    SRWLOCK lock;
+    LONG submitted;
+    XUSB_REPORT xusb;
+    DS4_REPORT_EX ds4;
+
+    volatile LONG listening;
+};
+
+static struct target_sink *_target_loopback_connect(LPTSTR address, INT *error)
+{
+    (void)address;
+    (void)error;
+
+    return (struct target_sink *)malloc(sizeof(struct target_sink));
+}
+
+static void _target_loopback_disconnect(struct target_sink *sink)
+{
+    free(sink);
+}
+
+static struct target *_target_loopback_add(struct target_sink *sink, UINT type)
+{
+    (void)sink;
+    (void)type;
+
+    struct target_loopback *target = (struct target_loopback *)malloc(sizeof(struct target_loopback));
+    InitializeSRWLock(&target->lock);
+    target->submitted = 0;
+    memset(&target->xusb, 0, sizeof(XUSB_REPORT));
+    memset(&target->ds4, 0, sizeof(DS4_REPORT_EX));
+    target->listening = FALSE;
+
+    return &target->base;
+}
+
+static BOOL _target_loopback_listen(struct target *target)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    InterlockedExchange(&loopback->listening, TRUE);
+    return TRUE;
+}
+
+static BOOL _target_loopback_submit_xusb(struct target *target, const XUSB_REPORT *report)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    AcquireSRWLockExclusive(&loopback->lock);
+    loopback->xusb = *report;
+    loopback->submitted++;
+    ReleaseSRWLockExclusive(&loopback->lock);
+
+    return TRUE;
+}
+
+static BOOL _target_loopback_submit_ds4(struct target *target, const DS4_REPORT_EX *report)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    AcquireSRWLockExclusive(&loopback->lock);
+    loopback->ds4 = *report;
+    loopback->submitted++;
+    ReleaseSRWLockExclusive(&loopback->lock);
+
+    return TRUE;
+}
+
+static void _target_loopback_remove(struct target *target)
+{
+    free(target);
+}
+
+const struct target_backend target_loopback_backend = {
+    .name = "loopback",
+    .connect = _target_loopback_connect,
+    .disconnect = _target_loopback_disconnect,
+    .add = _target_loopback_add,
+    .listen = _target_loopback_listen,
+    .submit_xusb = _target_loopback_submit_xusb,
+    .submit_ds4 = _target_loopback_submit_ds4,
+    .remove = _target_loopback_remove};
+
+LONG target_loopback_get_xusb(struct target *target, XUSB_REPORT *report)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    AcquireSRWLockShared(&loopback->lock);
+    *report = loopback->xusb;
+    LONG submitted = loopback->submitted;
+    ReleaseSRWLockShared(&loopback->lock);
+
+    return submitted;
+}
+
+LONG target_loopback_get_ds4(struct target *target, DS4_REPORT_EX *report)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    AcquireSRWLockShared(&loopback->lock);
+    *report = loopback->ds4;
+    LONG submitted = loopback->submitted;
+    ReleaseSRWLockShared(&loopback->lock);
+
+    return submitted;
+}
+
+void target_loopback_rumble(struct target *target, BYTE small_motor, BYTE big_motor)
+{
+    struct target_loopback *loopback = (struct target_loopback *)target;
+
+    if (loopback->listening && target->rumble != NULL)
+    {
+        target->rumble(target, small_motor, big_motor, target->context);
+    }
+}
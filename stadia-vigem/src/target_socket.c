@@ -0,0 +1,232 @@
+/*
+ * target_socket.c -- Target sink sending reports to a UDP peer, a stand-in for the bus driver.
+ */
+
+#include "target.h"
+
+#ifndef _WIN32
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "slot_table.h"
+
+#define TARGET_SOCKET_DEFAULT_ADDRESS "127.0.0.1:26760"
+#define TARGET_SOCKET_MAX_TARGETS 256
+
+// Longest the receiver waits for a datagram before checking whether the sink is going away.
+#define TARGET_SOCKET_RECEIVE_TIMEOUT 100
+
+#define TARGET_SOCKET_HEADER_SIZE (sizeof(DWORD) + 1)
+#define TARGET_SOCKET_RUMBLE_SIZE (sizeof(DWORD) + 2)
+
+struct target_socket_sink
+{
+    struct target_sink base;
+
+    int fd;
+    pthread_t receiver;
+    volatile LONG stopping;
+
+    // Targets by identifier, the receiver only calls back under the shared lock.
+    SRWLOCK lock;
+    struct slot_table targets;
+};
+
+struct target_socket
+{
+    struct target base;
+
+    DWORD id;
+    volatile LONG listening;
+};
+
+static BOOL _target_socket_parse_address(LPTSTR address, struct sockaddr_in *peer)
+{
+    char host[64];
+    unsigned int port;
+
+    if (sscanf(address, "%63[^:]:%u", host, &port) != 2 || port == 0 || port > 0xFFFF)
+    {
+        return FALSE;
+    }
+
+    memset(peer, 0, sizeof(struct sockaddr_in));
+    peer->sin_family = AF_INET;
+    peer->sin_port = htons((USHORT)port);
+    return inet_pton(AF_INET, host, &peer->sin_addr) == 1;
+}
+
+static void *_target_socket_receive(void *param)
+{
+    struct target_socket_sink *sink = (struct target_socket_sink *)param;
+    BYTE datagram[TARGET_SOCKET_RUMBLE_SIZE];
+
+    while (!sink->stopping)
+    {
+        // Times out regularly, and fails while nothing listens on the peer's end.
+        ssize_t length = recv(sink->fd, datagram, sizeof(datagram), 0);
+        if (length != TARGET_SOCKET_RUMBLE_SIZE)
+        {
+            continue;
+        }
+
+        DWORD id;
+        memcpy(&id, datagram, sizeof(DWORD));
+
+        AcquireSRWLockShared(&sink->lock);
+        struct target_socket *target = (struct target_socket *)slot_table_get(&sink->targets, id);
+        if (target != NULL && target->listening && target->base.rumble != NULL)
+        {
+            target->base.rumble(&target->base, datagram[sizeof(DWORD)], datagram[sizeof(DWORD) + 1],
+                                target->base.context);
+        }
+        ReleaseSRWLockShared(&sink->lock);
+    }
+
+    return NULL;
+}
+
+static struct target_sink *_target_socket_connect(LPTSTR address, INT *error)
+{
+    struct sockaddr_in peer;
+    if (!_target_socket_parse_address(address != NULL ? address : TARGET_SOCKET_DEFAULT_ADDRESS, &peer))
+    {
+        *error = TARGET_ERROR_NOT_FOUND;
+        return NULL;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        *error = TARGET_ERROR_CONNECT_FAILURE;
+        return NULL;
+    }
+
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = TARGET_SOCKET_RECEIVE_TIMEOUT * 1000};
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        connect(fd, (struct sockaddr *)&peer, sizeof(peer)) < 0)
+    {
+        close(fd);
+        *error = TARGET_ERROR_CONNECT_FAILURE;
+        return NULL;
+    }
+
+    struct target_socket_sink *sink = (struct target_socket_sink *)malloc(sizeof(struct target_socket_sink));
+    sink->fd = fd;
+    sink->stopping = FALSE;
+    InitializeSRWLock(&sink->lock);
+    if (!slot_table_init(&sink->targets, 4, TARGET_SOCKET_MAX_TARGETS))
+    {
+        close(fd);
+        free(sink);
+        *error = TARGET_ERROR_CONNECT_FAILURE;
+        return NULL;
+    }
+
+    if (pthread_create(&sink->receiver, NULL, _target_socket_receive, sink) != 0)
+    {
+        slot_table_free(&sink->targets);
+        close(fd);
+        free(sink);
+        *error = TARGET_ERROR_CONNECT_FAILURE;
+        return NULL;
+    }
+
+    return &sink->base;
+}
+
+static void _target_socket_disconnect(struct target_sink *sink)
+{
+    struct target_socket_sink *socket_sink = (struct target_socket_sink *)sink;
+
+    InterlockedExchange(&socket_sink->stopping, TRUE);
+    pthread_join(socket_sink->receiver, NULL);
+
+    close(socket_sink->fd);
+    slot_table_free(&socket_sink->targets);
+    free(socket_sink);
+}
+
+static struct target *_target_socket_add(struct target_sink *sink, UINT type)
+{
+    struct target_socket_sink *socket_sink = (struct target_socket_sink *)sink;
+    (void)type;
+
+    struct target_socket *target = (struct target_socket *)malloc(sizeof(struct target_socket));
+    target->listening = FALSE;
+
+    AcquireSRWLockExclusive(&socket_sink->lock);
+    target->id = slot_table_add(&socket_sink->targets, target);
+    ReleaseSRWLockExclusive(&socket_sink->lock);
+
+    if (target->id == SLOT_TABLE_INVALID_HANDLE)
+    {
+        free(target);
+        return NULL;
+    }
+    return &target->base;
+}
+
+static BOOL _target_socket_listen(struct target *target)
+{
+    struct target_socket *socket_target = (struct target_socket *)target;
+
+    InterlockedExchange(&socket_target->listening, TRUE);
+    return TRUE;
+}
+
+static BOOL _target_socket_send(struct target *target, const void *report, size_t length)
+{
+    struct target_socket_sink *sink = (struct target_socket_sink *)target->sink;
+    struct target_socket *socket_target = (struct target_socket *)target;
+    BYTE datagram[TARGET_SOCKET_HEADER_SIZE + sizeof(DS4_REPORT_EX)];
+
+    memcpy(datagram, &socket_target->id, sizeof(DWORD));
+    datagram[sizeof(DWORD)] = (BYTE)target->type;
+    memcpy(&datagram[TARGET_SOCKET_HEADER_SIZE], report, length);
+
+    // Never blocks the input path, a report the socket has no room for is dropped.
+    return send(sink->fd, datagram, TARGET_SOCKET_HEADER_SIZE + length, MSG_DONTWAIT) >= 0;
+}
+
+static BOOL _target_socket_submit_xusb(struct target *target, const XUSB_REPORT *report)
+{
+    return _target_socket_send(target, report, sizeof(XUSB_REPORT));
+}
+
+static BOOL _target_socket_submit_ds4(struct target *target, const DS4_REPORT_EX *report)
+{
+    return _target_socket_send(target, report->ReportBuffer, sizeof(report->ReportBuffer));
+}
+
+static void _target_socket_remove(struct target *target)
+{
+    struct target_socket_sink *sink = (struct target_socket_sink *)target->sink;
+    struct target_socket *socket_target = (struct target_socket *)target;
+
+    // Waits out a rumble callback in progress.
+    AcquireSRWLockExclusive(&sink->lock);
+    slot_table_remove(&sink->targets, socket_target->id);
+    ReleaseSRWLockExclusive(&sink->lock);
+
+    free(socket_target);
+}
+
+const struct target_backend target_socket_backend = {
+    .name = "socket",
+    .connect = _target_socket_connect,
+    .disconnect = _target_socket_disconnect,
+    .add = _target_socket_add,
+    .listen = _target_socket_listen,
+    .submit_xusb = _target_socket_submit_xusb,
+    .submit_ds4 = _target_socket_submit_ds4,
+    .remove = _target_socket_remove};
+
+#endif /* _WIN32 */
@@ -0,0 +1,201 @@
+/*
+ * target_vigem.c -- Target sink over the ViGEmBus driver.
+ */
+
+#include "target.h"
+
+#ifdef _WIN32
+
+#include <stdlib.h>
+
+#include <ViGEm/Client.h>
+
+#include "mapping.h"
+
+// Longest a DS4 output thread waits for a report before checking whether its target is going away.
+#define DS4_OUTPUT_WAIT_TIMEOUT 250
+
+struct target_vigem_sink
+{
+    struct target_sink base;
+
+    PVIGEM_CLIENT client;
+};
+
+struct target_vigem
+{
+    struct target base;
+
+    PVIGEM_CLIENT client;
+    PVIGEM_TARGET target;
+
+    BOOL notifying;
+    // Passes DS4 rumble on, runs until the target is removed.
+    HANDLE output_thread;
+    volatile LONG stopping;
+};
+
+static struct target_sink *_target_vigem_connect(LPTSTR address, INT *error)
+{
+    (void)address;
+
+    PVIGEM_CLIENT client = vigem_alloc();
+    if (client == NULL)
+    {
+        *error = TARGET_ERROR_CONNECT_FAILURE;
+        return NULL;
+    }
+
+    VIGEM_ERROR result = vigem_connect(client);
+    if (result != VIGEM_ERROR_NONE)
+    {
+        *error = result == VIGEM_ERROR_BUS_NOT_FOUND          ? TARGET_ERROR_NOT_FOUND
+                 : result == VIGEM_ERROR_BUS_VERSION_MISMATCH ? TARGET_ERROR_VERSION_MISMATCH
+                                                              : TARGET_ERROR_CONNECT_FAILURE;
+        vigem_free(client);
+        return NULL;
+    }
+
+    struct target_vigem_sink *sink = (struct target_vigem_sink *)malloc(sizeof(struct target_vigem_sink));
+    sink->client = client;
+
+    return &sink->base;
+}
+
+static void _target_vigem_disconnect(struct target_sink *sink)
+{
+    struct target_vigem_sink *vigem = (struct target_vigem_sink *)sink;
+
+    vigem_disconnect(vigem->client);
+    vigem_free(vigem->client);
+    free(vigem);
+}
+
+static struct target *_target_vigem_add(struct target_sink *sink, UINT type)
+{
+    struct target_vigem_sink *vigem = (struct target_vigem_sink *)sink;
+
+    PVIGEM_TARGET pad = type == TARGET_TYPE_DS4 ? vigem_target_ds4_alloc() : vigem_target_x360_alloc();
+    if (pad == NULL)
+    {
+        return NULL;
+    }
+    if (vigem_target_add(vigem->client, pad) != VIGEM_ERROR_NONE)
+    {
+        vigem_target_free(pad);
+        return NULL;
+    }
+
+    struct target_vigem *target = (struct target_vigem *)malloc(sizeof(struct target_vigem));
+    target->client = vigem->client;
+    target->target = pad;
+    target->notifying = FALSE;
+    target->output_thread = NULL;
+    target->stopping = FALSE;
+
+    return &target->base;
+}
+
+static void CALLBACK _target_vigem_x360_notification(PVIGEM_CLIENT client, PVIGEM_TARGET pad, UCHAR large_motor,
+                                                     UCHAR small_motor, UCHAR led_number, LPVOID user_data)
+{
+    struct target_vigem *target = (struct target_vigem *)user_data;
+    (void)client;
+    (void)pad;
+    (void)led_number;
+
+    target->base.rumble(&target->base, small_motor, large_motor, target->base.context);
+}
+
+static DWORD WINAPI _target_vigem_ds4_output_thread(LPVOID param)
+{
+    struct target_vigem *target = (struct target_vigem *)param;
+    DS4_OUTPUT_BUFFER buffer;
+    struct mapping_ds4_output output;
+
+    while (!target->stopping)
+    {
+        VIGEM_ERROR error = vigem_target_ds4_await_output_report_timeout(target->client, target->target,
+                                                                         DS4_OUTPUT_WAIT_TIMEOUT, &buffer);
+        if (error == VIGEM_ERROR_TIMED_OUT)
+        {
+            continue;
+        }
+        if (error != VIGEM_ERROR_NONE)
+        {
+            break;
+        }
+
+        // The Stadia controller has no lightbar, only the motors are passed on.
+        if (mapping_parse_ds4_output(buffer.Buffer, sizeof(buffer.Buffer), &output) &&
+            (output.flags & MAPPING_DS4_OUTPUT_RUMBLE) != 0)
+        {
+            target->base.rumble(&target->base, output.small_motor, output.big_motor, target->base.context);
+        }
+    }
+
+    return 0;
+}
+
+static BOOL _target_vigem_listen(struct target *target)
+{
+    struct target_vigem *vigem = (struct target_vigem *)target;
+
+    if (target->type == TARGET_TYPE_DS4)
+    {
+        vigem->output_thread = CreateThread(NULL, 0, _target_vigem_ds4_output_thread, vigem, 0, NULL);
+        return vigem->output_thread != NULL;
+    }
+
+    vigem->notifying = vigem_target_x360_register_notification(vigem->client, vigem->target,
+                                                               _target_vigem_x360_notification,
+                                                               (LPVOID)vigem) == VIGEM_ERROR_NONE;
+    return vigem->notifying;
+}
+
+static BOOL _target_vigem_submit_xusb(struct target *target, const XUSB_REPORT *report)
+{
+    struct target_vigem *vigem = (struct target_vigem *)target;
+
+    return vigem_target_x360_update(vigem->client, vigem->target, *report) == VIGEM_ERROR_NONE;
+}
+
+static BOOL _target_vigem_submit_ds4(struct target *target, const DS4_REPORT_EX *report)
+{
+    struct target_vigem *vigem = (struct target_vigem *)target;
+
+    return vigem_target_ds4_update_ex(vigem->client, vigem->target, *report) == VIGEM_ERROR_NONE;
+}
+
+static void _target_vigem_remove(struct target *target)
+{
+    struct target_vigem *vigem = (struct target_vigem *)target;
+
+    if (vigem->notifying)
+    {
+        vigem_target_x360_unregister_notification(vigem->target);
+    }
+
+    // Removing the target also aborts the output thread's wait.
+    InterlockedExchange(&vigem->stopping, TRUE);
+    vigem_target_remove(vigem->client, vigem->target);
+    if (vigem->output_thread != NULL)
+    {
+        WaitForSingleObject(vigem->output_thread, INFINITE);
+        CloseHandle(vigem->output_thread);
+    }
+    vigem_target_free(vigem->target);
+    free(vigem);
+}
+
+const struct target_backend target_vigem_backend = {
+    .name = "vigem",
+    .connect = _target_vigem_connect,
+    .disconnect = _target_vigem_disconnect,
+    .add = _target_vigem_add,
+    .listen = _target_vigem_listen,
+    .submit_xusb = _target_vigem_submit_xusb,
+    .submit_ds4 = _target_vigem_submit_ds4,
+    .remove = _target_vigem_remove};
+
+#endif /* _WIN32 */
@@ -13,6 +13,7 @@
 #pragma comment(lib, "shell32.lib")
 
 #define WM_TRAY_CALLBACK_MESSAGE (WM_USER + 1)
+#define WM_TRAY_INVOKE_MESSAGE (WM_USER + 2)
 #define WC_TRAY_CLASS_NAME TEXT("StadiaViGEmClass")
 #define WC_TRAY_MUTEX_NAME TEXT("Stadia Controller")
 #define ID_TRAY_FIRST 1000
@@ -51,6 +52,9 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
             return 0;
         }
         break;
+    case WM_TRAY_INVOKE_MESSAGE:
+        ((void (*)(void *))wparam)((void *)lparam);
+        return 0;
     case WM_COMMAND:
         if (wparam >= ID_TRAY_FIRST)
         {
@@ -70,7 +74,9 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
         }
         break;
     case WM_DEVICECHANGE:
-        if (devntf_cb != NULL)
+        // Volumes, ports and the like are broadcast here too, only device interfaces are passed on.
+        if (devntf_cb != NULL &&
+            (lparam == 0 || ((PDEV_BROADCAST_HDR)lparam)->dbch_devicetype == DBT_DEVTYP_DEVICEINTERFACE))
         {
             UINT op = DO_TRAY_UNKNOWN;
             switch (wparam)
@@ -251,6 +257,16 @@ void tray_register_device_notification(GUID filter, void (*cb)(UINT, LPTSTR))
     }
 }
 
+void tray_invoke(void (*cb)(void *), void *context)
+{
+    if (window_handle == NULL)
+    {
+        return;
+    }
+
+    PostMessage(window_handle, WM_TRAY_INVOKE_MESSAGE, (WPARAM)cb, (LPARAM)context);
+}
+
 void tray_show_notification(UINT type, LPTSTR title, LPTSTR text)
 {
     if (window_handle == NULL)
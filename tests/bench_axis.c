@@ -0,0 +1,87 @@
+/*
+ * bench_axis.c -- Stick conversion: the former per-axis mapping, table lookups and the four-lane path.
+ */
+
+#include "mapping.h"
+#include "test.h"
+
+#define REPORT_COUNT 4096
+
+__attribute__((noinline)) static void old_translate_sticks(const BYTE *sticks, XUSB_REPORT *out)
+{
+    BYTE values[4] = {sticks[0], sticks[1], sticks[2], sticks[3]};
+    BOOL inverted[4] = {FALSE, TRUE, FALSE, TRUE};
+    SHORT axes[4];
+
+    // As _map_byte_to_short used to map each axis, with the signed char of MSVC.
+    for (INT i = 0; i < 4; i++)
+    {
+        signed char centered = (signed char)(values[i] - 128);
+        if (centered < -127)
+        {
+            centered = -127;
+        }
+        if (inverted[i])
+        {
+            centered = -centered;
+        }
+        axes[i] = (SHORT)(32767 * centered / 127);
+    }
+
+    out->sThumbLX = axes[0];
+    out->sThumbLY = axes[1];
+    out->sThumbRX = axes[2];
+    out->sThumbRY = axes[3];
+}
+
+// What mapping_translate_sticks falls back to without SSE2.
+__attribute__((noinline)) static void table_translate_sticks(const BYTE *sticks, XUSB_REPORT *out)
+{
+    out->sThumbLX = mapping_axis_map[sticks[0]];
+    out->sThumbLY = mapping_axis_inverted_map[sticks[1]];
+    out->sThumbRX = mapping_axis_map[sticks[2]];
+    out->sThumbRY = mapping_axis_inverted_map[sticks[3]];
+}
+
+static void default_translate_sticks(const BYTE *sticks, XUSB_REPORT *out)
+{
+    mapping_translate_sticks(NULL, sticks, out);
+}
+
+#define RUN(name, translate, reports, repeat)                                              \
+    do                                                                                     \
+    {                                                                                      \
+        XUSB_REPORT _report;                                                               \
+        LONG _checksum = 0;                                                                \
+        ULONGLONG _start_us = timer_now_us();                                              \
+        for (long _r = 0; _r < (repeat); _r++)                                             \
+        {                                                                                  \
+            for (size_t _i = 0; _i < REPORT_COUNT; _i++)                                   \
+            {                                                                              \
+                translate(&(reports)[_i * STADIA_INPUT_REPORT_MIN_SIZE + 4], &_report);    \
+                _checksum += _report.sThumbLX + _report.sThumbLY + _report.sThumbRY;       \
+            }                                                                              \
+        }                                                                                  \
+        bench_print(name, (ULONGLONG)(repeat) * REPORT_COUNT, timer_now_us() - _start_us); \
+        checksums[runs++] = _checksum;                                                     \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    long repeat = bench_repeat(argc, argv, 2000);
+    LONG checksums[3];
+    INT runs = 0;
+
+    test_report_stream(reports, REPORT_COUNT, 0xA815);
+
+    printf("bench_axis: %ld x %d reports, four axes each\n", repeat, REPORT_COUNT);
+    RUN("_map_byte_to_short", old_translate_sticks, reports, repeat);
+    RUN("axis tables", table_translate_sticks, reports, repeat);
+    // Through the four-lane path where SSE2 is available.
+    RUN("mapping_translate_sticks", default_translate_sticks, reports, repeat);
+
+    CHECK_EQ(checksums[1], checksums[0]);
+    CHECK_EQ(checksums[2], checksums[0]);
+    return test_result("bench_axis");
+}
@@ -0,0 +1,120 @@
+/*
+ * bench_buttons.c -- Button decoding through lookup tables against the former test-and-OR chain.
+ */
+
+#include "report.h"
+#include "test.h"
+
+#define REPORT_COUNT 4096
+
+static const DWORD old_dpad_map[8] = {
+    STADIA_BUTTON_UP,
+    STADIA_BUTTON_UP | STADIA_BUTTON_RIGHT,
+    STADIA_BUTTON_RIGHT,
+    STADIA_BUTTON_RIGHT | STADIA_BUTTON_DOWN,
+    STADIA_BUTTON_DOWN,
+    STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT,
+    STADIA_BUTTON_LEFT,
+    STADIA_BUTTON_LEFT | STADIA_BUTTON_UP};
+
+// As _stadia_input_thread used to decode a report, one button bit at a time. Kept out of line
+// like stadia_decode_report, so both are timed as a call.
+__attribute__((noinline)) static BOOL old_decode_report(const BYTE *buf, size_t len, struct stadia_state *out)
+{
+    if (len < STADIA_INPUT_REPORT_MIN_SIZE || buf[0] != STADIA_INPUT_REPORT_ID)
+    {
+        return FALSE;
+    }
+
+    out->buttons = STADIA_BUTTON_NONE;
+
+    out->buttons |= buf[1] < 8 ? old_dpad_map[buf[1]] : 0;
+
+    out->buttons |= (buf[2] & (1 << 7)) != 0 ? STADIA_BUTTON_RS : 0;
+    out->buttons |= (buf[2] & (1 << 6)) != 0 ? STADIA_BUTTON_OPTIONS : 0;
+    out->buttons |= (buf[2] & (1 << 5)) != 0 ? STADIA_BUTTON_MENU : 0;
+    out->buttons |= (buf[2] & (1 << 4)) != 0 ? STADIA_BUTTON_STADIA_BTN : 0;
+
+    out->buttons |= (buf[3] & (1 << 6)) != 0 ? STADIA_BUTTON_A : 0;
+    out->buttons |= (buf[3] & (1 << 5)) != 0 ? STADIA_BUTTON_B : 0;
+    out->buttons |= (buf[3] & (1 << 4)) != 0 ? STADIA_BUTTON_X : 0;
+    out->buttons |= (buf[3] & (1 << 3)) != 0 ? STADIA_BUTTON_Y : 0;
+    out->buttons |= (buf[3] & (1 << 2)) != 0 ? STADIA_BUTTON_LB : 0;
+    out->buttons |= (buf[3] & (1 << 1)) != 0 ? STADIA_BUTTON_RB : 0;
+    out->buttons |= (buf[3] & (1 << 0)) != 0 ? STADIA_BUTTON_LS : 0;
+
+    out->left_stick_x = buf[4];
+    out->left_stick_y = buf[5];
+    out->right_stick_x = buf[6];
+    out->right_stick_y = buf[7];
+    out->left_trigger = buf[8];
+    out->right_trigger = buf[9];
+
+    return TRUE;
+}
+
+#define RUN(decode, reports, repeat, checksum)                                                \
+    do                                                                                        \
+    {                                                                                         \
+        struct stadia_state _state;                                                           \
+        ULONGLONG _start_us = timer_now_us();                                                 \
+        for (long _r = 0; _r < (repeat); _r++)                                                \
+        {                                                                                     \
+            for (size_t _i = 0; _i < REPORT_COUNT; _i++)                                      \
+            {                                                                                 \
+                const BYTE *_report = &(reports)[_i * STADIA_INPUT_REPORT_MIN_SIZE];          \
+                decode(_report, STADIA_INPUT_REPORT_MIN_SIZE, &_state);                       \
+                (checksum) += _state.buttons;                                                 \
+            }                                                                                 \
+        }                                                                                     \
+        bench_print(#decode, (ULONGLONG)(repeat) * REPORT_COUNT, timer_now_us() - _start_us); \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    long repeat = bench_repeat(argc, argv, 2000);
+
+    // Both agree on every possible value of the three button bytes first.
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID};
+    for (INT value = 0; value < 256; value++)
+    {
+        for (INT byte = 1; byte <= 3; byte++)
+        {
+            buf[1] = buf[2] = buf[3] = 0;
+            buf[byte] = (BYTE)value;
+            struct stadia_state old_state, new_state;
+            CHECK(old_decode_report(buf, sizeof(buf), &old_state));
+            CHECK(stadia_decode_report(buf, sizeof(buf), &new_state));
+            CHECK_EQ(new_state.buttons, old_state.buttons);
+        }
+    }
+
+    test_report_stream(reports, REPORT_COUNT, 0xB077);
+    // The synthetic session rarely touches the buttons, so a second stream mashes them every report.
+    static BYTE mashed[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    DWORD seed = 0xB0B0;
+    test_report_stream(mashed, REPORT_COUNT, seed);
+    for (size_t i = 0; i < REPORT_COUNT; i++)
+    {
+        DWORD r = test_random(&seed);
+        mashed[i * STADIA_INPUT_REPORT_MIN_SIZE + 1] = (BYTE)(r % 9);
+        mashed[i * STADIA_INPUT_REPORT_MIN_SIZE + 2] = (BYTE)(r >> 8);
+        mashed[i * STADIA_INPUT_REPORT_MIN_SIZE + 3] = (BYTE)(r >> 16);
+    }
+
+    DWORD old_checksum = 0, new_checksum = 0;
+    printf("bench_buttons: %ld x %d reports\n", repeat, REPORT_COUNT);
+
+    printf(" session\n");
+    RUN(old_decode_report, reports, repeat, old_checksum);
+    RUN(stadia_decode_report, reports, repeat, new_checksum);
+    CHECK_EQ(new_checksum, old_checksum);
+
+    printf(" button mashing\n");
+    RUN(old_decode_report, mashed, repeat, old_checksum);
+    RUN(stadia_decode_report, mashed, repeat, new_checksum);
+    CHECK_EQ(new_checksum, old_checksum);
+
+    return test_result("bench_buttons");
+}
@@ -0,0 +1,62 @@
+/*
+ * bench_ds4.c -- The fused DS4 translation against the XUSB one it runs instead of, with the
+ * default mapping and with a curved profile.
+ */
+
+#include "mapping.h"
+#include "test.h"
+
+#define REPORT_COUNT 4096
+
+#define RUN(name, translate, profile, out, reports, repeat, checksum)                         \
+    do                                                                                        \
+    {                                                                                         \
+        ULONGLONG _start_us = timer_now_us();                                                 \
+        for (long _r = 0; _r < (repeat); _r++)                                                \
+        {                                                                                     \
+            for (size_t _i = 0; _i < REPORT_COUNT; _i++)                                      \
+            {                                                                                 \
+                const BYTE *_report = &(reports)[_i * STADIA_INPUT_REPORT_MIN_SIZE];          \
+                translate(profile, _report, STADIA_INPUT_REPORT_MIN_SIZE, &(out));            \
+                (checksum) += *(const BYTE *)&(out);                                          \
+            }                                                                                 \
+        }                                                                                     \
+        bench_print(name, (ULONGLONG)(repeat) * REPORT_COUNT, timer_now_us() - _start_us);    \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    long repeat = bench_repeat(argc, argv, 2000);
+    struct profile_settings settings;
+    XUSB_REPORT xusb;
+    DS4_REPORT_EX ds4;
+    DWORD checksum = 0;
+
+    test_report_stream(reports, REPORT_COUNT, 0xD54B);
+    XUSB_REPORT_INIT(&xusb);
+    mapping_ds4_report_init(&ds4);
+
+    profile_settings_init(&settings);
+    settings.left_stick.deadzone_type = settings.right_stick.deadzone_type = PROFILE_DEADZONE_RADIAL;
+    settings.left_stick.deadzone = settings.right_stick.deadzone = 0.1f;
+    settings.left_stick.curve.type = settings.right_stick.curve.type = PROFILE_CURVE_EXPONENTIAL;
+    settings.left_stick.curve.exponent = settings.right_stick.curve.exponent = 1.5f;
+    settings.left_trigger.deadzone = settings.right_trigger.deadzone = 0.05f;
+    struct mapping_profile *curved = mapping_profile_create(&settings);
+    CHECK(curved != NULL);
+    if (curved == NULL)
+    {
+        return test_result("bench_ds4");
+    }
+
+    printf("bench_ds4: %ld x %d reports\n", repeat, REPORT_COUNT);
+    RUN("xusb", mapping_translate_xusb, NULL, xusb, reports, repeat, checksum);
+    RUN("ds4", mapping_translate_ds4, NULL, ds4, reports, repeat, checksum);
+    RUN("xusb, curved", mapping_translate_xusb, curved, xusb, reports, repeat, checksum);
+    RUN("ds4, curved", mapping_translate_ds4, curved, ds4, reports, repeat, checksum);
+    printf("  (checksum %08lx)\n", (unsigned long)checksum);
+
+    mapping_profile_free(curved);
+    return test_result("bench_ds4");
+}
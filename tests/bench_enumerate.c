@@ -0,0 +1,207 @@
+/*
+ * bench_enumerate.c -- HID enumeration over a synthetic device tree, filtering on instance IDs before
+ * any interface is queried against filtering every interface path.
+ *
+ * SetupAPI is not available here, so its queries are modeled by building the strings they return:
+ * an instance ID per device, and for every interface a detail path derived from it. The timings only
+ * count that modeled work; on Windows each skipped query is a call into SetupAPI and costs far more.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "hid.h"
+#include "stadia.h"
+#include "test.h"
+
+#define DEVICE_COUNT 160
+#define MAX_INTERFACES 4
+#define MAX_ID_LEN 200
+
+#define HID_INTERFACE_CLASS TEXT("{4d1e55b2-f16f-11cf-88cb-001111000030}")
+#define BLUETOOTH_HID_SERVICE TEXT("{00001124-0000-1000-8000-00805f9b34fb}")
+
+struct synthetic_device
+{
+    TCHAR instance_id[MAX_ID_LEN];
+    INT interface_count;
+};
+
+static struct synthetic_device devices[DEVICE_COUNT];
+static LPTSTR filters[3] = {STADIA_USB_HW_FILTER, STADIA_BLT_HW_FILTER, NULL};
+
+/*
+ * A desk's worth of HID devices: receivers, keyboards and headsets exposing several collections,
+ * some over Bluetooth, with a USB and a Bluetooth Stadia controller among them.
+ */
+static void make_devices()
+{
+    static const WORD vendors[] = {0x046D, 0x045E, 0x1532, 0x0B05, 0x05AC, 0x1038, 0x0951, 0x054C};
+    DWORD seed = 0xE7E7;
+
+    for (INT i = 0; i < DEVICE_COUNT; i++)
+    {
+        DWORD r = test_random(&seed);
+        WORD vendor = vendors[r % 8];
+        WORD product = (WORD)(r >> 8);
+        devices[i].interface_count = 1 + (INT)((r >> 24) % MAX_INTERFACES);
+
+        if (i == DEVICE_COUNT / 3 || i == 2 * DEVICE_COUNT / 3)
+        {
+            vendor = 0x18D1;
+            product = 0x9400;
+        }
+        if (i % 5 == 0 || i == 2 * DEVICE_COUNT / 3)
+        {
+            snprintf(devices[i].instance_id, MAX_ID_LEN, "HID\\%s_VID&02%04x_PID&%04x\\9&%x&0&0000",
+                     BLUETOOTH_HID_SERVICE, vendor, product, (unsigned)test_random(&seed));
+        }
+        else
+        {
+            snprintf(devices[i].instance_id, MAX_ID_LEN, "HID\\VID_%04X&PID_%04X&MI_%02d&COL%02d\\8&%x&0&%04d", vendor,
+                     product, i % 3, 1 + i % 4, (unsigned)test_random(&seed), i);
+        }
+    }
+}
+
+// What SetupDiGetDeviceInterfaceDetail returns for an interface of the device.
+static size_t interface_path(const struct synthetic_device *device, INT index, LPTSTR out, size_t size)
+{
+    TCHAR id[MAX_ID_LEN];
+    size_t i;
+
+    for (i = 0; device->instance_id[i] != 0; i++)
+    {
+        id[i] = device->instance_id[i] == '\\' ? '#' : (TCHAR)tolower((TBYTE)device->instance_id[i]);
+    }
+    id[i] = 0;
+    return (size_t)snprintf(out, size, "\\\\?\\%s&%d#%s", id, index, HID_INTERFACE_CLASS);
+}
+
+static struct hid_device_info *add_device_info(struct hid_device_info **tail, LPTSTR path)
+{
+    struct hid_device_info *info = (struct hid_device_info *)malloc(sizeof(struct hid_device_info));
+    info->path = strdup(path);
+    info->description = NULL;
+    info->next = NULL;
+    *tail = info;
+    return info;
+}
+
+// As hid_enumerate did before: every interface sized, allocated, fetched, then matched.
+__attribute__((noinline)) static struct hid_device_info *enumerate_interfaces()
+{
+    struct hid_device_info *head = NULL, **tail = &head;
+
+    for (INT d = 0; d < DEVICE_COUNT; d++)
+    {
+        for (INT i = 0; i < devices[d].interface_count; i++)
+        {
+            size_t size = interface_path(&devices[d], i, NULL, 0) + 1;
+            LPTSTR detail = (LPTSTR)malloc(size * sizeof(TCHAR));
+            interface_path(&devices[d], i, detail, size);
+            if (hid_match_filters(detail, filters))
+            {
+                tail = &add_device_info(tail, detail)->next;
+            }
+            free(detail);
+        }
+    }
+    return head;
+}
+
+// As hid_enumerate does now: the instance ID decides first, and one detail buffer serves throughout.
+__attribute__((noinline)) static struct hid_device_info *enumerate_prefiltered()
+{
+    struct hid_device_info *head = NULL, **tail = &head;
+    TCHAR instance_id[MAX_ID_LEN];
+    LPTSTR detail = NULL;
+    size_t detail_size = 0;
+
+    for (INT d = 0; d < DEVICE_COUNT; d++)
+    {
+        memcpy(instance_id, devices[d].instance_id, sizeof(instance_id));
+        if (!hid_match_filters(instance_id, filters))
+        {
+            continue;
+        }
+
+        for (INT i = 0; i < devices[d].interface_count; i++)
+        {
+            size_t size = interface_path(&devices[d], i, detail, detail_size) + 1;
+            if (size > detail_size)
+            {
+                free(detail);
+                detail = (LPTSTR)malloc(size * sizeof(TCHAR));
+                detail_size = size;
+                interface_path(&devices[d], i, detail, detail_size);
+            }
+            if (hid_match_filters(detail, filters))
+            {
+                tail = &add_device_info(tail, detail)->next;
+            }
+        }
+    }
+    free(detail);
+    return head;
+}
+
+static INT free_list(struct hid_device_info *list)
+{
+    INT count = 0;
+    while (list != NULL)
+    {
+        struct hid_device_info *next = list->next;
+        hid_free_device_info(list);
+        list = next;
+        count++;
+    }
+    return count;
+}
+
+#define RUN(enumerate, repeat, found)                                                       \
+    do                                                                                      \
+    {                                                                                       \
+        ULONGLONG _start_us = timer_now_us();                                               \
+        for (long _r = 0; _r < (repeat); _r++)                                              \
+        {                                                                                   \
+            (found) += free_list(enumerate());                                              \
+        }                                                                                   \
+        bench_print(#enumerate, (ULONGLONG)(repeat), timer_now_us() - _start_us);           \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    long repeat = bench_repeat(argc, argv, 2000);
+    LONGLONG old_found = 0, new_found = 0;
+
+    make_devices();
+
+    // Both find the same interfaces, in the same order: those of the two Stadia controllers.
+    struct hid_device_info *old_list = enumerate_interfaces();
+    struct hid_device_info *new_list = enumerate_prefiltered();
+    INT expected = devices[DEVICE_COUNT / 3].interface_count + devices[2 * DEVICE_COUNT / 3].interface_count;
+    struct hid_device_info *o = old_list, *n = new_list;
+    INT count = 0;
+    for (; o != NULL && n != NULL; o = o->next, n = n->next, count++)
+    {
+        CHECK(strcmp(o->path, n->path) == 0);
+    }
+    CHECK(o == NULL && n == NULL);
+    CHECK_EQ(count, expected);
+    free_list(old_list);
+    free_list(new_list);
+
+    INT interfaces = 0;
+    for (INT d = 0; d < DEVICE_COUNT; d++)
+    {
+        interfaces += devices[d].interface_count;
+    }
+    printf("bench_enumerate: %ld x %d devices, %d interfaces, %d matching\n", repeat, DEVICE_COUNT, interfaces,
+           expected);
+    RUN(enumerate_interfaces, repeat, old_found);
+    RUN(enumerate_prefiltered, repeat, new_found);
+    CHECK_EQ(new_found, old_found);
+
+    return test_result("bench_enumerate");
+}
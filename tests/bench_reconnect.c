@@ -0,0 +1,240 @@
+/*
+ * bench_reconnect.c -- Reconnecting a known pad with and without the device cache, from the first
+ * open attempt to the first report handled.
+ *
+ * The pads are replayed captures behind a mock backend that models what opening costs on Windows:
+ * the capability queries for a device opened without known caps, failed exclusive opens while
+ * another program holds the device, and re-enabling it to evict that program. The costs are spun
+ * out on the timer, the figures below are guesses at the Win32 ones, not measurements.
+ */
+
+#include "device_cache.h"
+#include "test.h"
+
+#define CAPTURE_PATH TEXT("bench_reconnect.capture")
+#define CACHE_PATH TEXT("bench_reconnect.cache")
+
+#define CAPS_QUERY_US 300
+#define FAILED_OPEN_US 100
+#define REENABLE_US 3000
+
+#define WAIT_MS 2000
+
+/*
+ * Whether another program holds the pad, and whether re-enabling it evicts that program.
+ */
+static BOOL held;
+static BOOL held_after_reenable;
+
+static LONG caps_queries;
+static LONG failed_opens;
+static LONG reenables;
+
+static HANDLE first_report;
+
+static void spin_us(ULONGLONG duration_us)
+{
+    ULONGLONG start_us = timer_now_us();
+    while (timer_now_us() - start_us < duration_us)
+    {
+    }
+}
+
+static struct hid_device *mock_open(LPTSTR path, BOOL access_rw, BOOL shared, const struct hid_caps *caps)
+{
+    if (!shared && held)
+    {
+        spin_us(FAILED_OPEN_US);
+        failed_opens++;
+        return NULL;
+    }
+
+    struct hid_device *device = hid_replay_backend.open(path, access_rw, shared, caps);
+    if (device == NULL)
+    {
+        return NULL;
+    }
+    if (caps != NULL)
+    {
+        device->bus = caps->bus;
+        device->input_report_size = caps->input_report_size;
+        device->output_report_size = caps->output_report_size;
+        device->feature_report_size = caps->feature_report_size;
+    }
+    else
+    {
+        spin_us(CAPS_QUERY_US);
+        caps_queries++;
+        device->bus = HID_BUS_USB;
+    }
+    return device;
+}
+
+static BOOL mock_reenable(LPTSTR path)
+{
+    (void)path;
+    spin_us(REENABLE_US);
+    reenables++;
+    held = held_after_reenable;
+    return TRUE;
+}
+
+static struct hid_backend mock_backend;
+
+/*
+ * As stadia-vigem opens a device (see open_device in main.c).
+ */
+static struct hid_device *open_device(struct device_cache *cache, LPTSTR path)
+{
+    struct hid_caps caps;
+    UINT open_mode = DEVICE_CACHE_OPEN_EXCLUSIVE;
+    BOOL cached = cache != NULL && device_cache_lookup(cache, path, &caps, &open_mode);
+    const struct hid_caps *known_caps = cached ? &caps : NULL;
+    BOOL reenable = open_mode != DEVICE_CACHE_OPEN_SHARED;
+
+    struct hid_device *device = hid_open_device(&mock_backend, path, TRUE, FALSE, known_caps);
+    open_mode = DEVICE_CACHE_OPEN_EXCLUSIVE;
+    if (device == NULL && reenable && mock_reenable(path))
+    {
+        device = hid_open_device(&mock_backend, path, TRUE, FALSE, known_caps);
+        open_mode = DEVICE_CACHE_OPEN_REENABLED;
+    }
+    if (device == NULL)
+    {
+        device = hid_open_device(&mock_backend, path, TRUE, TRUE, known_caps);
+        open_mode = DEVICE_CACHE_OPEN_SHARED;
+    }
+
+    if (device != NULL && cache != NULL)
+    {
+        hid_get_caps(device, &caps);
+        device_cache_store(cache, path, &caps, open_mode);
+    }
+    return device;
+}
+
+static void report_cb(struct stadia_controller *controller, const BYTE *report, size_t length, void *context)
+{
+    (void)controller;
+    (void)report;
+    (void)length;
+    (void)context;
+    SetEvent(first_report);
+}
+
+static void reconnect(struct io_engine *engine, struct device_cache *cache)
+{
+    struct stadia_subscriber subscriber;
+
+    memset(&subscriber, 0, sizeof(subscriber));
+    subscriber.report = report_cb;
+
+    struct hid_device *device = open_device(cache, CAPTURE_PATH);
+    CHECK(device != NULL);
+    if (device == NULL)
+    {
+        return;
+    }
+    hid_replay_set_speed(device, 0);
+    struct stadia_controller *controller = stadia_controller_create(engine, device, &subscriber);
+    CHECK(controller != NULL);
+    if (controller != NULL)
+    {
+        CHECK_EQ(WaitForSingleObject(first_report, WAIT_MS), WAIT_OBJECT_0);
+        stadia_controller_destroy(controller);
+        stadia_controller_release(controller);
+    }
+    hid_close_device(device);
+    hid_free_device(device);
+}
+
+/*
+ * The pad comes back in the same situation every time: another program grabs it first when held.
+ */
+static void run(const char *name, struct io_engine *engine, struct device_cache *cache, BOOL holder,
+                BOOL holder_evictable, long repeat)
+{
+    char label[64];
+
+    held_after_reenable = holder && !holder_evictable;
+    caps_queries = failed_opens = reenables = 0;
+    ULONGLONG start_us = timer_now_us();
+    for (long i = 0; i < repeat; i++)
+    {
+        held = holder;
+        reconnect(engine, cache);
+    }
+    ULONGLONG elapsed_us = timer_now_us() - start_us;
+
+    snprintf(label, sizeof(label), "%s, %s", name, cache != NULL ? "cached" : "uncached");
+    bench_print(label, (ULONGLONG)repeat, elapsed_us);
+    printf("    %ld caps queries, %ld failed opens, %ld re-enables\n", (long)caps_queries, (long)failed_opens,
+           (long)reenables);
+}
+
+int main(int argc, char **argv)
+{
+    long repeat = bench_repeat(argc, argv, 50);
+    BYTE reports[4 * STADIA_INPUT_REPORT_MIN_SIZE];
+    struct hid_caps caps;
+    UINT open_mode;
+
+    mock_backend = hid_replay_backend;
+    mock_backend.name = "mock";
+    mock_backend.open = mock_open;
+    first_report = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    test_report_stream(reports, 4, 0xC0DE);
+    CHECK(test_write_capture(CAPTURE_PATH, reports, 4, STADIA_INPUT_REPORT_MIN_SIZE, 4000));
+    struct io_engine *engine = io_engine_create();
+    CHECK(engine != NULL);
+    if (engine == NULL)
+    {
+        return test_result("bench_reconnect");
+    }
+
+    printf("bench_reconnect: %ld reconnects\n", repeat);
+    remove(CACHE_PATH);
+    struct device_cache *cache = device_cache_load(CACHE_PATH);
+
+    // Free: the cache saves the capability queries.
+    run("free", engine, NULL, FALSE, FALSE, repeat);
+    CHECK_EQ(caps_queries, repeat);
+    reconnect(engine, cache);
+    run("free", engine, cache, FALSE, FALSE, repeat);
+    CHECK_EQ(caps_queries, 0);
+    CHECK(device_cache_lookup(cache, CAPTURE_PATH, &caps, &open_mode));
+    CHECK_EQ(open_mode, DEVICE_CACHE_OPEN_EXCLUSIVE);
+
+    // Held, re-enabling frees it: nothing to skip but the queries, exclusive access is worth the wait.
+    run("evictable holder", engine, NULL, TRUE, TRUE, repeat);
+    held = TRUE;
+    reconnect(engine, cache);
+    run("evictable holder", engine, cache, TRUE, TRUE, repeat);
+    CHECK_EQ(reenables, repeat);
+    CHECK(device_cache_lookup(cache, CAPTURE_PATH, &caps, &open_mode));
+    CHECK_EQ(open_mode, DEVICE_CACHE_OPEN_REENABLED);
+
+    // Held for good: a pad remembered as shared skips the re-enable that never helps.
+    run("stubborn holder", engine, NULL, TRUE, FALSE, repeat);
+    CHECK_EQ(reenables, repeat);
+    held = TRUE;
+    reconnect(engine, cache);
+    run("stubborn holder", engine, cache, TRUE, FALSE, repeat);
+    CHECK_EQ(reenables, 0);
+    CHECK_EQ(caps_queries, 0);
+
+    // And a later run remembers it.
+    device_cache_free(cache);
+    cache = device_cache_load(CACHE_PATH);
+    CHECK(device_cache_lookup(cache, CAPTURE_PATH, &caps, &open_mode));
+    CHECK_EQ(open_mode, DEVICE_CACHE_OPEN_SHARED);
+    CHECK_EQ(caps.bus, HID_BUS_USB);
+    device_cache_free(cache);
+
+    io_engine_destroy(engine);
+    CloseHandle(first_report);
+    remove(CACHE_PATH);
+    remove(CAPTURE_PATH);
+    return test_result("bench_reconnect");
+}
@@ -0,0 +1,35 @@
+/*
+ * bench_report.c -- Throughput of stadia_decode_report over a synthetic play session.
+ */
+
+#include "report.h"
+#include "test.h"
+
+#define REPORT_COUNT 4096
+
+int main(int argc, char **argv)
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    long repeat = bench_repeat(argc, argv, 2000);
+    struct stadia_state state;
+    DWORD checksum = 0;
+
+    test_report_stream(reports, REPORT_COUNT, 0x5EED);
+
+    ULONGLONG start_us = timer_now_us();
+    for (long r = 0; r < repeat; r++)
+    {
+        for (size_t i = 0; i < REPORT_COUNT; i++)
+        {
+            CHECK(stadia_decode_report(&reports[i * STADIA_INPUT_REPORT_MIN_SIZE], STADIA_INPUT_REPORT_MIN_SIZE,
+                                       &state));
+            // Folded in so the decode cannot be optimized away.
+            checksum += state.buttons + state.left_stick_x + state.right_trigger;
+        }
+    }
+    ULONGLONG elapsed_us = timer_now_us() - start_us;
+
+    printf("bench_report: %ld x %d reports (checksum %08lx)\n", repeat, REPORT_COUNT, (unsigned long)checksum);
+    bench_print("stadia_decode_report", (ULONGLONG)repeat * REPORT_COUNT, elapsed_us);
+    return test_result("bench_report");
+}
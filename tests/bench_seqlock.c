@@ -0,0 +1,148 @@
+/*
+ * bench_seqlock.c -- Publishing controller state through the sequence lock against the SRW lock it
+ * replaced, with a writer streaming states while reader threads take snapshots.
+ */
+
+#include <pthread.h>
+
+#include "seqlock.h"
+#include "test.h"
+
+#define WRITES_PER_REPEAT 100000
+#define MAX_READERS 3
+
+static struct stadia_state state;
+static volatile LONG state_sequence;
+static SRWLOCK state_lock = SRWLOCK_INIT;
+
+static BOOL use_seqlock;
+static volatile LONG writer_done;
+static LONGLONG reads[MAX_READERS];
+
+static void write_state(const struct stadia_state *next)
+{
+    if (use_seqlock)
+    {
+        seqlock_write_begin(&state_sequence);
+        state = *next;
+        seqlock_write_end(&state_sequence);
+    }
+    else
+    {
+        AcquireSRWLockExclusive(&state_lock);
+        state = *next;
+        ReleaseSRWLockExclusive(&state_lock);
+    }
+}
+
+static void read_state(struct stadia_state *copy)
+{
+    if (use_seqlock)
+    {
+        LONG sequence;
+        do
+        {
+            sequence = seqlock_read_begin(&state_sequence);
+            *copy = state;
+        } while (seqlock_read_retry(&state_sequence, sequence));
+    }
+    else
+    {
+        AcquireSRWLockShared(&state_lock);
+        *copy = state;
+        ReleaseSRWLockShared(&state_lock);
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    LONGLONG *count = (LONGLONG *)arg;
+    struct stadia_state copy;
+    DWORD checksum = 0;
+
+    while (!InterlockedCompareExchange(&writer_done, 0, 0))
+    {
+        read_state(&copy);
+        checksum += copy.buttons;
+        (*count)++;
+    }
+    return (void *)(size_t)checksum;
+}
+
+static void run(const char *name, BOOL seqlock, INT reader_count, long repeat)
+{
+    pthread_t readers[MAX_READERS];
+    struct stadia_state next = {0};
+    char label[64];
+
+    use_seqlock = seqlock;
+    writer_done = FALSE;
+    for (INT i = 0; i < reader_count; i++)
+    {
+        reads[i] = 0;
+        pthread_create(&readers[i], NULL, reader_thread, &reads[i]);
+    }
+
+    ULONGLONG writes = (ULONGLONG)repeat * WRITES_PER_REPEAT;
+    ULONGLONG start_us = timer_now_us();
+    for (ULONGLONG i = 0; i < writes; i++)
+    {
+        next.buttons = (DWORD)i;
+        next.left_stick_x = (BYTE)i;
+        write_state(&next);
+    }
+    ULONGLONG elapsed_us = timer_now_us() - start_us;
+    InterlockedExchange(&writer_done, TRUE);
+
+    LONGLONG total_reads = 0;
+    for (INT i = 0; i < reader_count; i++)
+    {
+        pthread_join(readers[i], NULL);
+        total_reads += reads[i];
+    }
+
+    snprintf(label, sizeof(label), "%s write, %d readers", name, reader_count);
+    bench_print(label, writes, elapsed_us);
+    if (reader_count > 0)
+    {
+        snprintf(label, sizeof(label), "%s read, %d readers", name, reader_count);
+        bench_print(label, total_reads, elapsed_us);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long repeat = bench_repeat(argc, argv, 10);
+    struct stadia_state copy;
+
+    printf("bench_seqlock: %ld x %d writes\n", repeat, WRITES_PER_REPEAT);
+
+    // Uncontended snapshots, as the tray and the stats dump mostly take them.
+    printf(" uncontended read\n");
+    for (INT seqlock = 0; seqlock <= 1; seqlock++)
+    {
+        use_seqlock = seqlock;
+        ULONGLONG reads_done = (ULONGLONG)repeat * WRITES_PER_REPEAT;
+        DWORD checksum = 0;
+        ULONGLONG start_us = timer_now_us();
+        for (ULONGLONG i = 0; i < reads_done; i++)
+        {
+            read_state(&copy);
+            checksum += copy.buttons;
+        }
+        bench_print(seqlock ? "seqlock" : "srwlock", reads_done, timer_now_us() - start_us);
+        CHECK_EQ(checksum, 0);
+    }
+
+    printf(" streaming\n");
+    for (INT reader_count = 0; reader_count <= MAX_READERS; reader_count++)
+    {
+        run("srwlock", FALSE, reader_count, repeat);
+        run("seqlock", TRUE, reader_count, repeat);
+    }
+
+    // The last state written is what a snapshot sees.
+    read_state(&copy);
+    CHECK_EQ(copy.buttons, (DWORD)(repeat * WRITES_PER_REPEAT - 1));
+    return test_result("bench_seqlock");
+}
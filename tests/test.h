@@ -0,0 +1,214 @@
+/*
+ * test.h -- Checks, timing and synthetic input shared by the tests and benchmarks.
+ *
+ * Tests return non-zero from main when a check failed. Benchmarks take an optional repeat count as
+ * their first argument and only fail on wrong results, never on timings.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capture.h"
+#include "compat.h"
+#include "hid.h"
+#include "io.h"
+#include "report.h"
+#include "stadia.h"
+#include "timer.h"
+
+static int test_failures = 0;
+
+#define CHECK(condition)                                                                   \
+    do                                                                                     \
+    {                                                                                      \
+        if (!(condition))                                                                  \
+        {                                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++;                                                               \
+        }                                                                                  \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                             \
+    do                                                                                         \
+    {                                                                                          \
+        long long _actual = (long long)(actual);                                               \
+        long long _expected = (long long)(expected);                                           \
+        if (_actual != _expected)                                                              \
+        {                                                                                      \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, \
+                    _actual, _expected);                                                       \
+            test_failures++;                                                                   \
+        }                                                                                      \
+    } while (0)
+
+static inline int test_result(const char *name)
+{
+    if (test_failures != 0)
+    {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+/*
+ * Deterministic xorshift generator, so every run sees the same input.
+ */
+static inline DWORD test_random(DWORD *seed)
+{
+    DWORD x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static inline long bench_repeat(int argc, char **argv, long default_repeat)
+{
+    long repeat = argc > 1 ? atol(argv[1]) : 0;
+    return repeat > 0 ? repeat : default_repeat;
+}
+
+static inline void bench_print(const char *name, ULONGLONG operations, ULONGLONG elapsed_us)
+{
+    printf("  %-28s %8.2f ns/op %10.1f Mop/s\n", name, elapsed_us * 1000.0 / operations,
+           elapsed_us != 0 ? (double)operations / elapsed_us : 0.0);
+}
+
+/*
+ * Fills count input reports of STADIA_INPUT_REPORT_MIN_SIZE bytes shaped like a play session: the
+ * sticks wander and rest around the centre, triggers ramp, buttons and the d-pad change now and then.
+ */
+static inline void test_report_stream(BYTE *reports, size_t count, DWORD seed)
+{
+    INT sticks[4] = {128, 128, 128, 128};
+    INT triggers[2] = {0, 0};
+    BYTE hat = 8, byte2 = 0, byte3 = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        BYTE *report = &reports[i * STADIA_INPUT_REPORT_MIN_SIZE];
+        DWORD r = test_random(&seed);
+
+        for (INT axis = 0; axis < 4; axis++)
+        {
+            // Mostly small steps, sometimes back to rest.
+            sticks[axis] += (INT)((r >> (axis * 4)) & 0x7) - 3;
+            if ((r >> 28) == (DWORD)axis)
+            {
+                sticks[axis] = 128;
+            }
+            sticks[axis] = sticks[axis] < 0 ? 0 : sticks[axis] > 255 ? 255 : sticks[axis];
+        }
+        for (INT trigger = 0; trigger < 2; trigger++)
+        {
+            triggers[trigger] += (r >> (16 + trigger)) & 1 ? 9 : -9;
+            triggers[trigger] = triggers[trigger] < 0 ? 0 : triggers[trigger] > 255 ? 255 : triggers[trigger];
+        }
+        if ((r & 0x1F00) == 0)
+        {
+            DWORD b = test_random(&seed);
+            hat = (BYTE)(b % 9);
+            byte2 = (BYTE)(b >> 8) & 0xF0;
+            byte3 = (BYTE)(b >> 16) & 0x7F;
+        }
+
+        report[0] = STADIA_INPUT_REPORT_ID;
+        report[1] = hat;
+        report[2] = byte2;
+        report[3] = byte3;
+        report[4] = (BYTE)sticks[0];
+        report[5] = (BYTE)sticks[1];
+        report[6] = (BYTE)sticks[2];
+        report[7] = (BYTE)sticks[3];
+        report[8] = (BYTE)triggers[0];
+        report[9] = (BYTE)triggers[1];
+    }
+}
+
+/*
+ * Writes count reports of size bytes each to a capture, interval_us apart.
+ */
+static inline BOOL test_write_capture(LPTSTR path, const BYTE *reports, size_t count, size_t size,
+                                      ULONGLONG interval_us)
+{
+    struct capture_writer *writer = capture_writer_open(path, TRUE);
+    BOOL written = writer != NULL;
+
+    for (size_t i = 0; written && i < count; i++)
+    {
+        written = capture_writer_write(writer, i * interval_us, &reports[i * size], size);
+    }
+    if (writer != NULL)
+    {
+        capture_writer_close(writer);
+    }
+    return written;
+}
+
+/*
+ * A controller reading a capture through the replay backend, which stops on its own at the end of
+ * the capture. Start from a zeroed replay with the wanted callbacks set on its subscriber, they get
+ * the replay as their context.
+ */
+struct test_replay
+{
+    struct hid_device *device;
+    struct stadia_controller *controller;
+    struct stadia_subscriber subscriber;
+    HANDLE stopped;
+    void *context;
+};
+
+static inline void _test_replay_destroy_cb(struct stadia_controller *controller, void *context)
+{
+    (void)controller;
+    SetEvent(((struct test_replay *)context)->stopped);
+}
+
+static inline BOOL test_replay_start(struct test_replay *replay, struct io_engine *engine, LPTSTR path, double speed)
+{
+    replay->controller = NULL;
+    replay->stopped = CreateEvent(NULL, TRUE, FALSE, NULL);
+    replay->device = hid_open_device(&hid_replay_backend, path, TRUE, FALSE, NULL);
+    if (replay->device == NULL)
+    {
+        CloseHandle(replay->stopped);
+        return FALSE;
+    }
+    hid_replay_set_speed(replay->device, speed);
+
+    replay->subscriber.destroy = _test_replay_destroy_cb;
+    replay->subscriber.context = replay;
+    replay->controller = stadia_controller_create(engine, replay->device, &replay->subscriber);
+    if (replay->controller == NULL)
+    {
+        hid_close_device(replay->device);
+        hid_free_device(replay->device);
+        CloseHandle(replay->stopped);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Whether the controller reached the end of the capture in time.
+static inline BOOL test_replay_wait(struct test_replay *replay, DWORD timeout_ms)
+{
+    return WaitForSingleObject(replay->stopped, timeout_ms) == WAIT_OBJECT_0;
+}
+
+// Stops the controller if it is still running, and frees it along with the device.
+static inline void test_replay_free(struct test_replay *replay)
+{
+    stadia_controller_destroy(replay->controller);
+    stadia_controller_release(replay->controller);
+    hid_close_device(replay->device);
+    hid_free_device(replay->device);
+    CloseHandle(replay->stopped);
+}
+
+#endif /* TEST_H */
@@ -0,0 +1,68 @@
+/*
+ * test_axis.c -- Axis tables and the four-lane stick conversion against the former per-axis mapping.
+ */
+
+#include "mapping.h"
+#include "test.h"
+
+// As _map_byte_to_short used to map an axis, with the signed char of MSVC.
+static SHORT old_map_byte_to_short(BYTE value, BOOL inverted)
+{
+    signed char centered = (signed char)(value - 128);
+    if (centered < -127)
+    {
+        centered = -127;
+    }
+    if (inverted)
+    {
+        centered = -centered;
+    }
+    return (SHORT)(32767 * centered / 127);
+}
+
+static void test_tables()
+{
+    for (INT value = 0; value < 256; value++)
+    {
+        CHECK_EQ(mapping_axis_map[value], old_map_byte_to_short((BYTE)value, FALSE));
+        CHECK_EQ(mapping_axis_inverted_map[value], old_map_byte_to_short((BYTE)value, TRUE));
+    }
+
+    CHECK_EQ(mapping_axis_map[0], -32767);
+    CHECK_EQ(mapping_axis_map[1], -32767);
+    CHECK_EQ(mapping_axis_map[128], 0);
+    CHECK_EQ(mapping_axis_map[255], 32767);
+    CHECK_EQ(mapping_axis_inverted_map[0], 32767);
+    CHECK_EQ(mapping_axis_inverted_map[255], -32767);
+}
+
+static void test_sticks()
+{
+    // Each lane sees every value, with a different value in every other lane.
+    for (INT value = 0; value < 256; value++)
+    {
+        BYTE sticks[4] = {(BYTE)value, (BYTE)(255 - value), (BYTE)(value + 85), (BYTE)(value + 170)};
+        XUSB_REPORT report;
+
+        mapping_translate_sticks(NULL, sticks, &report);
+        CHECK_EQ(report.sThumbLX, old_map_byte_to_short(sticks[0], FALSE));
+        CHECK_EQ(report.sThumbLY, old_map_byte_to_short(sticks[1], TRUE));
+        CHECK_EQ(report.sThumbRX, old_map_byte_to_short(sticks[2], FALSE));
+        CHECK_EQ(report.sThumbRY, old_map_byte_to_short(sticks[3], TRUE));
+
+        // The same lanes with the polarities swapped.
+        BYTE swapped[4] = {sticks[1], sticks[0], sticks[3], sticks[2]};
+        mapping_translate_sticks(NULL, swapped, &report);
+        CHECK_EQ(report.sThumbLX, old_map_byte_to_short(sticks[1], FALSE));
+        CHECK_EQ(report.sThumbLY, old_map_byte_to_short(sticks[0], TRUE));
+        CHECK_EQ(report.sThumbRX, old_map_byte_to_short(sticks[3], FALSE));
+        CHECK_EQ(report.sThumbRY, old_map_byte_to_short(sticks[2], TRUE));
+    }
+}
+
+int main()
+{
+    test_tables();
+    test_sticks();
+    return test_result("test_axis");
+}
@@ -0,0 +1,239 @@
+/*
+ * test_capture.c -- Capture files written and read back, and replayed through the replay backend.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "hid.h"
+#include "io.h"
+#include "test.h"
+
+#define CAPTURE_FILE TEXT("test_capture.stcap")
+
+#define REPORT_COUNT 512
+#define PACED_COUNT 50
+#define PACED_INTERVAL_US 2000
+
+// Reports of the session stream, with a few of other lengths thrown in.
+static size_t report_length(INT i)
+{
+    return i % 97 == 5 ? 64 : i % 89 == 7 ? 3 : STADIA_INPUT_REPORT_MIN_SIZE;
+}
+
+static void make_report(const BYTE *session, INT i, BYTE *report)
+{
+    size_t length = report_length(i);
+    memset(report, 0, length);
+    memcpy(report, &session[i * STADIA_INPUT_REPORT_MIN_SIZE],
+           length < STADIA_INPUT_REPORT_MIN_SIZE ? length : STADIA_INPUT_REPORT_MIN_SIZE);
+    for (size_t b = STADIA_INPUT_REPORT_MIN_SIZE; b < length; b++)
+    {
+        report[b] = (BYTE)(i + b);
+    }
+}
+
+static long file_size(LPTSTR path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static long test_round_trip(const BYTE *session, BOOL delta)
+{
+    BYTE report[CAPTURE_MAX_REPORT_SIZE], buffer[CAPTURE_MAX_REPORT_SIZE];
+    ULONGLONG timestamp_us;
+
+    struct capture_writer *writer = capture_writer_open(CAPTURE_FILE, delta);
+    CHECK(writer != NULL);
+    if (writer == NULL)
+    {
+        return -1;
+    }
+    for (INT i = 0; i < REPORT_COUNT; i++)
+    {
+        make_report(session, i, report);
+        // Starting well after zero, the reader counts from the first report.
+        CHECK(capture_writer_write(writer, 5000000 + (ULONGLONG)i * 4000 + (i % 3), report, report_length(i)));
+    }
+    // Too long for a record, kept truncated.
+    BYTE oversized[CAPTURE_MAX_REPORT_SIZE + 20];
+    memset(oversized, 0xA5, sizeof(oversized));
+    CHECK(capture_writer_write(writer, 5000000 + (ULONGLONG)REPORT_COUNT * 4000, oversized, sizeof(oversized)));
+    capture_writer_close(writer);
+
+    struct capture_reader *reader = capture_reader_open(CAPTURE_FILE);
+    CHECK(reader != NULL);
+    if (reader == NULL)
+    {
+        return -1;
+    }
+    for (INT i = 0; i < REPORT_COUNT; i++)
+    {
+        make_report(session, i, report);
+        INT length = capture_reader_next(reader, &timestamp_us, buffer, sizeof(buffer));
+        CHECK_EQ(length, report_length(i));
+        CHECK_EQ(timestamp_us, (ULONGLONG)i * 4000 + (i % 3));
+        CHECK(length > 0 && memcmp(buffer, report, length) == 0);
+    }
+    INT length = capture_reader_next(reader, &timestamp_us, buffer, 16);
+    CHECK_EQ(length, CAPTURE_MAX_REPORT_SIZE);
+    CHECK_EQ(buffer[15], 0xA5);
+    CHECK_EQ(capture_reader_next(reader, &timestamp_us, buffer, sizeof(buffer)), -1);
+    CHECK_EQ(capture_reader_next(reader, &timestamp_us, buffer, sizeof(buffer)), -1);
+    capture_reader_close(reader);
+
+    return file_size(CAPTURE_FILE);
+}
+
+static void test_malformed()
+{
+    BYTE buffer[CAPTURE_MAX_REPORT_SIZE];
+    ULONGLONG timestamp_us;
+
+    FILE *file = fopen(CAPTURE_FILE, "wb");
+    fputs("STCX\x01", file);
+    fclose(file);
+    CHECK(capture_reader_open(CAPTURE_FILE) == NULL);
+
+    // Cut off in the middle of a record: everything before it, then the end.
+    struct capture_writer *writer = capture_writer_open(CAPTURE_FILE, FALSE);
+    BYTE report[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8};
+    capture_writer_write(writer, 0, report, sizeof(report));
+    capture_writer_write(writer, 1000, report, sizeof(report));
+    capture_writer_close(writer);
+    long size = file_size(CAPTURE_FILE);
+    CHECK(truncate(CAPTURE_FILE, size - 3) == 0);
+
+    struct capture_reader *reader = capture_reader_open(CAPTURE_FILE);
+    CHECK(reader != NULL);
+    if (reader != NULL)
+    {
+        CHECK_EQ(capture_reader_next(reader, &timestamp_us, buffer, sizeof(buffer)), sizeof(report));
+        CHECK_EQ(capture_reader_next(reader, &timestamp_us, buffer, sizeof(buffer)), -1);
+        capture_reader_close(reader);
+    }
+}
+
+struct replay_run
+{
+    struct hid_device *device;
+    struct io_request request;
+    BYTE buffer[64];
+    ULONGLONG arrival_us[PACED_COUNT];
+    INT count;
+    INT last_result;
+    HANDLE done;
+};
+
+static void replay_read_cb(struct io_request *request, INT result)
+{
+    struct replay_run *run = (struct replay_run *)request->context;
+
+    run->last_result = result;
+    if (result < 0)
+    {
+        SetEvent(run->done);
+        return;
+    }
+    if (run->count < PACED_COUNT)
+    {
+        run->arrival_us[run->count] = timer_now_us();
+    }
+    run->count++;
+    if (!hid_read_input_report(run->device, &run->request))
+    {
+        SetEvent(run->done);
+    }
+}
+
+static ULONGLONG replay(struct io_engine *engine, double speed, struct replay_run *run)
+{
+    memset(run, 0, sizeof(struct replay_run));
+    run->device = hid_open_device(&hid_replay_backend, CAPTURE_FILE, TRUE, FALSE, NULL);
+    CHECK(run->device != NULL);
+    if (run->device == NULL)
+    {
+        return 0;
+    }
+    run->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    run->request.complete = replay_read_cb;
+    run->request.context = run;
+    run->request.buffer = run->buffer;
+    run->request.length = sizeof(run->buffer);
+
+    hid_replay_set_speed(run->device, speed);
+    CHECK(hid_attach_device(run->device, engine));
+    ULONGLONG start_us = timer_now_us();
+    CHECK(hid_read_input_report(run->device, &run->request));
+    CHECK_EQ(WaitForSingleObject(run->done, 5000), WAIT_OBJECT_0);
+    ULONGLONG elapsed_us = timer_now_us() - start_us;
+
+    hid_detach_device(run->device);
+    hid_close_device(run->device);
+    hid_free_device(run->device);
+    CloseHandle(run->done);
+    return elapsed_us;
+}
+
+static void test_replay_pacing()
+{
+    static struct replay_run run;
+    BYTE report[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8};
+
+    struct capture_writer *writer = capture_writer_open(CAPTURE_FILE, TRUE);
+    for (INT i = 0; i < PACED_COUNT; i++)
+    {
+        report[4] = (BYTE)i;
+        capture_writer_write(writer, (ULONGLONG)i * PACED_INTERVAL_US, report, sizeof(report));
+    }
+    capture_writer_close(writer);
+
+    struct io_engine *engine = io_engine_create();
+    CHECK(engine != NULL);
+
+    // As fast as possible: everything, in order, and well ahead of the capture's own 98ms.
+    ULONGLONG elapsed_us = replay(engine, 0, &run);
+    CHECK_EQ(run.count, PACED_COUNT);
+    CHECK_EQ(run.last_result, IO_FAILED);
+    CHECK_EQ(run.buffer[4], PACED_COUNT - 1);
+    CHECK(elapsed_us < (PACED_COUNT - 1) * PACED_INTERVAL_US / 2);
+
+    // At the original speed every report arrives on time, never early and at most a little late.
+    replay(engine, 1, &run);
+    CHECK_EQ(run.count, PACED_COUNT);
+    CHECK_EQ(run.last_result, IO_FAILED);
+    for (INT i = 1; i < PACED_COUNT; i++)
+    {
+        ULONGLONG offset_us = run.arrival_us[i] - run.arrival_us[0];
+        CHECK(offset_us + 200 >= (ULONGLONG)i * PACED_INTERVAL_US);
+        CHECK(offset_us <= (ULONGLONG)i * PACED_INTERVAL_US + 20000);
+    }
+
+    io_engine_destroy(engine);
+}
+
+int main()
+{
+    static BYTE session[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    test_report_stream(session, REPORT_COUNT, 0xCA97);
+
+    long full_size = test_round_trip(session, FALSE);
+    long delta_size = test_round_trip(session, TRUE);
+    // Successive session reports share most of their bytes, so the deltas come out smaller.
+    CHECK(delta_size > 0 && delta_size < full_size);
+
+    test_malformed();
+    test_replay_pacing();
+
+    remove(CAPTURE_FILE);
+    return test_result("test_capture");
+}
@@ -0,0 +1,257 @@
+/*
+ * test_discovery.c -- Debounced discovery passes, driven by a fake enumerator.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "discovery.h"
+#include "test.h"
+
+#define DEBOUNCE_MS 50
+#define MAX_CALLS 64
+#define WAIT_MS 2000
+
+/*
+ * Every handler call in order: 'E'numerate, 'P'rune, 'A'rrived, 'R'emoved, 'D'one.
+ */
+struct call
+{
+    char kind;
+    char path[16];
+    ULONGLONG time_us;
+};
+
+static SRWLOCK calls_lock = SRWLOCK_INIT;
+static struct call calls[MAX_CALLS];
+static INT call_count;
+static HANDLE pass_done;
+
+// What the fake enumerator lists, separated by spaces.
+static const char *present_devices;
+static char pruned_with[64];
+
+static void record(char kind, LPTSTR path)
+{
+    AcquireSRWLockExclusive(&calls_lock);
+    if (call_count < MAX_CALLS)
+    {
+        calls[call_count].kind = kind;
+        snprintf(calls[call_count].path, sizeof(calls[call_count].path), "%s", path != NULL ? path : "");
+        calls[call_count].time_us = timer_now_us();
+        call_count++;
+    }
+    ReleaseSRWLockExclusive(&calls_lock);
+}
+
+static struct hid_device_info *enumerate_cb(void *context)
+{
+    struct hid_device_info *head = NULL, **tail = &head;
+    char names[64];
+    (void)context;
+
+    record('E', NULL);
+    snprintf(names, sizeof(names), "%s", present_devices);
+    for (char *name = strtok(names, " "); name != NULL; name = strtok(NULL, " "))
+    {
+        struct hid_device_info *info = (struct hid_device_info *)malloc(sizeof(struct hid_device_info));
+        info->path = strdup(name);
+        info->description = NULL;
+        info->next = NULL;
+        *tail = info;
+        tail = &info->next;
+    }
+    return head;
+}
+
+static void arrived_cb(LPTSTR path, void *context)
+{
+    (void)context;
+    record('A', path);
+}
+
+static void removed_cb(LPTSTR path, void *context)
+{
+    (void)context;
+    record('R', path);
+}
+
+static void prune_cb(const struct hid_device_info *present, void *context)
+{
+    (void)context;
+    record('P', NULL);
+    pruned_with[0] = 0;
+    for (; present != NULL; present = present->next)
+    {
+        strcat(pruned_with, present->path);
+        strcat(pruned_with, present->next != NULL ? " " : "");
+    }
+}
+
+static void done_cb(void *context)
+{
+    (void)context;
+    record('D', NULL);
+    SetEvent(pass_done);
+}
+
+static const struct discovery_handler handler = {
+    .enumerate = enumerate_cb,
+    .arrived = arrived_cb,
+    .removed = removed_cb,
+    .prune = prune_cb,
+    .done = done_cb,
+};
+
+static void reset_calls()
+{
+    AcquireSRWLockExclusive(&calls_lock);
+    call_count = 0;
+    ReleaseSRWLockExclusive(&calls_lock);
+}
+
+/*
+ * The calls of the pass, without the done marker, as e.g. "R:a A:a A:b".
+ */
+static void describe_calls(char *out, size_t size)
+{
+    size_t used = 0;
+
+    out[0] = 0;
+    AcquireSRWLockShared(&calls_lock);
+    for (INT i = 0; i < call_count; i++)
+    {
+        if (calls[i].kind == 'D')
+        {
+            continue;
+        }
+        used += snprintf(&out[used], size - used, "%s%c%s%s", used > 0 ? " " : "", calls[i].kind,
+                         calls[i].path[0] != 0 ? ":" : "", calls[i].path);
+    }
+    ReleaseSRWLockShared(&calls_lock);
+}
+
+#define CHECK_CALLS(expected)                                                                            \
+    do                                                                                                   \
+    {                                                                                                    \
+        char _calls[256];                                                                                \
+        describe_calls(_calls, sizeof(_calls));                                                          \
+        if (strcmp(_calls, expected) != 0)                                                               \
+        {                                                                                                \
+            fprintf(stderr, "%s:%d: calls were \"%s\", expected \"%s\"\n", __FILE__, __LINE__, _calls,   \
+                    expected);                                                                           \
+            test_failures++;                                                                             \
+        }                                                                                                \
+    } while (0)
+
+static void test_burst(struct discovery *discovery)
+{
+    reset_calls();
+
+    // A dock bringing interfaces up, one of them reported twice.
+    ULONGLONG start_us = timer_now_us();
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("a"));
+    usleep(10000);
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("b"));
+    usleep(10000);
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("A"));
+    usleep(10000);
+    ULONGLONG last_us = timer_now_us();
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("c"));
+
+    CHECK_EQ(WaitForSingleObject(pass_done, WAIT_MS), WAIT_OBJECT_0);
+    CHECK_CALLS("A:a A:b A:c");
+    // Only once the burst has been quiet for the interval.
+    CHECK(calls[0].time_us >= last_us + DEBOUNCE_MS * 1000);
+    CHECK(calls[0].time_us - start_us < 500000);
+
+    // Nothing more happens afterwards.
+    CHECK_EQ(WaitForSingleObject(pass_done, DEBOUNCE_MS * 3), WAIT_TIMEOUT);
+}
+
+static void test_replug(struct discovery *discovery)
+{
+    reset_calls();
+
+    // Unplugged and back within the burst: closed and reopened. Plugged and gone again: only closed.
+    discovery_notify(discovery, DISCOVERY_REMOVED, TEXT("a"));
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("a"));
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("d"));
+    discovery_notify(discovery, DISCOVERY_REMOVED, TEXT("d"));
+    discovery_notify(discovery, DISCOVERY_REMOVED, TEXT("b"));
+
+    CHECK_EQ(WaitForSingleObject(pass_done, WAIT_MS), WAIT_OBJECT_0);
+    CHECK_CALLS("R:a R:d R:b A:a");
+}
+
+static void test_rescan(struct discovery *discovery)
+{
+    reset_calls();
+    present_devices = "a c";
+
+    // Removals still go first, the rescan's listing replaces queued arrivals.
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("e"));
+    discovery_notify(discovery, DISCOVERY_REMOVED, TEXT("b"));
+    discovery_notify(discovery, DISCOVERY_RESCAN, NULL);
+
+    CHECK_EQ(WaitForSingleObject(pass_done, WAIT_MS), WAIT_OBJECT_0);
+    CHECK_CALLS("R:b E P A:a A:c");
+    CHECK(strcmp(pruned_with, "a c") == 0);
+}
+
+static void test_max_debounce(struct discovery *discovery)
+{
+    reset_calls();
+
+    // A stream of notifications closer together than the interval still gets passes.
+    ULONGLONG start_us = timer_now_us();
+    ULONGLONG limit_us = DISCOVERY_MAX_DEBOUNCE_FACTOR * DEBOUNCE_MS * 1000ULL;
+    while (timer_now_us() - start_us < 2 * limit_us)
+    {
+        discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("f"));
+        usleep(DEBOUNCE_MS * 1000 / 5);
+    }
+
+    CHECK_EQ(WaitForSingleObject(pass_done, WAIT_MS), WAIT_OBJECT_0);
+    CHECK(call_count > 0);
+    CHECK(calls[0].kind == 'A' && calls[0].time_us >= start_us + limit_us);
+    CHECK(calls[0].time_us < start_us + limit_us + 100000);
+    usleep(DEBOUNCE_MS * 3 * 1000);
+}
+
+static void test_destroy()
+{
+    reset_calls();
+    struct discovery *discovery = discovery_create(&handler, DEBOUNCE_MS);
+    CHECK(discovery != NULL);
+
+    // Queued events are dropped, not handled on the way out.
+    discovery_notify(discovery, DISCOVERY_ARRIVED, TEXT("g"));
+    discovery_notify(discovery, DISCOVERY_RESCAN, NULL);
+    discovery_destroy(discovery);
+    CHECK_EQ(call_count, 0);
+}
+
+int main()
+{
+    pass_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    present_devices = "";
+
+    struct discovery *discovery = discovery_create(&handler, DEBOUNCE_MS);
+    CHECK(discovery != NULL);
+    if (discovery == NULL)
+    {
+        return test_result("test_discovery");
+    }
+
+    test_burst(discovery);
+    test_replug(discovery);
+    test_rescan(discovery);
+    test_max_debounce(discovery);
+    discovery_destroy(discovery);
+
+    test_destroy();
+
+    CloseHandle(pass_done);
+    return test_result("test_discovery");
+}
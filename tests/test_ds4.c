@@ -0,0 +1,280 @@
+/*
+ * test_ds4.c -- The fused Stadia to DS4 translation against a reference going through the decoded
+ * state and the XUSB path, field by field.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapping.h"
+#include "report.h"
+#include "test.h"
+
+#define SESSION_COUNT 4096
+
+static BYTE reference_axis(SHORT value)
+{
+    INT axis = (value + 32768) >> 8;
+    return (BYTE)(axis > 255 ? 255 : axis);
+}
+
+static BYTE reference_axis_inverted(SHORT value)
+{
+    INT axis = (32768 - value) >> 8;
+    return (BYTE)(axis > 255 ? 255 : axis);
+}
+
+static DS4_DPAD_DIRECTIONS reference_dpad(DWORD buttons)
+{
+    switch (buttons & (STADIA_BUTTON_UP | STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT | STADIA_BUTTON_RIGHT))
+    {
+    case STADIA_BUTTON_UP:
+        return DS4_BUTTON_DPAD_NORTH;
+    case STADIA_BUTTON_UP | STADIA_BUTTON_RIGHT:
+        return DS4_BUTTON_DPAD_NORTHEAST;
+    case STADIA_BUTTON_RIGHT:
+        return DS4_BUTTON_DPAD_EAST;
+    case STADIA_BUTTON_RIGHT | STADIA_BUTTON_DOWN:
+        return DS4_BUTTON_DPAD_SOUTHEAST;
+    case STADIA_BUTTON_DOWN:
+        return DS4_BUTTON_DPAD_SOUTH;
+    case STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT:
+        return DS4_BUTTON_DPAD_SOUTHWEST;
+    case STADIA_BUTTON_LEFT:
+        return DS4_BUTTON_DPAD_WEST;
+    case STADIA_BUTTON_LEFT | STADIA_BUTTON_UP:
+        return DS4_BUTTON_DPAD_NORTHWEST;
+    default:
+        return DS4_BUTTON_DPAD_NONE;
+    }
+}
+
+/*
+ * What the DS4 target should show: the decoded state for the buttons, and with a non-linear
+ * profile the XUSB target's values brought back to bytes. Linear axes are passed through.
+ */
+static BOOL reference_translate_ds4(const struct mapping_profile *profile, const BYTE *buf, size_t len,
+                                    DS4_REPORT_EX *out)
+{
+    static const struct
+    {
+        DWORD stadia;
+        USHORT ds4;
+    } buttons[] = {
+        {STADIA_BUTTON_A, DS4_BUTTON_CROSS},
+        {STADIA_BUTTON_B, DS4_BUTTON_CIRCLE},
+        {STADIA_BUTTON_X, DS4_BUTTON_SQUARE},
+        {STADIA_BUTTON_Y, DS4_BUTTON_TRIANGLE},
+        {STADIA_BUTTON_LB, DS4_BUTTON_SHOULDER_LEFT},
+        {STADIA_BUTTON_RB, DS4_BUTTON_SHOULDER_RIGHT},
+        {STADIA_BUTTON_LS, DS4_BUTTON_THUMB_LEFT},
+        {STADIA_BUTTON_RS, DS4_BUTTON_THUMB_RIGHT},
+        {STADIA_BUTTON_OPTIONS, DS4_BUTTON_SHARE},
+        {STADIA_BUTTON_MENU, DS4_BUTTON_OPTIONS},
+    };
+    struct stadia_state state;
+    XUSB_REPORT xusb;
+    DS4_REPORT report;
+
+    if (!stadia_decode_report(buf, len, &state) || !mapping_translate_xusb(profile, buf, len, &xusb))
+    {
+        return FALSE;
+    }
+
+    DS4_REPORT_INIT(&report);
+    if (profile == NULL || profile->linear)
+    {
+        report.bThumbLX = state.left_stick_x;
+        report.bThumbLY = state.left_stick_y;
+        report.bThumbRX = state.right_stick_x;
+        report.bThumbRY = state.right_stick_y;
+    }
+    else
+    {
+        report.bThumbLX = reference_axis(xusb.sThumbLX);
+        report.bThumbLY = reference_axis_inverted(xusb.sThumbLY);
+        report.bThumbRX = reference_axis(xusb.sThumbRX);
+        report.bThumbRY = reference_axis_inverted(xusb.sThumbRY);
+    }
+    report.bTriggerL = xusb.bLeftTrigger;
+    report.bTriggerR = xusb.bRightTrigger;
+
+    DS4_SET_DPAD(&report, reference_dpad(state.buttons));
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++)
+    {
+        report.wButtons |= (state.buttons & buttons[i].stadia) != 0 ? buttons[i].ds4 : 0;
+    }
+    report.wButtons |= report.bTriggerL != 0 ? DS4_BUTTON_TRIGGER_LEFT : 0;
+    report.wButtons |= report.bTriggerR != 0 ? DS4_BUTTON_TRIGGER_RIGHT : 0;
+    report.bSpecial = (state.buttons & STADIA_BUTTON_STADIA_BTN) != 0 ? DS4_SPECIAL_BUTTON_PS : 0;
+
+    // DS4_REPORT is not packed, only the fields up to the triggers line up with DS4_REPORT_EX.
+    memcpy(out->ReportBuffer, &report, offsetof(DS4_REPORT, bTriggerR) + 1);
+    return TRUE;
+}
+
+/*
+ * Both start from the same filled report, so a field either side leaves alone must stay alone on
+ * the other as well.
+ */
+static void check_equivalent(const struct mapping_profile *profile, const BYTE *buf, size_t len)
+{
+    DS4_REPORT_EX fused, reference;
+
+    memset(&fused, 0xA5, sizeof(fused));
+    memset(&reference, 0xA5, sizeof(reference));
+    BOOL fused_ok = mapping_translate_ds4(profile, buf, len, &fused);
+    BOOL reference_ok = reference_translate_ds4(profile, buf, len, &reference);
+
+    CHECK_EQ(fused_ok, reference_ok);
+    if (memcmp(&fused, &reference, sizeof(fused)) != 0)
+    {
+        fprintf(stderr, "  report %02x %02x %02x %02x | %02x %02x %02x %02x | %02x %02x\n", buf[0], buf[1], buf[2],
+                buf[3], buf[4], buf[5], buf[6], buf[7], buf[8], buf[9]);
+        CHECK(memcmp(&fused, &reference, sizeof(fused)) == 0);
+    }
+}
+
+static struct mapping_profile *curved_profile(UINT deadzone_type)
+{
+    struct profile_settings settings;
+
+    profile_settings_init(&settings);
+    settings.left_stick.deadzone_type = deadzone_type;
+    settings.left_stick.deadzone = 0.12f;
+    settings.left_stick.outer_deadzone = 0.9f;
+    settings.left_stick.curve.type = PROFILE_CURVE_EXPONENTIAL;
+    settings.left_stick.curve.exponent = 1.8f;
+    settings.right_stick.deadzone_type = deadzone_type;
+    settings.right_stick.deadzone = 0.05f;
+    settings.right_stick.anti_deadzone = 0.1f;
+    settings.right_stick.curve.type = PROFILE_CURVE_CUSTOM;
+    settings.right_stick.curve.point_count = 2;
+    settings.right_stick.curve.points_x[0] = 0.3f;
+    settings.right_stick.curve.points_y[0] = 0.1f;
+    settings.right_stick.curve.points_x[1] = 0.7f;
+    settings.right_stick.curve.points_y[1] = 0.6f;
+    settings.left_trigger.deadzone = 0.1f;
+    settings.right_trigger.curve.type = PROFILE_CURVE_EXPONENTIAL;
+    settings.right_trigger.curve.exponent = 2.0f;
+
+    struct mapping_profile *profile = mapping_profile_create(&settings);
+    CHECK(profile != NULL && !profile->linear);
+    return profile;
+}
+
+static void test_rejects_bad_reports()
+{
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 1, 0xFF, 0xFF, 1, 2, 3, 4, 5, 6};
+
+    for (size_t len = 0; len < STADIA_INPUT_REPORT_MIN_SIZE; len++)
+    {
+        check_equivalent(NULL, buf, len);
+    }
+    buf[0] = 0x01;
+    check_equivalent(NULL, buf, sizeof(buf));
+}
+
+static void test_every_button_byte(const struct mapping_profile *profile)
+{
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8, 0, 0, 0x80, 0x80, 0x80, 0x80, 0, 0};
+
+    for (INT byte = 1; byte <= 3; byte++)
+    {
+        for (INT value = 0; value < 256; value++)
+        {
+            buf[byte] = (BYTE)value;
+            check_equivalent(profile, buf, sizeof(buf));
+        }
+        buf[byte] = byte == 1 ? 8 : 0;
+    }
+}
+
+static void test_every_axis_value(const struct mapping_profile *profile)
+{
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8, 0, 0};
+
+    for (INT value = 0; value < 256; value++)
+    {
+        // Each axis on its own and all of them together, the other way round on the Y axes.
+        for (INT axis = 4; axis <= 10; axis++)
+        {
+            memset(&buf[4], 0x80, 4);
+            memset(&buf[8], 0, 2);
+            if (axis < 10)
+            {
+                buf[axis] = (BYTE)value;
+            }
+            else
+            {
+                buf[4] = buf[6] = buf[8] = buf[9] = (BYTE)value;
+                buf[5] = buf[7] = (BYTE)(255 - value);
+            }
+            check_equivalent(profile, buf, sizeof(buf));
+        }
+    }
+}
+
+static void test_session(const struct mapping_profile *profile, const BYTE *reports)
+{
+    for (INT i = 0; i < SESSION_COUNT; i++)
+    {
+        check_equivalent(profile, &reports[i * STADIA_INPUT_REPORT_MIN_SIZE], STADIA_INPUT_REPORT_MIN_SIZE);
+    }
+}
+
+/*
+ * With the default mapping the DS4 passes the bytes through while XUSB scales them, so both targets
+ * only agree to within the rounding of that scaling.
+ */
+static void test_matches_xusb(const BYTE *reports)
+{
+    DS4_REPORT_EX ds4;
+    XUSB_REPORT xusb;
+
+    mapping_ds4_report_init(&ds4);
+    for (INT i = 0; i < SESSION_COUNT; i++)
+    {
+        const BYTE *buf = &reports[i * STADIA_INPUT_REPORT_MIN_SIZE];
+        CHECK(mapping_translate_ds4(NULL, buf, STADIA_INPUT_REPORT_MIN_SIZE, &ds4));
+        CHECK(mapping_translate_xusb(NULL, buf, STADIA_INPUT_REPORT_MIN_SIZE, &xusb));
+
+        CHECK(abs(ds4.Report.bThumbLX - reference_axis(xusb.sThumbLX)) <= 1);
+        CHECK(abs(ds4.Report.bThumbLY - reference_axis_inverted(xusb.sThumbLY)) <= 1);
+        CHECK(abs(ds4.Report.bThumbRX - reference_axis(xusb.sThumbRX)) <= 1);
+        CHECK(abs(ds4.Report.bThumbRY - reference_axis_inverted(xusb.sThumbRY)) <= 1);
+        CHECK_EQ(ds4.Report.bTriggerL, xusb.bLeftTrigger);
+        CHECK_EQ(ds4.Report.bTriggerR, xusb.bRightTrigger);
+    }
+}
+
+int main()
+{
+    static BYTE reports[SESSION_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    struct profile_settings settings;
+
+    test_report_stream(reports, SESSION_COUNT, 0xD54);
+    profile_settings_init(&settings);
+    struct mapping_profile *profiles[] = {
+        NULL,
+        mapping_profile_create(&settings),
+        curved_profile(PROFILE_DEADZONE_AXIAL),
+        curved_profile(PROFILE_DEADZONE_RADIAL),
+    };
+
+    test_rejects_bad_reports();
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    {
+        test_every_button_byte(profiles[i]);
+        test_every_axis_value(profiles[i]);
+        test_session(profiles[i], reports);
+    }
+    test_matches_xusb(reports);
+
+    for (size_t i = 1; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    {
+        mapping_profile_free(profiles[i]);
+    }
+    return test_result("test_ds4");
+}
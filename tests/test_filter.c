@@ -0,0 +1,179 @@
+/*
+ * test_filter.c -- Which translated reports the target filter holds back, and its keep-alive.
+ */
+
+#include <string.h>
+
+#include "mapping.h"
+#include "test.h"
+
+#define KEEP_ALIVE_US 100000
+#define REPORT_INTERVAL_US 4000
+#define SESSION_COUNT 4096
+
+static void test_drop()
+{
+    struct mapping_filter filter;
+    XUSB_REPORT report;
+
+    mapping_filter_init(&filter, KEEP_ALIVE_US);
+    XUSB_REPORT_INIT(&report);
+
+    // The first report goes through even when it is all at rest, the target starts out unknown.
+    CHECK(mapping_filter_check(&filter, &report, 1000));
+    CHECK(!mapping_filter_check(&filter, &report, 2000));
+    CHECK(!mapping_filter_check(&filter, &report, 3000));
+    CHECK_EQ(filter.submitted, 1);
+    CHECK_EQ(filter.suppressed, 2);
+
+    // Any one field changing is enough.
+    for (INT field = 0; field < 7; field++)
+    {
+        XUSB_REPORT changed = report;
+        switch (field)
+        {
+        case 0:
+            changed.wButtons ^= XUSB_GAMEPAD_A;
+            break;
+        case 1:
+            changed.bLeftTrigger++;
+            break;
+        case 2:
+            changed.bRightTrigger++;
+            break;
+        case 3:
+            changed.sThumbLX++;
+            break;
+        case 4:
+            changed.sThumbLY--;
+            break;
+        case 5:
+            changed.sThumbRX--;
+            break;
+        default:
+            changed.sThumbRY++;
+            break;
+        }
+        CHECK(mapping_filter_check(&filter, &changed, 4000 + field));
+        CHECK(!mapping_filter_check(&filter, &changed, 4000 + field));
+        CHECK(mapping_filter_check(&filter, &report, 4000 + field));
+    }
+    CHECK_EQ(filter.submitted, 1 + 7 * 2);
+    CHECK_EQ(filter.suppressed, 2 + 7);
+}
+
+static void test_keep_alive()
+{
+    struct mapping_filter filter;
+    XUSB_REPORT report;
+
+    mapping_filter_init(&filter, KEEP_ALIVE_US);
+    XUSB_REPORT_INIT(&report);
+
+    // Counted from the last submission, changed or not.
+    CHECK(mapping_filter_check(&filter, &report, 0));
+    CHECK(!mapping_filter_check(&filter, &report, KEEP_ALIVE_US - 1));
+    CHECK(mapping_filter_check(&filter, &report, KEEP_ALIVE_US));
+    report.sThumbLX = 1000;
+    CHECK(mapping_filter_check(&filter, &report, KEEP_ALIVE_US + 50000));
+    CHECK(!mapping_filter_check(&filter, &report, 2 * KEEP_ALIVE_US));
+    CHECK(!mapping_filter_check(&filter, &report, 2 * KEEP_ALIVE_US + 50000 - 1));
+    CHECK(mapping_filter_check(&filter, &report, 2 * KEEP_ALIVE_US + 50000));
+
+    // A pad at rest: one report per keep-alive interval.
+    mapping_filter_init(&filter, KEEP_ALIVE_US);
+    for (ULONGLONG now_us = 0; now_us < 1000 * REPORT_INTERVAL_US; now_us += REPORT_INTERVAL_US)
+    {
+        mapping_filter_check(&filter, &report, now_us);
+    }
+    CHECK_EQ(filter.submitted, 1000 * REPORT_INTERVAL_US / KEEP_ALIVE_US);
+    CHECK_EQ(filter.submitted + filter.suppressed, 1000);
+
+    // Without a keep-alive an unchanged report never goes through again.
+    mapping_filter_init(&filter, 0);
+    CHECK(mapping_filter_check(&filter, &report, 0));
+    CHECK(!mapping_filter_check(&filter, &report, 60000000));
+    CHECK(!mapping_filter_check(&filter, &report, 0xFFFFFFFFFFFFULL));
+}
+
+static void test_ds4()
+{
+    struct mapping_filter filter;
+    DS4_REPORT_EX report;
+
+    mapping_filter_init(&filter, KEEP_ALIVE_US);
+    mapping_ds4_report_init(&report);
+
+    CHECK(mapping_filter_check_ds4(&filter, &report, 0));
+    CHECK(!mapping_filter_check_ds4(&filter, &report, 1000));
+
+    // Every byte counts, including the timestamp and touch data an XUSB report does not have.
+    for (size_t i = 0; i < sizeof(report.ReportBuffer); i++)
+    {
+        report.ReportBuffer[i] ^= 0x01;
+        CHECK(mapping_filter_check_ds4(&filter, &report, 2000));
+        CHECK(!mapping_filter_check_ds4(&filter, &report, 2000));
+    }
+    CHECK(mapping_filter_check_ds4(&filter, &report, 2000 + KEEP_ALIVE_US));
+}
+
+/*
+ * Over a play session, what the target last got always matches the latest report, and it never
+ * goes longer than the keep-alive without an update.
+ */
+static void test_session()
+{
+    static BYTE reports[SESSION_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    struct mapping_filter filter;
+    XUSB_REPORT report, target;
+    ULONGLONG last_submit_us = 0;
+    LONG changes = 0;
+
+    test_report_stream(reports, SESSION_COUNT, 0xF117);
+    // The synthetic session keeps moving, so the pad is put down for a while every 2 seconds.
+    for (INT i = 0; i < SESSION_COUNT; i++)
+    {
+        if (i % 512 >= 256 && i % 512 < 448)
+        {
+            memcpy(&reports[i * STADIA_INPUT_REPORT_MIN_SIZE], &reports[(i - 1) * STADIA_INPUT_REPORT_MIN_SIZE],
+                   STADIA_INPUT_REPORT_MIN_SIZE);
+        }
+    }
+    mapping_filter_init(&filter, KEEP_ALIVE_US);
+    XUSB_REPORT_INIT(&target);
+
+    for (INT i = 0; i < SESSION_COUNT; i++)
+    {
+        ULONGLONG now_us = (ULONGLONG)i * REPORT_INTERVAL_US;
+        CHECK(mapping_translate_xusb(NULL, &reports[i * STADIA_INPUT_REPORT_MIN_SIZE], STADIA_INPUT_REPORT_MIN_SIZE,
+                                     &report));
+        BOOL changed = i == 0 || memcmp(&report, &target, sizeof(report)) != 0;
+        changes += changed;
+
+        if (mapping_filter_check(&filter, &report, now_us))
+        {
+            target = report;
+            last_submit_us = now_us;
+        }
+        else
+        {
+            CHECK(!changed);
+        }
+        CHECK(memcmp(&report, &target, sizeof(report)) == 0);
+        CHECK(now_us - last_submit_us < KEEP_ALIVE_US);
+    }
+
+    // Changed reports all went through, the rests only as keep-alives.
+    CHECK(filter.submitted >= changes);
+    CHECK_EQ(filter.submitted - changes, (SESSION_COUNT / 512) * (192 * REPORT_INTERVAL_US / KEEP_ALIVE_US));
+    CHECK_EQ(filter.submitted + filter.suppressed, SESSION_COUNT);
+}
+
+int main()
+{
+    test_drop();
+    test_keep_alive();
+    test_ds4();
+    test_session();
+    return test_result("test_filter");
+}
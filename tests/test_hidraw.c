@@ -0,0 +1,149 @@
+/*
+ * test_hidraw.c -- The hidraw backend over a FIFO standing in for the device node: reads, and
+ * output and feature reports completing from the worker rather than blocking the caller.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define FIFO_PATH TEXT("test_hidraw.fifo")
+
+#define REPORT_SIZE 64
+#define FEATURE_COUNT 3
+
+struct completion
+{
+    struct io_request request;
+    BYTE buffer[REPORT_SIZE];
+    INT result;
+    BOOL on_engine;
+    INT order;
+    HANDLE done;
+};
+
+static struct io_engine *engine;
+static volatile LONG completed;
+
+static void completion_cb(struct io_request *request, INT result)
+{
+    struct completion *completion = (struct completion *)request->context;
+
+    completion->result = result;
+    completion->on_engine = io_engine_is_current(engine);
+    completion->order = InterlockedIncrement(&completed);
+    SetEvent(completion->done);
+}
+
+static void completion_init(struct completion *completion)
+{
+    memset(completion, 0, sizeof(struct completion));
+    completion->request.complete = completion_cb;
+    completion->request.context = completion;
+    completion->request.buffer = completion->buffer;
+    completion->request.length = sizeof(completion->buffer);
+    completion->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/*
+ * An output report against a FIFO nobody empties, as a pad that does not take the transfer: the
+ * engine keeps running until there is room and the write completes.
+ */
+static void test_output_blocked(struct hid_device *device, int writer)
+{
+    struct completion output, posted;
+    BYTE fill[REPORT_SIZE];
+
+    memset(fill, 0, sizeof(fill));
+    while (write(writer, fill, sizeof(fill)) > 0)
+    {
+    }
+    CHECK_EQ(errno, EAGAIN);
+
+    completion_init(&output);
+    output.buffer[0] = 0x05;
+    CHECK(hid_write_output_report(device, &output.request));
+
+    completion_init(&posted);
+    io_post(engine, &posted.request, 0);
+    CHECK_EQ(WaitForSingleObject(posted.done, 2000), WAIT_OBJECT_0);
+    CHECK(posted.on_engine);
+    CHECK_EQ(WaitForSingleObject(output.done, 100), WAIT_TIMEOUT);
+
+    int reader = open(FIFO_PATH, O_RDONLY | O_NONBLOCK);
+    CHECK(reader >= 0);
+    while (read(reader, fill, sizeof(fill)) > 0)
+    {
+    }
+
+    CHECK_EQ(WaitForSingleObject(output.done, 2000), WAIT_OBJECT_0);
+    CHECK_EQ(output.result, REPORT_SIZE);
+    CHECK(output.on_engine);
+
+    close(reader);
+    CloseHandle(output.done);
+    CloseHandle(posted.done);
+}
+
+int main()
+{
+    static struct completion features[FEATURE_COUNT];
+    struct completion read;
+    struct hid_caps caps = {HID_BUS_BLUETOOTH, REPORT_SIZE, REPORT_SIZE, REPORT_SIZE};
+
+    remove(FIFO_PATH);
+    CHECK(mkfifo(FIFO_PATH, 0600) == 0);
+
+    // Known caps skip the hidraw info query a FIFO cannot answer.
+    engine = io_engine_create();
+    struct hid_device *device = hid_open_device(&hid_hidraw_backend, FIFO_PATH, TRUE, FALSE, &caps);
+    CHECK(engine != NULL && device != NULL);
+    if (engine == NULL || device == NULL)
+    {
+        return test_result("test_hidraw");
+    }
+    CHECK(hid_attach_device(device, engine));
+    int writer = open(FIFO_PATH, O_WRONLY | O_NONBLOCK);
+    CHECK(writer >= 0);
+
+    completion_init(&read);
+    CHECK(hid_read_input_report(device, &read.request));
+    CHECK_EQ(write(writer, "\x03\x08\x00", 3), 3);
+    CHECK_EQ(WaitForSingleObject(read.done, 2000), WAIT_OBJECT_0);
+    CHECK_EQ(read.result, 3);
+    CHECK(read.on_engine);
+
+    // Queued, then completed in order on the engine thread. A FIFO takes no feature reports, so they
+    // fail, but only through their completions.
+    completed = 0;
+    for (INT i = 0; i < FEATURE_COUNT; i++)
+    {
+        completion_init(&features[i]);
+        features[i].buffer[0] = 0x05;
+        CHECK(hid_write_feature_report(device, &features[i].request));
+    }
+    for (INT i = 0; i < FEATURE_COUNT; i++)
+    {
+        CHECK_EQ(WaitForSingleObject(features[i].done, 2000), WAIT_OBJECT_0);
+        CHECK_EQ(features[i].result, IO_FAILED);
+        CHECK_EQ(features[i].order, i + 1);
+        CHECK(features[i].on_engine);
+        CloseHandle(features[i].done);
+    }
+
+    test_output_blocked(device, writer);
+
+    // The worker is joined on close.
+    close(writer);
+    hid_detach_device(device);
+    hid_close_device(device);
+    hid_free_device(device);
+    io_engine_destroy(engine);
+    CloseHandle(read.done);
+    remove(FIFO_PATH);
+
+    return test_result("test_hidraw");
+}
@@ -0,0 +1,174 @@
+/*
+ * test_io.c -- Reads, hang-ups and shutdown of the epoll engine, with a pipe standing in for a device.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "test.h"
+
+#define WAIT_MS 2000
+
+struct test_request
+{
+    struct io_request request;
+    BYTE buffer[16];
+    INT result;
+    HANDLE done;
+};
+
+static void test_request_cb(struct io_request *request, INT result)
+{
+    struct test_request *test_request = (struct test_request *)request->context;
+    test_request->result = result;
+    SetEvent(test_request->done);
+}
+
+static void test_request_init(struct test_request *test_request)
+{
+    memset(test_request, 0, sizeof(struct test_request));
+    test_request->request.complete = test_request_cb;
+    test_request->request.context = test_request;
+    test_request->request.buffer = test_request->buffer;
+    test_request->request.length = sizeof(test_request->buffer);
+    test_request->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+static INT test_read(struct io_handle *handle, struct test_request *test_request)
+{
+    test_request->result = 0;
+    CHECK(io_read(handle, &test_request->request));
+    if (WaitForSingleObject(test_request->done, WAIT_MS) != WAIT_OBJECT_0)
+    {
+        io_cancel(handle, &test_request->request);
+        WaitForSingleObject(test_request->done, INFINITE);
+        return IO_CANCELLED;
+    }
+    return test_request->result;
+}
+
+static void detach_cb(struct io_request *request, INT result)
+{
+    struct io_handle *handle = (struct io_handle *)request->buffer;
+    (void)result;
+
+    io_engine_detach(handle);
+    SetEvent(((struct test_request *)request->context)->done);
+}
+
+// Detaching is only allowed from the engine thread.
+static void detach(struct io_engine *engine, struct io_handle *handle)
+{
+    struct test_request detach_request;
+    test_request_init(&detach_request);
+    detach_request.request.complete = detach_cb;
+    detach_request.request.buffer = (BYTE *)handle;
+
+    io_post(engine, &detach_request.request, 0);
+    WaitForSingleObject(detach_request.done, INFINITE);
+    CloseHandle(detach_request.done);
+}
+
+static void test_pipe(struct io_engine *engine)
+{
+    struct io_handle handle;
+    struct test_request read_request;
+    int fds[2];
+
+    CHECK(pipe(fds) == 0);
+    CHECK(io_engine_attach(engine, &handle, fds[0]));
+    test_request_init(&read_request);
+
+    CHECK_EQ(write(fds[1], "abc", 3), 3);
+    CHECK_EQ(test_read(&handle, &read_request), 3);
+    CHECK(memcmp(read_request.buffer, "abc", 3) == 0);
+
+    // A read pending when the other end goes away fails.
+    read_request.result = 0;
+    CHECK(io_read(&handle, &read_request.request));
+    close(fds[1]);
+    CHECK_EQ(WaitForSingleObject(read_request.done, WAIT_MS), WAIT_OBJECT_0);
+    CHECK_EQ(read_request.result, IO_FAILED);
+
+    // And so does every read after it.
+    CHECK_EQ(test_read(&handle, &read_request), IO_FAILED);
+
+    detach(engine, &handle);
+    close(fds[0]);
+    CloseHandle(read_request.done);
+}
+
+static void test_idle_hang_up(struct io_engine *engine)
+{
+    struct io_handle handle;
+    struct test_request read_request;
+    int fds[2];
+
+    CHECK(pipe(fds) == 0);
+    CHECK(io_engine_attach(engine, &handle, fds[0]));
+    test_request_init(&read_request);
+
+    // Hung up with data left over and nobody reading.
+    CHECK_EQ(write(fds[1], "xy", 2), 2);
+    close(fds[1]);
+
+    // The engine would spin on the hang-up for as long as it stayed watched.
+    clock_t start = clock();
+    usleep(200 * 1000);
+    double cpu_ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    CHECK(cpu_ms < 50.0);
+
+    CHECK(handle.hung_up);
+    CHECK_EQ(test_read(&handle, &read_request), 2);
+    CHECK(memcmp(read_request.buffer, "xy", 2) == 0);
+    CHECK_EQ(test_read(&handle, &read_request), IO_FAILED);
+
+    detach(engine, &handle);
+    close(fds[0]);
+    CloseHandle(read_request.done);
+}
+
+static LONG posted_count;
+
+static void posted_cb(struct io_request *request, INT result)
+{
+    (void)request;
+    (void)result;
+    InterlockedIncrement(&posted_count);
+}
+
+static void test_destroy()
+{
+    struct io_engine *engine = io_engine_create();
+    struct io_request posted[3];
+
+    CHECK(engine != NULL);
+    memset(posted, 0, sizeof(posted));
+    for (INT i = 0; i < 3; i++)
+    {
+        posted[i].complete = posted_cb;
+        io_post(engine, &posted[i], 0);
+    }
+
+    // Completions posted before the quit request still run.
+    io_engine_destroy(engine);
+    CHECK_EQ(posted_count, 3);
+}
+
+int main()
+{
+    struct io_engine *engine = io_engine_create();
+    CHECK(engine != NULL);
+    if (engine == NULL)
+    {
+        return test_result("test_io");
+    }
+
+    test_pipe(engine);
+    test_idle_hang_up(engine);
+    io_engine_destroy(engine);
+
+    test_destroy();
+    return test_result("test_io");
+}
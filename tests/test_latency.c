@@ -0,0 +1,125 @@
+/*
+ * test_latency.c -- Histogram buckets and the percentiles summarized from them.
+ */
+
+#include "latency.h"
+#include "test.h"
+
+#define LATENCY_LAST_UPPER_US 131071
+
+static struct latency_histogram histogram;
+
+/*
+ * The upper bound of the bucket a sample lands in, read back as the median of the sample and one
+ * far slower one.
+ */
+static LONG bucket_upper(ULONGLONG elapsed_us)
+{
+    struct latency_summary summary;
+
+    latency_histogram_reset(&histogram);
+    latency_histogram_record(&histogram, elapsed_us);
+    latency_histogram_record(&histogram, 1000000);
+    latency_histogram_summarize(&histogram, &summary);
+    return summary.p50_us;
+}
+
+static void test_buckets()
+{
+    // Exact below 8 us.
+    for (ULONGLONG us = 0; us < 8; us++)
+    {
+        CHECK_EQ(bucket_upper(us), us);
+    }
+
+    // Then four per power of two.
+    CHECK_EQ(bucket_upper(8), 9);
+    CHECK_EQ(bucket_upper(9), 9);
+    CHECK_EQ(bucket_upper(10), 11);
+    CHECK_EQ(bucket_upper(15), 15);
+    CHECK_EQ(bucket_upper(16), 19);
+    CHECK_EQ(bucket_upper(20), 23);
+    CHECK_EQ(bucket_upper(1023), 1023);
+    CHECK_EQ(bucket_upper(1024), 1279);
+    CHECK_EQ(bucket_upper(LATENCY_LAST_UPPER_US), LATENCY_LAST_UPPER_US);
+
+    // Every sample is within its bucket and overstated by at most a quarter. A bucket ends right
+    // before the next one starts.
+    LONG previous = -1;
+    for (ULONGLONG us = 0; us <= LATENCY_LAST_UPPER_US; us++)
+    {
+        LONG upper = bucket_upper(us);
+        CHECK(upper >= (LONG)us && upper <= (LONG)(us + us / 4));
+        if (upper != previous)
+        {
+            CHECK_EQ(previous, (LONG)us - 1);
+            previous = upper;
+        }
+    }
+
+    // Everything slower shares the last bucket.
+    CHECK_EQ(bucket_upper(LATENCY_LAST_UPPER_US + 1), LATENCY_LAST_UPPER_US);
+    CHECK_EQ(bucket_upper(500000), LATENCY_LAST_UPPER_US);
+    CHECK_EQ(bucket_upper(0xFFFFFFFFFFULL), LATENCY_LAST_UPPER_US);
+}
+
+static void test_percentiles()
+{
+    struct latency_summary summary;
+
+    latency_histogram_reset(&histogram);
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK(summary.count == 0 && summary.p50_us == 0 && summary.p99_us == 0 && summary.max_us == 0);
+
+    // 1 to 100 us: the median is the bucket holding 50, the 99th percentile is capped at the maximum.
+    for (ULONGLONG us = 1; us <= 100; us++)
+    {
+        latency_histogram_record(&histogram, us);
+    }
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK_EQ(summary.count, 100);
+    CHECK_EQ(summary.p50_us, 55);
+    CHECK_EQ(summary.p99_us, 100);
+    CHECK_EQ(summary.max_us, 100);
+
+    // A maximum never goes down.
+    latency_histogram_record(&histogram, 3);
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK_EQ(summary.max_us, 100);
+
+    // The 99th percentile rounds up: 1% of stalls is just past it, one more falls inside.
+    latency_histogram_reset(&histogram);
+    for (INT i = 0; i < 990; i++)
+    {
+        latency_histogram_record(&histogram, 5);
+    }
+    for (INT i = 0; i < 10; i++)
+    {
+        latency_histogram_record(&histogram, 10000);
+    }
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK_EQ(summary.p50_us, 5);
+    CHECK_EQ(summary.p99_us, 5);
+
+    latency_histogram_record(&histogram, 10000);
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK_EQ(summary.count, 1001);
+    CHECK_EQ(summary.p99_us, 10000);
+    CHECK_EQ(summary.max_us, 10000);
+
+    // Too slow to count in microseconds, clamped rather than wrapped.
+    latency_histogram_record(&histogram, 0x100000000ULL);
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK_EQ(summary.max_us, 0x7FFFFFFF);
+
+    latency_histogram_reset(&histogram);
+    latency_histogram_summarize(&histogram, &summary);
+    CHECK(summary.count == 0 && summary.max_us == 0);
+}
+
+int main()
+{
+    test_buckets();
+    test_percentiles();
+    return test_result("test_latency");
+}
@@ -0,0 +1,218 @@
+/*
+ * test_loopback.c -- The whole input path end to end: replayed pads, controllers, translation and
+ * the target batch into loopback targets, with rumble going back the other way.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "mapping.h"
+#include "target.h"
+#include "target_batch.h"
+#include "test.h"
+
+#define CAPTURE_PATH TEXT("test_loopback.capture")
+
+#define REPORT_COUNT 250
+#define REPORT_INTERVAL_US 4000
+#define BATCH_WINDOW_US 10000
+// Only every third report goes to the DS4 target, as if the filter held the others back, so the
+// controller has moved on by the time a queued report is flushed.
+#define DS4_REPORT_STRIDE 3
+#define WAIT_MS 5000
+
+/*
+ * One pad feeding one target, the X360 one submitting directly and the DS4 one through the batch.
+ */
+struct pipe
+{
+    struct test_replay replay;
+    struct target *target;
+    struct target_batch_entry entry;
+    XUSB_REPORT xusb;
+    DS4_REPORT_EX ds4;
+    LONG translated;
+
+    volatile LONG rumbles;
+    BYTE small_motor;
+    BYTE big_motor;
+};
+
+static struct target_batch batch;
+
+static void report_cb(struct stadia_controller *controller, const BYTE *report, size_t length, void *context)
+{
+    struct pipe *pipe = (struct pipe *)((struct test_replay *)context)->context;
+
+    if (pipe->target->type == TARGET_TYPE_DS4)
+    {
+        if (mapping_translate_ds4(NULL, report, length, &pipe->ds4) &&
+            (REPORT_COUNT - ++pipe->translated) % DS4_REPORT_STRIDE == 0)
+        {
+            target_batch_queue_ds4(&batch, &pipe->entry, controller, &pipe->ds4);
+        }
+    }
+    else if (mapping_translate_xusb(NULL, report, length, &pipe->xusb))
+    {
+        pipe->translated++;
+        ULONGLONG submit_start = timer_now_us();
+        CHECK(target_submit_xusb(pipe->target, &pipe->xusb));
+        stadia_controller_record_submit(controller, submit_start, timer_now_us());
+    }
+}
+
+static void rumble_cb(struct target *target, BYTE small_motor, BYTE big_motor, void *context)
+{
+    struct pipe *pipe = (struct pipe *)context;
+
+    CHECK(target == pipe->target);
+    pipe->small_motor = small_motor;
+    pipe->big_motor = big_motor;
+    InterlockedIncrement(&pipe->rumbles);
+    stadia_controller_set_vibration(pipe->replay.controller, small_motor, big_motor);
+}
+
+static BOOL start_pipe(struct pipe *pipe, struct io_engine *engine, struct target_sink *sink, UINT type)
+{
+    memset(pipe, 0, sizeof(struct pipe));
+    pipe->target = target_add(sink, type);
+    CHECK(pipe->target != NULL);
+    if (pipe->target == NULL)
+    {
+        return FALSE;
+    }
+    target_batch_entry_init(&pipe->entry, pipe->target);
+    XUSB_REPORT_INIT(&pipe->xusb);
+    mapping_ds4_report_init(&pipe->ds4);
+
+    pipe->replay.subscriber.report = report_cb;
+    pipe->replay.context = pipe;
+    CHECK(test_replay_start(&pipe->replay, engine, CAPTURE_PATH, 1));
+    return pipe->replay.controller != NULL;
+}
+
+// Whether the target shows what the last report translated to, once the batch got to it.
+static BOOL shows_last_report(struct pipe *pipe, const BYTE *last)
+{
+    if (pipe->target->type == TARGET_TYPE_DS4)
+    {
+        DS4_REPORT_EX expected, shown;
+        mapping_ds4_report_init(&expected);
+        mapping_translate_ds4(NULL, last, STADIA_INPUT_REPORT_MIN_SIZE, &expected);
+        return target_loopback_get_ds4(pipe->target, &shown) > 0 &&
+               memcmp(&expected, &shown, sizeof(expected)) == 0;
+    }
+
+    XUSB_REPORT expected, shown;
+    XUSB_REPORT_INIT(&expected);
+    mapping_translate_xusb(NULL, last, STADIA_INPUT_REPORT_MIN_SIZE, &expected);
+    return target_loopback_get_xusb(pipe->target, &shown) > 0 && memcmp(&expected, &shown, sizeof(expected)) == 0;
+}
+
+/*
+ * A game asking for rumble while input flows: it reaches the controller through the target's
+ * callback, and the controller sends it to the pad.
+ */
+static void check_rumble(struct pipe *pipe, BYTE small_motor, BYTE big_motor)
+{
+    LONG sent, dropped, sent_before;
+
+    // Nothing is passed on before listening.
+    target_loopback_rumble(pipe->target, 0xFF, 0xFF);
+    CHECK_EQ(pipe->rumbles, 0);
+    CHECK(target_listen(pipe->target, rumble_cb, pipe));
+
+    stadia_controller_get_vibration_stats(pipe->replay.controller, &sent_before, &dropped);
+    target_loopback_rumble(pipe->target, small_motor, big_motor);
+    CHECK_EQ(pipe->rumbles, 1);
+    CHECK_EQ(pipe->small_motor, small_motor);
+    CHECK_EQ(pipe->big_motor, big_motor);
+
+    ULONGLONG start_us = timer_now_us();
+    do
+    {
+        usleep(1000);
+        stadia_controller_get_vibration_stats(pipe->replay.controller, &sent, &dropped);
+    } while (sent == sent_before && timer_now_us() - start_us < WAIT_MS * 1000ULL);
+    CHECK(sent > sent_before);
+}
+
+int main()
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    const BYTE *last = &reports[(REPORT_COUNT - 1) * STADIA_INPUT_REPORT_MIN_SIZE];
+    struct pipe pipes[2];
+    struct stadia_latency_summary latency;
+    INT error;
+
+    test_report_stream(reports, REPORT_COUNT, 0x100B);
+    CHECK(test_write_capture(CAPTURE_PATH, reports, REPORT_COUNT, STADIA_INPUT_REPORT_MIN_SIZE,
+                             REPORT_INTERVAL_US));
+
+    struct io_engine *engine = io_engine_create();
+    struct target_sink *sink = target_sink_connect(&target_loopback_backend, NULL, &error);
+    CHECK(engine != NULL && sink != NULL);
+    if (engine == NULL || sink == NULL)
+    {
+        return test_result("test_loopback");
+    }
+    target_batch_init(&batch, engine, BATCH_WINDOW_US);
+
+    BOOL started = start_pipe(&pipes[0], engine, sink, TARGET_TYPE_X360);
+    started = start_pipe(&pipes[1], engine, sink, TARGET_TYPE_DS4) && started;
+    if (!started)
+    {
+        return test_result("test_loopback");
+    }
+
+    // Halfway through the capture, both pads are asked to rumble.
+    usleep(REPORT_COUNT * REPORT_INTERVAL_US / 2);
+    check_rumble(&pipes[0], 0x30, 0xC0);
+    check_rumble(&pipes[1], 0xA0, 0x10);
+
+    for (INT i = 0; i < 2; i++)
+    {
+        struct pipe *pipe = &pipes[i];
+        CHECK(test_replay_wait(&pipe->replay, WAIT_MS));
+        CHECK_EQ(pipe->translated, REPORT_COUNT);
+
+        ULONGLONG start_us = timer_now_us();
+        while (!shows_last_report(pipe, last) && timer_now_us() - start_us < WAIT_MS * 1000ULL)
+        {
+            usleep(1000);
+        }
+        CHECK(shows_last_report(pipe, last));
+
+        // Every submission timed, through the batch or not.
+        stadia_controller_get_latency(pipe->replay.controller, &latency);
+        CHECK(latency.submit.count > 0);
+        CHECK_EQ(latency.submit.count, latency.total.count);
+        // Timed from the report that was queued, which waited out the whole window.
+        if (pipe->target->type == TARGET_TYPE_DS4)
+        {
+            CHECK(latency.total.p50_us >= BATCH_WINDOW_US * 3 / 4);
+        }
+        printf("test_loopback: %s target, submit p50 %ldus p99 %ldus, total p50 %ldus p99 %ldus\n",
+               pipe->target->type == TARGET_TYPE_DS4 ? "DS4" : "X360", (long)latency.submit.p50_us,
+               (long)latency.submit.p99_us, (long)latency.total.p50_us, (long)latency.total.p99_us);
+    }
+
+    // The X360 target got every report, the DS4 one every report queued the batch did not supersede.
+    XUSB_REPORT xusb;
+    DS4_REPORT_EX ds4;
+    CHECK_EQ(target_loopback_get_xusb(pipes[0].target, &xusb), REPORT_COUNT);
+    CHECK_EQ(batch.queued, (REPORT_COUNT + DS4_REPORT_STRIDE - 1) / DS4_REPORT_STRIDE);
+    CHECK_EQ(target_loopback_get_ds4(pipes[1].target, &ds4), batch.submitted);
+    CHECK(batch.submitted > 0 && batch.submitted <= batch.queued);
+
+    for (INT i = 0; i < 2; i++)
+    {
+        test_replay_free(&pipes[i].replay);
+        target_remove(pipes[i].target);
+    }
+    target_sink_disconnect(sink);
+    io_engine_destroy(engine);
+    remove(CAPTURE_PATH);
+
+    return test_result("test_loopback");
+}
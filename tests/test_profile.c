@@ -0,0 +1,345 @@
+/*
+ * test_profile.c -- Profile files, and baked profiles applied to recorded stick movements.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "capture.h"
+#include "mapping.h"
+#include "profile.h"
+#include "test.h"
+
+#define PROFILE_FILE TEXT("test_profile.ini")
+#define CAPTURE_FILE TEXT("test_profile.stcap")
+
+#define PI 3.14159265358979323846
+
+static BOOL write_file(const char *text)
+{
+    FILE *file = fopen(PROFILE_FILE, "w");
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+    fputs(text, file);
+    fclose(file);
+    return TRUE;
+}
+
+static void test_load()
+{
+    struct profile_settings settings;
+    INT line = -1;
+
+    profile_settings_init(&settings);
+    CHECK(write_file("# comment\n"
+                     "\n"
+                     "[sticks]\n"
+                     "deadzone_type = radial\n"
+                     "deadzone = 0.1\n"
+                     "  outer_deadzone=0.95  \n"
+                     "\n"
+                     "[right_stick]\n"
+                     "curve = custom\n"
+                     "points = 0.25:0.1, 0.5:0.4 0.75:0.8\n"
+                     "; comment\n"
+                     "[triggers]\n"
+                     "deadzone = 0.05\n"
+                     "[left_trigger]\n"
+                     "curve = exponential\n"
+                     "exponent = 2.5\n"
+                     "anti_deadzone = 0.2\n"));
+    CHECK(profile_settings_load(PROFILE_FILE, &settings, &line));
+
+    CHECK_EQ(settings.left_stick.deadzone_type, PROFILE_DEADZONE_RADIAL);
+    CHECK_EQ(settings.right_stick.deadzone_type, PROFILE_DEADZONE_RADIAL);
+    CHECK(settings.left_stick.deadzone == 0.1f && settings.right_stick.deadzone == 0.1f);
+    CHECK(settings.left_stick.outer_deadzone == 0.95f && settings.right_stick.outer_deadzone == 0.95f);
+    CHECK_EQ(settings.left_stick.curve.type, PROFILE_CURVE_LINEAR);
+    CHECK_EQ(settings.right_stick.curve.type, PROFILE_CURVE_CUSTOM);
+    CHECK_EQ(settings.right_stick.curve.point_count, 3);
+    CHECK(settings.right_stick.curve.points_x[1] == 0.5f && settings.right_stick.curve.points_y[2] == 0.8f);
+    CHECK(settings.left_trigger.deadzone == 0.05f && settings.right_trigger.deadzone == 0.05f);
+    CHECK_EQ(settings.left_trigger.curve.type, PROFILE_CURVE_EXPONENTIAL);
+    CHECK(settings.left_trigger.curve.exponent == 2.5f && settings.left_trigger.anti_deadzone == 0.2f);
+    CHECK_EQ(settings.right_trigger.curve.type, PROFILE_CURVE_LINEAR);
+
+    // Keys not in the file keep their value.
+    CHECK(write_file("[left_stick]\ndeadzone_type = axial\n"));
+    CHECK(profile_settings_load(PROFILE_FILE, &settings, &line));
+    CHECK_EQ(settings.left_stick.deadzone_type, PROFILE_DEADZONE_AXIAL);
+    CHECK(settings.left_stick.deadzone == 0.1f);
+}
+
+static void test_load_errors()
+{
+    static const struct
+    {
+        const char *text;
+        INT line;
+    } bad[] = {
+        {"deadzone = 0.1\n", 1},
+        {"[sticks]\n\ndeadzone = 1.5\n", 3},
+        {"[sticks]\ndeadzone 0.1\n", 2},
+        {"[pedals]\ndeadzone = 0.1\n", 1},
+        {"[sticks]\nsensitivity = 2\n", 2},
+        {"[triggers]\ndeadzone_type = radial\n", 2},
+        {"[sticks]\ncurve = cubic\n", 2},
+        {"[sticks]\nexponent = 0\n", 2},
+        {"[sticks]\npoints = 0.5:0.5 0.25:0.75\n", 2},
+        {"[sticks]\npoints = 0.1:0.1 0.2:0.2 0.3:0.3 0.4:0.4 0.5:0.5 0.6:0.6 0.7:0.7 0.8:0.8 0.9:0.9\n", 2},
+        {"[sticks]\ndeadzone = 0.1 # no trailing comments\n", 2},
+    };
+    struct profile_settings settings, defaults;
+    INT line;
+
+    profile_settings_init(&defaults);
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        profile_settings_init(&settings);
+        CHECK(write_file(bad[i].text));
+        CHECK(!profile_settings_load(PROFILE_FILE, &settings, &line));
+        CHECK_EQ(line, bad[i].line);
+        CHECK(memcmp(&settings, &defaults, sizeof(settings)) == 0);
+    }
+
+    // Nothing is applied from a file that fails further down.
+    profile_settings_init(&settings);
+    CHECK(write_file("[sticks]\ndeadzone = 0.2\n[triggers]\noops\n"));
+    CHECK(!profile_settings_load(PROFILE_FILE, &settings, &line));
+    CHECK_EQ(line, 4);
+    CHECK(settings.left_stick.deadzone == 0.0f);
+
+    char long_line[400];
+    memset(long_line, ' ', sizeof(long_line));
+    memcpy(long_line, "[sticks]\n", 9);
+    memcpy(&long_line[sizeof(long_line) - 16], "deadzone = 0.1\n", 16);
+    CHECK(write_file(long_line));
+    CHECK(!profile_settings_load(PROFILE_FILE, &settings, &line));
+    CHECK_EQ(line, 2);
+
+    remove(PROFILE_FILE);
+    CHECK(!profile_settings_load(PROFILE_FILE, &settings, &line));
+    CHECK_EQ(line, 0);
+}
+
+/*
+ * Records stick movements as input reports: resting with sensor noise, a slow full circle, the left
+ * stick pushed out along a diagonal, and the triggers pulled through their range.
+ */
+static INT record_sticks()
+{
+    struct capture_writer *writer = capture_writer_open(CAPTURE_FILE, TRUE);
+    BYTE report[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8};
+    DWORD seed = 0x571C;
+    ULONGLONG time_us = 0;
+    INT count = 0;
+
+    if (writer == NULL)
+    {
+        return 0;
+    }
+
+    for (INT i = 0; i < 500; i++, count++)
+    {
+        DWORD r = test_random(&seed);
+        report[4] = (BYTE)(128 + (INT)(r & 7) - 3);
+        report[5] = (BYTE)(128 + (INT)((r >> 3) & 7) - 3);
+        report[6] = (BYTE)(128 + (INT)((r >> 6) & 7) - 3);
+        report[7] = (BYTE)(128 + (INT)((r >> 9) & 7) - 3);
+        capture_writer_write(writer, time_us += 4000, report, sizeof(report));
+    }
+    for (INT i = 0; i < 720; i++, count++)
+    {
+        double angle = i * PI / 360.0;
+        report[4] = report[6] = (BYTE)lround(128.0 + 127.0 * cos(angle));
+        report[5] = report[7] = (BYTE)lround(128.0 + 127.0 * sin(angle));
+        capture_writer_write(writer, time_us += 4000, report, sizeof(report));
+    }
+    for (INT i = 0; i <= 127; i++, count++)
+    {
+        report[4] = (BYTE)(128 + i);
+        report[5] = (BYTE)(128 - i);
+        report[6] = report[7] = 128;
+        report[8] = (BYTE)(i * 2);
+        report[9] = (BYTE)(255 - i * 2);
+        capture_writer_write(writer, time_us += 4000, report, sizeof(report));
+    }
+
+    capture_writer_close(writer);
+    return count;
+}
+
+static double stick_magnitude(BYTE x, BYTE y)
+{
+    double nx = ((INT)x - 128 < -127 ? -127 : (INT)x - 128) / 127.0;
+    double ny = ((INT)y - 128 < -127 ? -127 : (INT)y - 128) / 127.0;
+    return sqrt(nx * nx + ny * ny);
+}
+
+static double report_magnitude(SHORT x, SHORT y)
+{
+    return sqrt((double)x * x + (double)y * y) / 32767.0;
+}
+
+/*
+ * Replays the recording through the profile and checks every translated report.
+ */
+static void check_recording(const struct profile_settings *settings, INT expected_count)
+{
+    struct mapping_profile *profile = mapping_profile_create(settings);
+    struct capture_reader *reader = capture_reader_open(CAPTURE_FILE);
+    const struct response_settings *stick = &settings->left_stick;
+    BYTE report[CAPTURE_MAX_REPORT_SIZE];
+    ULONGLONG timestamp_us;
+    INT length, count = 0;
+
+    CHECK(profile != NULL && reader != NULL);
+    if (profile == NULL || reader == NULL)
+    {
+        return;
+    }
+
+    while ((length = capture_reader_next(reader, &timestamp_us, report, sizeof(report))) >= 0)
+    {
+        XUSB_REPORT linear, shaped;
+        count++;
+        CHECK(mapping_translate_xusb(NULL, report, length, &linear));
+        CHECK(mapping_translate_xusb(profile, report, length, &shaped));
+
+        double in = stick_magnitude(report[4], report[5]);
+        double out = report_magnitude(shaped.sThumbLX, shaped.sThumbLY);
+
+        if (stick->deadzone_type == PROFILE_DEADZONE_RADIAL)
+        {
+            if (in <= stick->deadzone)
+            {
+                CHECK(shaped.sThumbLX == 0 && shaped.sThumbLY == 0);
+            }
+            else
+            {
+                // Pointing the same way as the stick, at least the anti-deadzone away from the centre.
+                CHECK(out >= stick->anti_deadzone - 0.001);
+                CHECK((double)shaped.sThumbLX * linear.sThumbLX >= 0 && (double)shaped.sThumbLY * linear.sThumbLY >= 0);
+                double cross = (double)shaped.sThumbLX * linear.sThumbLY - (double)shaped.sThumbLY * linear.sThumbLX;
+                CHECK(fabs(cross) / (32767.0 * 32767.0 * out * report_magnitude(linear.sThumbLX, linear.sThumbLY)) <
+                      0.01);
+            }
+            if (in >= stick->outer_deadzone)
+            {
+                CHECK(out > 0.999 && out < 1.001);
+            }
+        }
+        else if (stick->deadzone_type == PROFILE_DEADZONE_AXIAL)
+        {
+            if (fabs(linear.sThumbLX / 32767.0) <= stick->deadzone)
+            {
+                CHECK_EQ(shaped.sThumbLX, 0);
+            }
+            if (fabs(linear.sThumbLY / 32767.0) <= stick->deadzone)
+            {
+                CHECK_EQ(shaped.sThumbLY, 0);
+            }
+        }
+
+        // Triggers never go down while pulled further.
+        CHECK(settings->left_trigger.deadzone <= 0.0f || report[8] > 255 * settings->left_trigger.deadzone ||
+              shaped.bLeftTrigger == 0);
+    }
+
+    CHECK_EQ(count, expected_count);
+    capture_reader_close(reader);
+    mapping_profile_free(profile);
+}
+
+static void test_recorded_sticks()
+{
+    struct profile_settings settings;
+    INT count = record_sticks();
+    CHECK(count > 0);
+
+    // Defaults are linear and translate exactly like no profile at all.
+    profile_settings_init(&settings);
+    struct mapping_profile *profile = mapping_profile_create(&settings);
+    CHECK(profile != NULL && profile->linear);
+    mapping_profile_free(profile);
+    check_recording(&settings, count);
+
+    profile_settings_init(&settings);
+    settings.left_stick.deadzone_type = PROFILE_DEADZONE_RADIAL;
+    settings.left_stick.deadzone = 0.1f;
+    check_recording(&settings, count);
+
+    settings.left_stick.outer_deadzone = 0.9f;
+    settings.left_stick.anti_deadzone = 0.15f;
+    settings.left_trigger.deadzone = 0.1f;
+    check_recording(&settings, count);
+
+    profile_settings_init(&settings);
+    settings.left_stick.deadzone_type = PROFILE_DEADZONE_AXIAL;
+    settings.left_stick.deadzone = 0.2f;
+    settings.left_stick.curve.type = PROFILE_CURVE_EXPONENTIAL;
+    settings.left_stick.curve.exponent = 2.0f;
+    check_recording(&settings, count);
+
+    remove(CAPTURE_FILE);
+}
+
+static void test_tables()
+{
+    struct profile_settings settings;
+
+    profile_settings_init(&settings);
+    settings.left_stick.deadzone_type = PROFILE_DEADZONE_AXIAL;
+    settings.left_stick.curve.type = PROFILE_CURVE_EXPONENTIAL;
+    settings.left_stick.curve.exponent = 2.0f;
+    settings.right_stick.curve.type = PROFILE_CURVE_CUSTOM;
+    settings.right_stick.curve.point_count = 1;
+    settings.right_stick.curve.points_x[0] = 0.5f;
+    settings.right_stick.curve.points_y[0] = 0.2f;
+    settings.left_trigger.deadzone = 0.1f;
+    settings.right_trigger.anti_deadzone = 0.2f;
+
+    struct mapping_profile *profile = mapping_profile_create(&settings);
+    CHECK(profile != NULL && !profile->linear);
+    if (profile == NULL)
+    {
+        return;
+    }
+
+    // Both ends and the centre stay where they were, and every table is monotonic.
+    CHECK_EQ(profile->left_stick.x[128], 0);
+    CHECK_EQ(profile->left_stick.x[255], 32767);
+    CHECK_EQ(profile->left_stick.x[0], -32767);
+    CHECK_EQ(profile->left_stick.y[0], 32767);
+    for (INT v = 1; v < 256; v++)
+    {
+        CHECK(profile->left_stick.x[v] >= profile->left_stick.x[v - 1]);
+        CHECK(profile->left_stick.y[v] <= profile->left_stick.y[v - 1]);
+        CHECK(profile->right_stick.x[v] >= profile->right_stick.x[v - 1]);
+        CHECK(profile->left_trigger[v] >= profile->left_trigger[v - 1]);
+        CHECK(profile->right_trigger[v] >= profile->right_trigger[v - 1]);
+    }
+
+    // A quarter half way out with the square curve, either side of the point on the custom one.
+    CHECK(abs(profile->left_stick.x[128 + 64] - (INT)(32767.0 * 0.25 * (64.0 / 127) / 0.5 * (64.0 / 127) / 0.5)) < 64);
+    CHECK(abs(profile->right_stick.x[128 + 32] - (INT)(32767.0 * 0.2 * (32.0 / 127) / 0.5)) < 64);
+    CHECK(abs(profile->right_stick.x[128 + 96] - (INT)(32767.0 * (0.2 + 0.8 * ((96.0 / 127) - 0.5) / 0.5))) < 64);
+
+    CHECK_EQ(profile->left_trigger[25], 0);
+    CHECK_EQ(profile->left_trigger[255], 255);
+    CHECK_EQ(profile->right_trigger[0], 0);
+    CHECK(profile->right_trigger[1] >= 51);
+
+    mapping_profile_free(profile);
+}
+
+int main()
+{
+    test_load();
+    test_load_errors();
+    test_tables();
+    test_recorded_sticks();
+    return test_result("test_profile");
+}
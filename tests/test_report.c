@@ -0,0 +1,125 @@
+/*
+ * test_report.c -- Decoding of Stadia controller input reports.
+ */
+
+#include <string.h>
+
+#include "report.h"
+#include "test.h"
+
+static void test_rejects_bad_reports()
+{
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8, 0xFF, 0xFF, 1, 2, 3, 4, 5, 6};
+    struct stadia_state state;
+
+    for (size_t len = 0; len < STADIA_INPUT_REPORT_MIN_SIZE; len++)
+    {
+        memset(&state, 0xAB, sizeof(state));
+        CHECK(!stadia_decode_report(buf, len, &state));
+        CHECK_EQ(state.buttons, 0xABABABAB);
+        CHECK_EQ(state.left_stick_x, 0xAB);
+    }
+
+    buf[0] = 0x01;
+    memset(&state, 0xAB, sizeof(state));
+    CHECK(!stadia_decode_report(buf, sizeof(buf), &state));
+    CHECK_EQ(state.right_trigger, 0xAB);
+}
+
+static void test_axes()
+{
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8, 0, 0, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60};
+    struct stadia_state state;
+
+    CHECK(stadia_decode_report(buf, sizeof(buf), &state));
+    CHECK_EQ(state.buttons, STADIA_BUTTON_NONE);
+    CHECK_EQ(state.left_stick_x, 0x10);
+    CHECK_EQ(state.left_stick_y, 0x20);
+    CHECK_EQ(state.right_stick_x, 0x30);
+    CHECK_EQ(state.right_stick_y, 0x40);
+    CHECK_EQ(state.left_trigger, 0x50);
+    CHECK_EQ(state.right_trigger, 0x60);
+}
+
+static void test_dpad()
+{
+    static const DWORD expected[9] = {
+        STADIA_BUTTON_UP,
+        STADIA_BUTTON_UP | STADIA_BUTTON_RIGHT,
+        STADIA_BUTTON_RIGHT,
+        STADIA_BUTTON_RIGHT | STADIA_BUTTON_DOWN,
+        STADIA_BUTTON_DOWN,
+        STADIA_BUTTON_DOWN | STADIA_BUTTON_LEFT,
+        STADIA_BUTTON_LEFT,
+        STADIA_BUTTON_LEFT | STADIA_BUTTON_UP,
+        STADIA_BUTTON_NONE};
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID};
+    struct stadia_state state;
+
+    for (INT hat = 0; hat < 256; hat++)
+    {
+        buf[1] = (BYTE)hat;
+        CHECK(stadia_decode_report(buf, sizeof(buf), &state));
+        CHECK_EQ(state.buttons, hat < 9 ? expected[hat] : STADIA_BUTTON_NONE);
+    }
+}
+
+static void test_buttons()
+{
+    static const struct
+    {
+        INT byte;
+        BYTE mask;
+        DWORD button;
+    } bits[] = {
+        {2, 1 << 7, STADIA_BUTTON_RS},
+        {2, 1 << 6, STADIA_BUTTON_OPTIONS},
+        {2, 1 << 5, STADIA_BUTTON_MENU},
+        {2, 1 << 4, STADIA_BUTTON_STADIA_BTN},
+        {3, 1 << 6, STADIA_BUTTON_A},
+        {3, 1 << 5, STADIA_BUTTON_B},
+        {3, 1 << 4, STADIA_BUTTON_X},
+        {3, 1 << 3, STADIA_BUTTON_Y},
+        {3, 1 << 2, STADIA_BUTTON_LB},
+        {3, 1 << 1, STADIA_BUTTON_RB},
+        {3, 1 << 0, STADIA_BUTTON_LS},
+    };
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE] = {STADIA_INPUT_REPORT_ID, 8};
+    struct stadia_state state;
+    DWORD all = 0;
+
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+    {
+        buf[2] = buf[3] = 0;
+        buf[bits[i].byte] = bits[i].mask;
+        CHECK(stadia_decode_report(buf, sizeof(buf), &state));
+        CHECK_EQ(state.buttons, bits[i].button);
+        all |= bits[i].button;
+    }
+
+    // Every bit set, including the ones that carry no button (e.g. the trigger clicks in byte 2).
+    buf[2] = buf[3] = 0xFF;
+    CHECK(stadia_decode_report(buf, sizeof(buf), &state));
+    CHECK_EQ(state.buttons, all);
+}
+
+static void test_longer_report()
+{
+    // Bluetooth reports carry more than the decoder looks at.
+    BYTE buf[STADIA_INPUT_REPORT_MIN_SIZE + 6] = {STADIA_INPUT_REPORT_ID, 2, 0, 1 << 6, 128, 128, 128, 128, 0, 255};
+    struct stadia_state state;
+
+    CHECK(stadia_decode_report(buf, sizeof(buf), &state));
+    CHECK_EQ(state.buttons, STADIA_BUTTON_RIGHT | STADIA_BUTTON_A);
+    CHECK_EQ(state.right_trigger, 255);
+}
+
+int main()
+{
+    test_rejects_bad_reports();
+    test_axes();
+    test_dpad();
+    test_buttons();
+    test_longer_report();
+    return test_result("test_report");
+}
@@ -0,0 +1,243 @@
+/*
+ * test_seqlock.c -- Snapshots taken from other threads while a writer keeps changing the data: of a
+ * payload wide enough for unprotected copies to tear, then of a controller's state as reports
+ * stream in.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "seqlock.h"
+#include "test.h"
+
+#define CAPTURE_FILE TEXT("test_seqlock.stcap")
+
+#define REPORT_COUNT 100000
+#define READER_COUNT 4
+
+#define PAYLOAD_SIZE 32
+#define PAYLOAD_WRITES 2000000
+
+struct payload
+{
+    LONG words[PAYLOAD_SIZE];
+};
+
+static volatile LONG payload_sequence;
+static struct payload payload;
+static volatile LONG writer_done;
+
+struct payload_reader
+{
+    pthread_t thread;
+    BOOL locked;
+    LONGLONG snapshots;
+    LONGLONG torn;
+};
+
+static BOOL is_torn(const struct payload *copy)
+{
+    for (INT i = 1; i < PAYLOAD_SIZE; i++)
+    {
+        if (copy->words[i] != copy->words[0])
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void *payload_writer_thread(void *arg)
+{
+    (void)arg;
+
+    for (LONG value = 1; value <= PAYLOAD_WRITES; value++)
+    {
+        seqlock_write_begin(&payload_sequence);
+        for (INT i = 0; i < PAYLOAD_SIZE; i++)
+        {
+            ((volatile LONG *)payload.words)[i] = value;
+        }
+        seqlock_write_end(&payload_sequence);
+    }
+    InterlockedExchange(&writer_done, TRUE);
+    return NULL;
+}
+
+static void *payload_reader_thread(void *arg)
+{
+    struct payload_reader *reader = (struct payload_reader *)arg;
+    struct payload copy;
+
+    while (!InterlockedCompareExchange(&writer_done, 0, 0))
+    {
+        if (reader->locked)
+        {
+            LONG sequence;
+            do
+            {
+                sequence = seqlock_read_begin(&payload_sequence);
+                copy = payload;
+            } while (seqlock_read_retry(&payload_sequence, sequence));
+        }
+        else
+        {
+            copy = *(volatile struct payload *)&payload;
+        }
+        reader->snapshots++;
+        reader->torn += is_torn(&copy);
+    }
+    return NULL;
+}
+
+static void test_payload()
+{
+    static struct payload_reader readers[READER_COUNT];
+    pthread_t writer;
+
+    // Half the readers go through the lock, the others copy as is to show that tearing happens.
+    for (INT i = 0; i < READER_COUNT; i++)
+    {
+        readers[i].locked = i % 2 == 0;
+        CHECK(pthread_create(&readers[i].thread, NULL, payload_reader_thread, &readers[i]) == 0);
+    }
+    CHECK(pthread_create(&writer, NULL, payload_writer_thread, NULL) == 0);
+    pthread_join(writer, NULL);
+
+    LONGLONG unlocked_torn = 0;
+    for (INT i = 0; i < READER_COUNT; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+        CHECK(readers[i].snapshots > 0);
+        if (readers[i].locked)
+        {
+            CHECK_EQ(readers[i].torn, 0);
+        }
+        else
+        {
+            unlocked_torn += readers[i].torn;
+        }
+    }
+    printf("test_seqlock: %d writes, %lld torn copies without the lock\n", PAYLOAD_WRITES, (long long)unlocked_torn);
+
+    // Only likely with the writer and a reader on separate cores.
+    if (sysconf(_SC_NPROCESSORS_ONLN) >= 2)
+    {
+        CHECK(unlocked_torn > 0);
+    }
+}
+
+// A report is decoded from all of its bytes being the same value, so a torn copy mixes two values.
+static struct stadia_state expected[256];
+static volatile LONG replay_done;
+
+struct reader
+{
+    pthread_t thread;
+    struct stadia_controller *controller;
+    LONGLONG snapshots;
+    LONGLONG torn;
+};
+
+static BYTE report_value(INT i)
+{
+    return (BYTE)(i * 37 + 1);
+}
+
+static BOOL is_consistent(const struct stadia_state *state)
+{
+    const struct stadia_state *reference = &expected[state->left_stick_x];
+    return state->buttons == reference->buttons && state->left_stick_y == reference->left_stick_y &&
+           state->right_stick_x == reference->right_stick_x && state->right_stick_y == reference->right_stick_y &&
+           state->left_trigger == reference->left_trigger && state->right_trigger == reference->right_trigger;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct reader *reader = (struct reader *)arg;
+    struct stadia_state state;
+
+    while (!InterlockedCompareExchange(&replay_done, 0, 0))
+    {
+        stadia_controller_get_state(reader->controller, &state);
+        reader->snapshots++;
+        // The initial state is all zeroes, which no report decodes to.
+        if (state.left_stick_x != 0 && !is_consistent(&state))
+        {
+            reader->torn++;
+        }
+    }
+    return NULL;
+}
+
+static void state_update_cb(struct stadia_controller *controller, const struct stadia_state *state, void *context)
+{
+    (void)controller;
+    (void)state;
+    (void)context;
+}
+
+static void test_controller_state()
+{
+    static BYTE reports[REPORT_COUNT * STADIA_INPUT_REPORT_MIN_SIZE];
+    static struct reader readers[READER_COUNT];
+    struct test_replay replay;
+
+    for (INT value = 0; value < 256; value++)
+    {
+        BYTE report[STADIA_INPUT_REPORT_MIN_SIZE];
+        memset(report, value, sizeof(report));
+        report[0] = STADIA_INPUT_REPORT_ID;
+        stadia_decode_report(report, sizeof(report), &expected[value]);
+    }
+    for (INT i = 0; i < REPORT_COUNT; i++)
+    {
+        memset(&reports[i * STADIA_INPUT_REPORT_MIN_SIZE], report_value(i), STADIA_INPUT_REPORT_MIN_SIZE);
+        reports[i * STADIA_INPUT_REPORT_MIN_SIZE] = STADIA_INPUT_REPORT_ID;
+    }
+    CHECK(test_write_capture(CAPTURE_FILE, reports, REPORT_COUNT, STADIA_INPUT_REPORT_MIN_SIZE, 1000));
+
+    struct io_engine *engine = io_engine_create();
+    memset(&replay, 0, sizeof(replay));
+    replay.subscriber.update = state_update_cb;
+    CHECK(engine != NULL && test_replay_start(&replay, engine, CAPTURE_FILE, 0));
+    if (engine == NULL || replay.controller == NULL)
+    {
+        return;
+    }
+
+    for (INT i = 0; i < READER_COUNT; i++)
+    {
+        readers[i].controller = replay.controller;
+        CHECK(pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]) == 0);
+    }
+
+    CHECK(test_replay_wait(&replay, 60000));
+    InterlockedExchange(&replay_done, TRUE);
+
+    LONGLONG snapshots = 0;
+    for (INT i = 0; i < READER_COUNT; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+        CHECK_EQ(readers[i].torn, 0);
+        CHECK(readers[i].snapshots > 0);
+        snapshots += readers[i].snapshots;
+    }
+    printf("test_seqlock: %d reports, %lld snapshots\n", REPORT_COUNT, (long long)snapshots);
+
+    // Once stopped, the state is the last report's.
+    struct stadia_state state;
+    stadia_controller_get_state(replay.controller, &state);
+    CHECK(memcmp(&state, &expected[report_value(REPORT_COUNT - 1)], sizeof(state)) == 0);
+
+    test_replay_free(&replay);
+    io_engine_destroy(engine);
+    remove(CAPTURE_FILE);
+}
+
+int main()
+{
+    test_payload();
+    test_controller_state();
+    return test_result("test_seqlock");
+}
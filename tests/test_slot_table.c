@@ -0,0 +1,309 @@
+/*
+ * test_slot_table.c -- Slot reuse and stale handles, against a model and then under hotplug threads
+ * racing input threads, the way stadia-vigem shares its device table.
+ */
+
+#include <pthread.h>
+
+#include "slot_table.h"
+#include "test.h"
+
+#define MODEL_LIMIT 300
+#define MODEL_OPERATIONS 50000
+
+#define STRESS_LIMIT 256
+#define HOTPLUG_THREADS 2
+#define INPUT_THREADS 3
+#define HOTPLUG_OPERATIONS 100000
+#define MAX_OWNED 300
+#define RECENT_HANDLES 64
+
+#define DEVICE_MAGIC 0x5AD1A
+
+static void test_reuse()
+{
+    struct slot_table table;
+    int a, b;
+
+    CHECK(!slot_table_init(&table, 1, 0));
+    CHECK(!slot_table_init(&table, 1, SLOT_TABLE_MAX_LIMIT + 1));
+    CHECK(slot_table_init(&table, 1, 2));
+
+    // A freed slot comes back under a new generation, and the old handle is stale for good.
+    DWORD first = slot_table_add(&table, &a);
+    CHECK(first != SLOT_TABLE_INVALID_HANDLE);
+    CHECK(slot_table_remove(&table, first) == &a);
+    DWORD second = slot_table_add(&table, &b);
+    CHECK_EQ(SLOT_TABLE_INDEX(second), SLOT_TABLE_INDEX(first));
+    CHECK(second != first);
+    CHECK(slot_table_get(&table, first) == NULL);
+    CHECK(slot_table_remove(&table, first) == NULL);
+    CHECK(slot_table_get(&table, second) == &b);
+    CHECK_EQ(table.used, 1);
+
+    // Growing to the limit and no further.
+    DWORD third = slot_table_add(&table, &a);
+    CHECK(third != SLOT_TABLE_INVALID_HANDLE);
+    CHECK_EQ(slot_table_add(&table, &a), SLOT_TABLE_INVALID_HANDLE);
+    CHECK_EQ(table.capacity, 2);
+
+    // Generations skip 0 when they wrap, so the handle never reads as invalid, and a handle only
+    // comes back after every other generation has been through the slot.
+    DWORD handle = second;
+    for (LONG i = 0; i < 0xFFFF; i++)
+    {
+        CHECK(slot_table_remove(&table, handle) != NULL);
+        DWORD next = slot_table_add(&table, &b);
+        CHECK(next != SLOT_TABLE_INVALID_HANDLE && (next >> 16) != 0);
+        CHECK_EQ(SLOT_TABLE_INDEX(next), SLOT_TABLE_INDEX(second));
+        CHECK(i == 0xFFFE ? next == second : next != second);
+        handle = next;
+    }
+    CHECK(slot_table_get(&table, third) == &a);
+    CHECK(slot_table_get(&table, SLOT_TABLE_INVALID_HANDLE) == NULL);
+    CHECK(slot_table_get(&table, 0xFFFF0000 | 3) == NULL);
+
+    slot_table_free(&table);
+}
+
+/*
+ * Random adds and removes against a plain list of what should be in the table.
+ */
+static void test_model()
+{
+    static int values[MODEL_LIMIT];
+    static DWORD live[MODEL_LIMIT];
+    static DWORD stale[MODEL_OPERATIONS];
+    struct slot_table table;
+    INT live_count = 0, stale_count = 0;
+    DWORD seed = 0x5107;
+
+    CHECK(slot_table_init(&table, 4, MODEL_LIMIT));
+    for (INT op = 0; op < MODEL_OPERATIONS; op++)
+    {
+        DWORD r = test_random(&seed);
+        // Drifts between empty and full, so both ends get exercised.
+        BOOL add = (op / 5000) % 2 == 0 ? r % 8 < 5 : r % 8 < 3;
+
+        if (add)
+        {
+            DWORD handle = slot_table_add(&table, &values[live_count]);
+            if (live_count == MODEL_LIMIT)
+            {
+                CHECK_EQ(handle, SLOT_TABLE_INVALID_HANDLE);
+                continue;
+            }
+            CHECK(handle != SLOT_TABLE_INVALID_HANDLE);
+            live[live_count++] = handle;
+        }
+        else if (live_count > 0)
+        {
+            INT i = (INT)((r >> 8) % live_count);
+            CHECK(slot_table_remove(&table, live[i]) != NULL);
+            stale[stale_count++] = live[i];
+            live[i] = live[--live_count];
+        }
+
+        CHECK_EQ(table.count, live_count);
+        CHECK(table.used <= MODEL_LIMIT);
+        if (op % 97 == 0)
+        {
+            INT seen = 0;
+            for (INT i = 0; i < slot_table_end(&table); i++)
+            {
+                seen += slot_table_at(&table, i) != NULL;
+            }
+            CHECK_EQ(seen, live_count);
+            for (INT i = 0; i < live_count; i++)
+            {
+                CHECK(slot_table_get(&table, live[i]) != NULL);
+            }
+            for (INT i = 0; i < stale_count; i++)
+            {
+                CHECK(slot_table_get(&table, stale[i]) == NULL);
+            }
+        }
+    }
+    CHECK(stale_count > MODEL_LIMIT);
+
+    slot_table_free(&table);
+}
+
+/*
+ * Devices are reference counted like stadia-vigem's active devices: the table holds one reference,
+ * and an input thread takes another under the shared lock before using the device outside it.
+ */
+struct mock_device
+{
+    volatile LONG refs;
+    DWORD handle;
+    volatile LONG magic;
+    volatile LONG reports;
+};
+
+static struct slot_table devices;
+static SRWLOCK devices_lock = SRWLOCK_INIT;
+
+// Handles of plugged in devices, many of them stale by the time an input thread tries them.
+static volatile LONG recent[RECENT_HANDLES];
+static volatile LONG recent_next;
+static volatile LONG hotplug_running;
+
+static volatile LONG added;
+static volatile LONG limit_hits;
+static volatile LONG reports_delivered;
+static volatile LONG stale_lookups;
+
+static void release_device(struct mock_device *device)
+{
+    if (InterlockedDecrement(&device->refs) == 0)
+    {
+        device->magic = 0;
+        free(device);
+    }
+}
+
+static void *hotplug_thread(void *arg)
+{
+    struct mock_device *owned[MAX_OWNED];
+    INT owned_count = 0;
+    DWORD seed = (DWORD)(size_t)arg;
+
+    for (INT op = 0; op < HOTPLUG_OPERATIONS; op++)
+    {
+        DWORD r = test_random(&seed);
+        // Filling up overshoots the limit even for one thread alone, then everything drains.
+        BOOL add = (op / 1000) % 2 == 0 ? r % 4 != 0 : r % 4 == 0;
+
+        if (add && owned_count < MAX_OWNED)
+        {
+            struct mock_device *device = (struct mock_device *)malloc(sizeof(struct mock_device));
+            device->refs = 1;
+            device->magic = DEVICE_MAGIC;
+            device->reports = 0;
+
+            AcquireSRWLockExclusive(&devices_lock);
+            device->handle = slot_table_add(&devices, device);
+            if (device->handle == SLOT_TABLE_INVALID_HANDLE)
+            {
+                CHECK_EQ(devices.count, STRESS_LIMIT);
+            }
+            ReleaseSRWLockExclusive(&devices_lock);
+
+            if (device->handle == SLOT_TABLE_INVALID_HANDLE)
+            {
+                InterlockedIncrement(&limit_hits);
+                free(device);
+                continue;
+            }
+            InterlockedIncrement(&added);
+            owned[owned_count++] = device;
+        }
+        else if (!add && owned_count > 0)
+        {
+            INT i = (INT)((r >> 8) % owned_count);
+            struct mock_device *device = owned[i];
+            owned[i] = owned[--owned_count];
+
+            AcquireSRWLockExclusive(&devices_lock);
+            CHECK(slot_table_remove(&devices, device->handle) == device);
+            CHECK(slot_table_get(&devices, device->handle) == NULL);
+            ReleaseSRWLockExclusive(&devices_lock);
+            release_device(device);
+        }
+
+        // Input keeps coming from whatever is plugged in, so lookups race every remove.
+        if (owned_count > 0)
+        {
+            LONG slot = InterlockedIncrement(&recent_next) % RECENT_HANDLES;
+            InterlockedExchange(&recent[slot], (LONG)owned[(r >> 16) % owned_count]->handle);
+        }
+    }
+
+    while (owned_count > 0)
+    {
+        struct mock_device *device = owned[--owned_count];
+        AcquireSRWLockExclusive(&devices_lock);
+        CHECK(slot_table_remove(&devices, device->handle) == device);
+        ReleaseSRWLockExclusive(&devices_lock);
+        release_device(device);
+    }
+    return NULL;
+}
+
+static void *input_thread(void *arg)
+{
+    DWORD seed = (DWORD)(size_t)arg;
+
+    while (InterlockedCompareExchange(&hotplug_running, 0, 0) != 0)
+    {
+        DWORD handle = (DWORD)recent[test_random(&seed) % RECENT_HANDLES];
+
+        AcquireSRWLockShared(&devices_lock);
+        struct mock_device *device = (struct mock_device *)slot_table_get(&devices, handle);
+        if (device != NULL)
+        {
+            // Never the device that took the slot over.
+            CHECK_EQ(device->handle, handle);
+            InterlockedIncrement(&device->refs);
+        }
+        ReleaseSRWLockShared(&devices_lock);
+
+        if (device == NULL)
+        {
+            InterlockedIncrement(&stale_lookups);
+            continue;
+        }
+        CHECK_EQ(device->magic, DEVICE_MAGIC);
+        InterlockedIncrement(&device->reports);
+        InterlockedIncrement(&reports_delivered);
+        release_device(device);
+    }
+    return NULL;
+}
+
+static void test_stress()
+{
+    pthread_t hotplug[HOTPLUG_THREADS], input[INPUT_THREADS];
+
+    CHECK(slot_table_init(&devices, 4, STRESS_LIMIT));
+    hotplug_running = HOTPLUG_THREADS;
+    for (INT i = 0; i < INPUT_THREADS; i++)
+    {
+        pthread_create(&input[i], NULL, input_thread, (void *)(size_t)(0x1000 + i));
+    }
+    for (INT i = 0; i < HOTPLUG_THREADS; i++)
+    {
+        pthread_create(&hotplug[i], NULL, hotplug_thread, (void *)(size_t)(0x2000 + i));
+    }
+
+    for (INT i = 0; i < HOTPLUG_THREADS; i++)
+    {
+        pthread_join(hotplug[i], NULL);
+    }
+    InterlockedExchange(&hotplug_running, 0);
+    for (INT i = 0; i < INPUT_THREADS; i++)
+    {
+        pthread_join(input[i], NULL);
+    }
+
+    // Hundreds of devices at once, past the limit, and plenty of lookups on either side.
+    printf("test_slot_table: %ld devices added, %ld refused at the limit, %ld reports, %ld stale lookups\n",
+           (long)added, (long)limit_hits, (long)reports_delivered, (long)stale_lookups);
+    CHECK(devices.used > STRESS_LIMIT / 2);
+    CHECK(limit_hits > 0);
+    CHECK(reports_delivered > 0);
+    CHECK(stale_lookups > 0);
+    CHECK_EQ(devices.count, 0);
+    CHECK(devices.used <= STRESS_LIMIT);
+
+    slot_table_free(&devices);
+}
+
+int main()
+{
+    test_reuse();
+    test_model();
+    test_stress();
+    return test_result("test_slot_table");
+}